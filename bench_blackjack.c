@@ -0,0 +1,1799 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "rankings.h"
+#include "stats.h"
+#include "logger.h"
+#include "discovery.h"
+#include "protocol.h"
+#include "engine.h"
+#include "record.h"
+#include "timer.h"
+
+#define PORT 12951
+#define MAXLINE 1024
+#define MAX_EVENTS 256
+#define DISCOVER_TIMEOUT 10     // seconds
+#define TIMER_TICK_MS 10        // as the server's wheels
+
+// Log-linear latency histogram: 16 linear sub-buckets per power of two,
+// so every recorded value is kept to within ~6%.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+typedef enum {
+    PROMPT_NAME,
+    PROMPT_MENU,
+    PROMPT_HIT,
+    PROMPT_ACE,
+    PROMPT_KINDS
+} PROMPT_KIND;
+
+static const char *prompt_names[PROMPT_KINDS] = { "name", "menu", "hit", "ace" };
+
+typedef struct {
+    int         fd;
+    int         id;
+    int         connected;
+    int         greeted;
+    int         in_game;
+    int         hands;
+    int         score;
+    uint64_t    sent_at;    // when our last answer left, 0 before the first one
+    uint64_t    play_at;    // when we chose to play, until the hand's first prompt
+    int         moves;      // hit/stand decisions so far this hand
+    uint64_t    connect_at;
+    size_t      in_len;
+    char        in[4 * MAXLINE];
+} Bot;
+
+static Histogram    latency[PROMPT_KINDS];
+static Histogram    play_wait;  // choosing to play -> the hand's first prompt
+static Histogram    connect_wait;   // connect() -> the name prompt
+static int          hands_per_session = 10;
+static int          binary;     // bots speak frames instead of text
+static uint64_t     hands_done;
+static int          active, peak_active, finished, failed;
+static int          connecting;
+static uint64_t     lobby_full;
+static uint64_t     greet_last;     // when the last session got its name prompt
+static int          hit_below = 17;
+static const char  *script;         // 'h'/'s' per decision of a hand, then stand
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int hist_index(uint64_t v) {
+    if (v < HIST_SUB)
+        return (int)v;
+    int exp = 63 - __builtin_clzll(v);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+uint64_t hist_value(int index) {
+    if (index < HIST_SUB)
+        return index;
+    int exp = index / HIST_SUB + HIST_SUB_BITS - 1;
+    return ((uint64_t)(HIST_SUB + index % HIST_SUB)) << (exp - HIST_SUB_BITS);
+}
+
+void hist_record(Histogram *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+uint64_t hist_percentile(const Histogram *h, double p) {
+    uint64_t rank = (uint64_t)(p * h->total);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank)
+            return hist_value(i);
+    }
+    return h->max;
+}
+
+// The bots' strategy: the script if there is one, else hit below a score.
+int bot_hits(Bot *b) {
+    int move = b->moves++;
+
+    if (script != NULL)
+        return move < (int)strlen(script) && script[move] == 'h';
+    return b->score < hit_below;
+}
+
+void bot_greeted(Bot *b) {
+    b->greeted = 1;
+    connecting--;
+    greet_last = now_ns();
+    hist_record(&connect_wait, greet_last - b->connect_at);
+}
+
+// Called on every prompt. The first one after choosing to play ends the
+// wait for a seat, if there was one; playing again starts the next.
+void bot_played(Bot *b, int playing) {
+    uint64_t now = now_ns();
+
+    if (b->play_at != 0)
+        hist_record(&play_wait, now - b->play_at);
+    b->play_at = playing ? now : 0;
+}
+
+int bot_send(Bot *b, const char *msg) {
+    b->sent_at = now_ns();
+    b->in_len = 0;
+    if (send(b->fd, msg, strlen(msg), 0) < 0)
+        return -1;
+    return 0;
+}
+
+// Called whenever new bytes arrive. The server always ends its output with a
+// prompt and then waits, so the prompt at the tail of the buffer tells us
+// exactly which answer is expected.
+int bot_input(Bot *b) {
+    char        reply[32];
+    PROMPT_KIND kind;
+    char       *p;
+
+    b->in[b->in_len] = '\0';
+
+    if (strstr(b->in, "Goodbye,"))
+        return -1;
+
+    if (strstr(b->in, "The lobby is full.")) {
+        lobby_full++;
+        b->in_game = 0;     // turned away: the menu that follows is no hand
+    }
+
+    if (strstr(b->in, "Enter your name: ")) {
+        kind = PROMPT_NAME;
+        bot_greeted(b);
+        snprintf(reply, sizeof(reply), "bot%d", b->id);
+    } else if (b->in_len >= 2 && strcmp(b->in + b->in_len - 2, "> ") == 0) {
+        kind = PROMPT_MENU;
+        if (b->in_game) {
+            b->in_game = 0;
+            b->hands++;
+            hands_done++;
+        }
+        if (b->hands < hands_per_session) {
+            b->in_game = 1;
+            b->moves = 0;
+            snprintf(reply, sizeof(reply), "1");
+        } else {
+            snprintf(reply, sizeof(reply), "3");
+        }
+    } else if ((p = strstr(b->in, "Your current score: ")) && strstr(p, "Draw a card? (yes/no): \n")) {
+        kind = PROMPT_HIT;
+        b->score = atoi(p + strlen("Your current score: "));
+        snprintf(reply, sizeof(reply), "%s", bot_hits(b) ? "yes" : "no");
+    } else if (strstr(b->in, "(1/11): \n")) {
+        kind = PROMPT_ACE;
+        snprintf(reply, sizeof(reply), "%s", b->score + 11 <= 21 ? "11" : "1");
+    } else {
+        return 0;   // prompt not complete yet
+    }
+
+    bot_played(b, kind == PROMPT_MENU && b->in_game);
+    if (b->sent_at != 0)
+        hist_record(&latency[kind], now_ns() - b->sent_at);
+
+    return bot_send(b, reply);
+}
+
+int bot_send_frame(Bot *b, int type, const void *payload, size_t len) {
+    uint8_t frame[FRAME_HEADER_LEN + 64];
+
+    b->sent_at = now_ns();
+    len = frame_put(frame, type, payload, len);
+    if (send(b->fd, frame, len, 0) < 0)
+        return -1;
+    return 0;
+}
+
+// The same bot speaking the binary protocol: it handles every complete
+// frame and keeps any partial one for the next read.
+int bot_input_binary(Bot *b) {
+    uint8_t       *in = (uint8_t *)b->in;
+    uint8_t       *p = in;
+    const uint8_t *payload;
+    size_t         len;
+    int            type;
+    long           used;
+
+    if (!b->greeted) {      // skip the text greeting
+        uint8_t *start = memchr(in, FRAME_MAGIC, b->in_len);
+        p = start ? start : in + b->in_len;
+    }
+
+    while ((used = frame_get(p, in + b->in_len - p, &type, &payload, &len)) > 0) {
+        PROMPT_KIND kind;
+        uint8_t     reply[32];
+        size_t      reply_len = 1;
+        int         reply_type;
+
+        p += used;
+        switch (type) {
+        case MSG_PROMPT_NAME:
+            kind = PROMPT_NAME;
+            bot_greeted(b);
+            reply_type = MSG_NAME;
+            reply_len = snprintf((char *)reply, sizeof(reply), "bot%d", b->id);
+            break;
+        case MSG_MENU:
+            kind = PROMPT_MENU;
+            if (b->in_game) {
+                b->in_game = 0;
+                b->hands++;
+                hands_done++;
+            }
+            b->in_game = b->hands < hands_per_session;
+            b->moves = 0;
+            reply_type = MSG_CHOOSE;
+            reply[0] = b->in_game ? 1 : 3;
+            put_u16(reply + 1, 0);
+            reply_len = 3;
+            break;
+        case MSG_PROMPT_HIT:
+            kind = PROMPT_HIT;
+            b->score = payload[0];
+            reply_type = MSG_HIT;
+            reply[0] = bot_hits(b);
+            break;
+        case MSG_PROMPT_ACE:
+            kind = PROMPT_ACE;
+            reply_type = MSG_ACE;
+            reply[0] = b->score + 11 <= 21 ? 11 : 1;
+            break;
+        case MSG_TEXT:
+            if (!b->in_game && b->hands == hands_per_session)
+                return -1;  // the goodbye
+            if (len >= 18 && memcmp(payload, "The lobby is full.", 18) == 0) {
+                lobby_full++;
+                b->in_game = 0;
+            }
+            continue;
+        default:
+            continue;
+        }
+
+        bot_played(b, kind == PROMPT_MENU && b->in_game);
+        if (b->sent_at != 0)
+            hist_record(&latency[kind], now_ns() - b->sent_at);
+        if (bot_send_frame(b, reply_type, reply, reply_len) < 0)
+            return -1;
+    }
+    if (used < 0)
+        return -1;
+
+    b->in_len = in + b->in_len - p;
+    memmove(in, p, b->in_len);
+    return 0;
+}
+
+void bot_close(int epfd, Bot *b, int ok) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, b->fd, NULL);
+    close(b->fd);
+    b->fd = -1;
+    if (b->connected)
+        active--;
+    if (!b->greeted)
+        connecting--;
+    if (ok)
+        finished++;
+    else
+        failed++;
+}
+
+int bot_connect(int epfd, Bot *b, const struct sockaddr_storage *addr, socklen_t addrlen) {
+    int one = 1;
+
+    if ((b->fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        fprintf(stderr, "socket error : %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    b->connect_at = now_ns();
+    if (connect(b->fd, (const struct sockaddr *)addr, addrlen) < 0 && errno != EINPROGRESS) {
+        fprintf(stderr, "connect error : %s\n", strerror(errno));
+        close(b->fd);
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = b };
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, b->fd, &ev);
+}
+
+void usage(const char *pname) {
+    fprintf(stderr, "Usage: %s [load] [-a address | -M 4|6] [-p port] [-c sessions] [-n hands per session] [-r max pending connects] [-R arrivals/sec]\n"
+                    "            [-H hit below | -S script] [-G max p99 us] [-b]\n"
+                    "       %s journal [-n results] [-P players] [-d dir]\n"
+                    "       %s leaderboard [-n updates] [-P players] [-k top K]\n"
+                    "       %s shoe [-n cards] [-D decks] [-C cut percent] [-s shuffles]\n"
+                    "       %s engine [-n hands] [-D decks]\n"
+                    "       %s record [-n hands] [-D decks] [-P players] [-R MB per file] [-z compressor] [-d dir]\n"
+                    "       %s stats [-n ops] [-t threads] [-p server port] [-H hands/sec]\n"
+                    "       %s log [-n records] [-t threads] [-l file]\n"
+                    "       %s scale [-s server] [-w cores,...] [-L load processes] [-c sessions] [-n hands per session] [-p port] [-m mode] [-b]\n"
+            "       %s resume [-a address] [-p port] [-n rounds]\n"
+            "       %s timers [-n timers] [-s spread seconds]\n",
+            pname, pname, pname, pname, pname, pname, pname, pname, pname, pname, pname);
+}
+
+// The server's counters, if it runs on this host.
+const StatsRegion *map_server_stats(int port) {
+    char name[64];
+    int  fd;
+
+    snprintf(name, sizeof(name), STATS_SHM_NAME, port);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return NULL;
+    void *p = mmap(NULL, sizeof(StatsRegion), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+int bench_address(const char *address, int port, uint32_t scope, struct sockaddr_storage *addr, socklen_t *addrlen) {
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, address, &((struct sockaddr_in *)addr)->sin_addr) == 1) {
+        ((struct sockaddr_in *)addr)->sin_family = AF_INET;
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+        *addrlen = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, address, &((struct sockaddr_in6 *)addr)->sin6_addr) == 1) {
+        ((struct sockaddr_in6 *)addr)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+        ((struct sockaddr_in6 *)addr)->sin6_scope_id = scope;
+        *addrlen = sizeof(struct sockaddr_in6);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int bench_load(int argc, char *argv[]) {
+    const char *address = "127.0.0.1";
+    int port = PORT;
+    int sessions = 100;
+    int max_connecting = 8;
+    double arrival_rate = 0;
+    double max_p99_us = 0;
+    int discover_version = 0;
+    Discovered found = { .scope = 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:M:p:c:n:r:R:H:S:G:b")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'M': discover_version = atoi(optarg) == 6 ? 6 : 4; break;
+        case 'H': hit_below = atoi(optarg); break;
+        case 'S': script = optarg; break;
+        case 'G': max_p99_us = atof(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': sessions = atoi(optarg); break;
+        case 'n': hands_per_session = atoi(optarg); break;
+        case 'r': max_connecting = atoi(optarg); break;
+        case 'R': arrival_rate = atof(optarg); break;
+        case 'b': binary = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (discover_version) {
+        if (discover(discover_version, DISCOVER_TIMEOUT * 1000, &found) < 0) {
+            fprintf(stderr, "No server announcement within %ds\n", DISCOVER_TIMEOUT);
+            return 1;
+        }
+        address = found.address;
+        port = found.beacon.port;
+        printf("discovered %d server(s), the least loaded at %s port %d (%u of %u sessions)\n",
+               found.heard, address, port, found.beacon.sessions, found.beacon.capacity);
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    if (bench_address(address, port, found.scope, &addr, &addrlen) < 0) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    int epfd = epoll_create1(0);
+    Bot *bots = calloc(sessions, sizeof(Bot));
+    if (epfd < 0 || bots == NULL) {
+        perror("setup failed");
+        return 1;
+    }
+
+    // Connects are released a few at a time: a burst larger than the
+    // server's listen backlog just turns into SYN retransmits.
+    const StatsRegion *server = map_server_stats(port);
+    ServerStats before = { 0 };
+    if (server != NULL)
+        stats_total(server, &before);
+
+    uint64_t start = now_ns();
+    uint64_t next_arrival = start;
+    int next = 0;
+
+    // With -R sessions arrive as a Poisson process instead: exponential
+    // gaps, whatever the server is doing, which is what lets a queue build.
+    struct epoll_event events[MAX_EVENTS];
+    while (finished + failed < sessions) {
+        int timeout = 10000;
+
+        while (next < sessions && (arrival_rate > 0 ? now_ns() >= next_arrival : connecting < max_connecting)) {
+            bots[next].id = next;
+            if (bot_connect(epfd, &bots[next], &addr, addrlen) < 0)
+                failed++;
+            else
+                connecting++;
+            next++;
+            if (arrival_rate > 0)
+                next_arrival += (uint64_t)(-log(1.0 - drand48()) / arrival_rate * 1e9);
+        }
+        if (arrival_rate > 0 && next < sessions) {
+            uint64_t now = now_ns();
+            timeout = next_arrival > now ? (int)((next_arrival - now) / 1000000) + 1 : 0;
+        }
+
+        int nready = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (nready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        } else if (nready == 0 && timeout == 10000) {
+            fprintf(stderr, "No progress for 10s, giving up\n");
+            break;
+        }
+
+        for (int i = 0; i < nready; i++) {
+            Bot *b = events[i].data.ptr;
+
+            if (!b->connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    bot_close(epfd, b, 0);
+                    continue;
+                }
+                b->connected = 1;
+                if (++active > peak_active)
+                    peak_active = active;
+                struct epoll_event ev = { .events = EPOLLIN, .data.ptr = b };
+                epoll_ctl(epfd, EPOLL_CTL_MOD, b->fd, &ev);
+
+                uint8_t version = PROTOCOL_VERSION;
+                if (binary && bot_send_frame(b, MSG_HELLO, &version, 1) < 0) {
+                    bot_close(epfd, b, 0);
+                    continue;
+                }
+            }
+
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                continue;
+
+            ssize_t n = recv(b->fd, b->in + b->in_len, sizeof(b->in) - 1 - b->in_len, 0);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                    continue;
+                bot_close(epfd, b, 0);
+                continue;
+            }
+            b->in_len += n;
+            if (b->in_len == sizeof(b->in) - 1)
+                b->in_len = 0;  // runaway output, nothing we can parse
+
+            if ((binary ? bot_input_binary(b) : bot_input(b)) < 0)
+                bot_close(epfd, b, b->hands == hands_per_session);
+        }
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+
+    double connect_span = greet_last > start ? (greet_last - start) / 1e9 : elapsed;
+
+    printf("sessions: %d ok, %d failed, peak concurrent %d\n", finished, failed, peak_active);
+    printf("connections: %llu greeted in %.2fs (%.0f connections/sec)\n",
+           (unsigned long long)connect_wait.total, connect_span, connect_wait.total / connect_span);
+    printf("hands: %llu in %.2fs (%.0f hands/sec)\n",
+           (unsigned long long)hands_done, elapsed, hands_done / elapsed);
+    printf("%-6s %10s %10s %10s %10s %10s\n", "prompt", "count", "p50 us", "p99 us", "p999 us", "max us");
+    for (int k = 0; k < PROMPT_KINDS; k++) {
+        printf("%-6s %10llu %10.1f %10.1f %10.1f %10.1f\n", prompt_names[k],
+               (unsigned long long)latency[k].total,
+               hist_percentile(&latency[k], 0.50) / 1e3,
+               hist_percentile(&latency[k], 0.99) / 1e3,
+               hist_percentile(&latency[k], 0.999) / 1e3,
+               latency[k].max / 1e3);
+    }
+    printf("%-6s %10llu %10.1f %10.1f %10.1f %10.1f   (connect -> name prompt)\n", "conn",
+           (unsigned long long)connect_wait.total,
+           hist_percentile(&connect_wait, 0.50) / 1e3,
+           hist_percentile(&connect_wait, 0.99) / 1e3,
+           hist_percentile(&connect_wait, 0.999) / 1e3,
+           connect_wait.max / 1e3);
+    printf("%-6s %10llu %10.1f %10.1f %10.1f %10.1f   (choosing to play -> first prompt of the hand)\n", "play",
+           (unsigned long long)play_wait.total,
+           hist_percentile(&play_wait, 0.50) / 1e3,
+           hist_percentile(&play_wait, 0.99) / 1e3,
+           hist_percentile(&play_wait, 0.999) / 1e3,
+           play_wait.max / 1e3);
+    if (lobby_full > 0)
+        printf("turned away by a full lobby: %llu times\n", (unsigned long long)lobby_full);
+
+    if (server != NULL) {
+        ServerStats after;
+        stats_total(server, &after);
+        uint64_t hands = after.hands - before.hands;
+        if (hands == 0)
+            hands = 1;
+        printf("server: %llu hands, per hand %.2f messages, %.2f send calls, %.2f recv calls, %.0f bytes out\n",
+               (unsigned long long)(after.hands - before.hands),
+               (double)(after.messages - before.messages) / hands,
+               (double)(after.send_calls - before.send_calls) / hands,
+               (double)(after.recv_calls - before.recv_calls) / hands,
+               (double)(after.send_bytes - before.send_bytes) / hands);
+        uint64_t syscalls = (after.send_calls - before.send_calls) + (after.recv_calls - before.recv_calls) +
+                            (after.wait_calls - before.wait_calls) + (after.ctl_calls - before.ctl_calls);
+        printf("server: %.2f I/O system calls per hand (%.2f waits, %.2f epoll_ctl), %.2f io_uring operations per hand\n",
+               (double)syscalls / hands,
+               (double)(after.wait_calls - before.wait_calls) / hands,
+               (double)(after.ctl_calls - before.ctl_calls) / hands,
+               (double)(after.uring_ops - before.uring_ops) / hands);
+        uint64_t rounds = after.rounds - before.rounds;
+        printf("server: %llu dealer rounds (%.0f rounds/sec), %.2f hands per round, %.2f dealer cards per hand\n",
+               (unsigned long long)rounds, rounds / elapsed, (double)(after.hands - before.hands) / (rounds ? rounds : 1),
+               (double)(after.dealer_cards - before.dealer_cards) / hands);
+        uint64_t joins = after.lobby_joins - before.lobby_joins;
+        if (joins > 0 || after.rejected != before.rejected)
+            printf("server: %llu lobby joins, mean wait %.1f ms, %llu turned away by the lobby, %llu connections refused as full\n",
+                   (unsigned long long)joins, (double)(after.lobby_wait_ms - before.lobby_wait_ms) / (joins ? joins : 1),
+                   (unsigned long long)(after.lobby_full - before.lobby_full),
+                   (unsigned long long)(after.rejected - before.rejected));
+    }
+
+    // A regression gate: a slow prompt fails the run like a failed session.
+    int slow = 0;
+    for (int k = 0; k < PROMPT_KINDS && max_p99_us > 0; k++) {
+        if (latency[k].total > 0 && hist_percentile(&latency[k], 0.99) / 1e3 > max_p99_us) {
+            fprintf(stderr, "%s p99 above %.0f us\n", prompt_names[k], max_p99_us);
+            slow = 1;
+        }
+    }
+
+    close(epfd);
+    free(bots);
+    return failed || slow ? 1 : 0;
+}
+
+// One blocking binary connection, for the resume benchmark.
+typedef struct {
+    int      fd;
+    int      framed;        // past the text greeting
+    size_t   len;
+    uint8_t  in[4 * MAXLINE];
+    uint64_t token;         // from the last MSG_RESUME
+} Conn;
+
+int conn_send(Conn *c, int type, const void *payload, size_t len) {
+    uint8_t frame[FRAME_HEADER_LEN + MAXLINE];
+
+    len = frame_put(frame, type, payload, len);
+    return send(c->fd, frame, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+int conn_open(Conn *c, const struct sockaddr_storage *addr, socklen_t addrlen, const void *hello, size_t len) {
+    int one = 1;
+
+    memset(c, 0, sizeof(*c));
+    if ((c->fd = socket(addr->ss_family, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (const struct sockaddr *)addr, addrlen) < 0) {
+        close(c->fd);
+        return -1;
+    }
+    return conn_send(c, MSG_HELLO, hello, len);
+}
+
+// Reads until a frame of type `want` or a name prompt (a refused resume)
+// arrives, and returns its type; -1 if the connection ends first.
+int conn_wait(Conn *c, int want) {
+    while (1) {
+        uint8_t       *p = c->in;
+        const uint8_t *payload;
+        size_t         payload_len;
+        int            type, found = 0;
+        long           used;
+        ssize_t        n;
+
+        if (!c->framed) {
+            uint8_t *start = memchr(c->in, FRAME_MAGIC, c->len);
+            c->framed = start != NULL;
+            p = start ? start : c->in + c->len;
+        }
+        while (!found && (used = frame_get(p, c->in + c->len - p, &type, &payload, &payload_len)) > 0) {
+            p += used;
+            if (type == MSG_RESUME && payload_len >= 8)
+                c->token = get_u64(payload);
+            found = type == want || type == MSG_PROMPT_NAME;
+        }
+        c->len = c->in + c->len - p;
+        memmove(c->in, p, c->len);
+        if (found)
+            return type;
+        if (used < 0 || (n = recv(c->fd, c->in + c->len, sizeof(c->in) - c->len, 0)) <= 0)
+            return -1;
+        c->len += n;
+    }
+}
+
+static void resume_row(const char *name, const Histogram *h, double sum_ns, const char *what) {
+    printf("%-7s %8llu %10.1f %10.1f %10.1f %10.1f   (%s)\n", name, (unsigned long long)h->total,
+           sum_ns / (h->total ? h->total : 1) / 1e3, hist_percentile(h, 0.50) / 1e3,
+           hist_percentile(h, 0.99) / 1e3, h->max / 1e3, what);
+}
+
+// What a dropped connection costs the player: without a token, a full
+// login (hello, name prompt, name, menu) and a new hand dealt to get back
+// to a hit prompt, the old hand lost; with one, a hello carrying the token
+// and the same hand's prompt back. Each round logs in, starts a hand,
+// drops the connection at the hit prompt, resumes, stands, and leaves.
+int bench_resume(int argc, char *argv[]) {
+    const char             *address = "127.0.0.1";
+    int                     port = PORT, rounds = 1000, opt;
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    static Histogram        login, replay, resume;
+    double                  login_sum = 0, replay_sum = 0, resume_sum = 0;
+    int                     refused = 0, lost = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:n:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (bench_address(address, port, 0, &addr, &addrlen) < 0) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+
+    const StatsRegion *server = map_server_stats(port);
+    ServerStats before = { 0 };
+    if (server != NULL)
+        stats_total(server, &before);
+
+    for (int i = 0; i < rounds; i++) {
+        uint8_t  hello[9] = { PROTOCOL_VERSION }, choose[3] = { 1, 0, 0 }, stand = 0;
+        char     name[32];
+        int      len = snprintf(name, sizeof(name), "resume%d", i % 100);
+        Conn     c;
+        uint64_t start = now_ns(), t;
+
+        if (conn_open(&c, &addr, addrlen, hello, 1) < 0 || conn_wait(&c, MSG_PROMPT_NAME) < 0 ||
+            conn_send(&c, MSG_NAME, name, len) < 0 || conn_wait(&c, MSG_MENU) != MSG_MENU) {
+            fprintf(stderr, "login failed : %s\n", strerror(errno));
+            return 1;
+        }
+        t = now_ns() - start;
+        hist_record(&login, t);
+        login_sum += t;
+
+        if (c.token == 0) {
+            fprintf(stderr, "The server issued no resume token (started with -g 0?)\n");
+            return 1;
+        }
+        if (conn_send(&c, MSG_CHOOSE, choose, 3) < 0 || conn_wait(&c, MSG_PROMPT_HIT) != MSG_PROMPT_HIT) {
+            lost++;
+            close(c.fd);
+            continue;
+        }
+        t = now_ns() - start;
+        hist_record(&replay, t);
+        replay_sum += t;
+        close(c.fd);
+
+        uint64_t token = c.token;
+        hello[0] = PROTOCOL_VERSION;
+        put_u64(hello + 1, token);
+        start = now_ns();
+        if (conn_open(&c, &addr, addrlen, hello, sizeof(hello)) < 0) {
+            lost++;
+            continue;
+        }
+        if (conn_wait(&c, MSG_PROMPT_HIT) != MSG_PROMPT_HIT) {
+            refused++;
+            close(c.fd);
+            continue;
+        }
+        t = now_ns() - start;
+        hist_record(&resume, t);
+        resume_sum += t;
+
+        choose[0] = 3;
+        if (conn_send(&c, MSG_HIT, &stand, 1) < 0 || conn_wait(&c, MSG_MENU) != MSG_MENU ||
+            conn_send(&c, MSG_CHOOSE, choose, 3) < 0)
+            lost++;
+        close(c.fd);
+    }
+
+    printf("%d rounds, %d resumes refused, %d connections lost\n", rounds, refused, lost);
+    printf("%-7s %8s %10s %10s %10s %10s\n", "", "count", "mean us", "p50 us", "p99 us", "max us");
+    resume_row("login", &login, login_sum, "connect, hello, name -> menu");
+    resume_row("relogin", &replay, replay_sum, "connect, hello, name, play -> a new hand's prompt");
+    resume_row("resume", &resume, resume_sum, "connect, hello with token -> the same hand's prompt");
+    if (resume.total > 0 && replay.total > 0)
+        printf("a resume costs %.0f%% of a login and %.0f%% of getting back into a hand without one\n",
+               100.0 * (resume_sum / resume.total) / (login_sum / login.total),
+               100.0 * (resume_sum / resume.total) / (replay_sum / replay.total));
+
+    if (server != NULL) {
+        ServerStats after;
+        stats_total(server, &after);
+        printf("server: %llu resumes, %llu refused, %llu hands\n",
+               (unsigned long long)(after.resumes - before.resumes),
+               (unsigned long long)(after.resume_misses - before.resume_misses),
+               (unsigned long long)(after.hands - before.hands));
+    }
+    return refused || lost ? 1 : 0;
+}
+
+void *journal_syncer(void *arg) {
+    (void)arg;
+
+    while (1) {
+        usleep(JOURNAL_SYNC_MS * 1000);
+        ranking_sync();
+    }
+    return NULL;
+}
+
+double recover(const char *dir, long *records) {
+    uint64_t start = now_ns();
+
+    if (ranking_init() < 0 || (*records = ranking_open(dir, NULL)) < 0) {
+        perror("recovery failed");
+        exit(1);
+    }
+    return (now_ns() - start) / 1e9;
+}
+
+// Persists results the way the server does (store update plus a journal
+// append under the ranking lock, fdatasync batched in the background), then
+// times recovery from the journal alone and from a compacted snapshot.
+int bench_journal(int argc, char *argv[]) {
+    long        results = 1000000;
+    int         players = 10000;
+    char        dir[256];
+    char        name[50];
+    int         opt;
+    long        records;
+
+    snprintf(dir, sizeof(dir), "/tmp/bench_journal.%d", (int)getpid());
+    while ((opt = getopt(argc, argv, "n:P:d:")) != -1) {
+        switch (opt) {
+        case 'n': results = atol(optarg); break;
+        case 'P': players = atoi(optarg); break;
+        case 'd': snprintf(dir, sizeof(dir), "%s", optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir failed");
+        return 1;
+    }
+    recover(dir, &records);
+    if (records > 0) {
+        fprintf(stderr, "%s already holds rankings\n", dir);
+        return 1;
+    }
+
+    pthread_t syncer;
+    pthread_create(&syncer, NULL, journal_syncer, NULL);
+
+    uint64_t start = now_ns();
+    uint32_t x = 2463534242u;
+    for (long i = 0; i < results; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        snprintf(name, sizeof(name), "player%u", x % players);
+        ranking_lock();
+        update_player_stats(name, (int)(x >> 8) % 3 - 1);
+        ranking_unlock();
+    }
+    ranking_sync();
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("persisted %ld results for %d players in %.2fs (%.0f hands/sec)\n",
+           results, players, elapsed, results / elapsed);
+
+    // The core mode's way: results applied RANKING_BATCH_MAX per lock and write.
+    static RankingUpdate batch[RANKING_BATCH_MAX];
+    start = now_ns();
+    for (long i = 0; i < results; i += RANKING_BATCH_MAX) {
+        int n = results - i < RANKING_BATCH_MAX ? results - i : RANKING_BATCH_MAX;
+        for (int j = 0; j < n; j++) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            snprintf(batch[j].name, sizeof(batch[j].name), "player%u", x % players);
+            batch[j].result = (int)(x >> 8) % 3 - 1;
+        }
+        ranking_lock();
+        ranking_record(batch, n);
+        ranking_unlock();
+    }
+    ranking_sync();
+    elapsed = (now_ns() - start) / 1e9;
+    printf("persisted in batches of %d: %.2fs (%.0f hands/sec)\n", RANKING_BATCH_MAX, elapsed, results / elapsed);
+
+    // What every hand used to cost: rewriting the whole text ranking.
+    char path[600];
+    snprintf(path, sizeof(path), "%s/rankings.txt", dir);
+    start = now_ns();
+    for (int i = 0; i < 10; i++) {
+        FILE *file = fopen(path, "w");
+        Player *p = ranking_players();
+        for (uint32_t j = 0; j < ranking->count; j++)
+            fprintf(file, "%s %d %d %d\n", p[j].name, p[j].wins, p[j].draws, p[j].losses);
+        fclose(file);
+    }
+    elapsed = (now_ns() - start) / 1e9 / 10;
+    printf("full text rewrite per hand: %.3f ms (%.0f hands/sec)\n", elapsed * 1e3, 1 / elapsed);
+    unlink(path);
+
+    elapsed = recover(dir, &records);
+    printf("recovery from journal: %ld records in %.3fs\n", records, elapsed);
+
+    start = now_ns();
+    ranking_compact();
+    printf("compaction: %.3fs\n", (now_ns() - start) / 1e9);
+
+    elapsed = recover(dir, &records);
+    printf("recovery from snapshot: %u players, %ld journal records in %.3fs\n", ranking->count, records, elapsed);
+
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    if (d)
+        closedir(d);
+    rmdir(dir);
+    return 0;
+}
+
+// Runs a load process for bench_scale: bench_load with its report on `out`.
+static pid_t scale_load(int out, const cpu_set_t *cpus, char *argv[]) {
+    pid_t pid = fork();
+    int   argc = 0;
+
+    if (pid != 0)
+        return pid;
+    if (cpus != NULL)
+        sched_setaffinity(0, sizeof(*cpus), cpus);
+    dup2(out, STDOUT_FILENO);
+    while (argv[argc] != NULL)
+        argc++;
+    optind = 1;
+    exit(bench_load(argc, argv));
+}
+
+// The scaling curve: for each core count, starts the server on that many
+// CPUs (-m core pins a worker to each), loads it from the other CPUs with
+// as many bench processes as it has cores, and reports hands/sec against
+// the first count. A load generator is one thread, so it needs its own
+// cores for the curve to measure the server rather than itself.
+int bench_scale(int argc, char *argv[]) {
+    const char *server = "./server";
+    const char *mode = "core";
+    char        list[256] = "1,2,4,8,16,32,64";
+    char        sessions[16] = "200", hands[16] = "50";
+    int         port = 12960, loaders = 0, binary_load = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "s:w:L:c:n:p:m:b")) != -1) {
+        switch (opt) {
+        case 's': server = optarg; break;
+        case 'w': snprintf(list, sizeof(list), "%s", optarg); break;
+        case 'L': loaders = atoi(optarg); break;
+        case 'c': snprintf(sessions, sizeof(sessions), "%s", optarg); break;
+        case 'n': snprintf(hands, sizeof(hands), "%s", optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'm': mode = optarg; break;
+        case 'b': binary_load = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    cpu_set_t allowed;
+    int       cpus[CPU_SETSIZE], ncpus = 0;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &allowed))
+            cpus[ncpus++] = c;
+
+    printf("%-6s %8s %12s %8s %10s %s\n", "cores", "loaders", "hands/sec", "speedup", "efficiency", "");
+    double base = 0;
+    int    base_cores = 0;
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ","), port++) {
+        int       cores = atoi(tok), load_count = loaders > 0 ? loaders : cores;
+        cpu_set_t server_cpus, load_cpus;
+        char      dir[64], workers[16], port_arg[16];
+
+        if (cores < 1)
+            continue;
+        CPU_ZERO(&server_cpus);
+        CPU_ZERO(&load_cpus);
+        for (int i = 0; i < ncpus; i++)
+            CPU_SET(cpus[i], i < cores ? &server_cpus : &load_cpus);
+        if (cores >= ncpus)
+            load_cpus = allowed;    // nothing left over: share
+
+        snprintf(dir, sizeof(dir), "/tmp/bench_scale.%d.%d", (int)getpid(), cores);
+        snprintf(workers, sizeof(workers), "%d", cores);
+        snprintf(port_arg, sizeof(port_arg), "%d", port);
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            perror("mkdir failed");
+            return 1;
+        }
+
+        pid_t srv = fork();
+        if (srv == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            if (cores < ncpus)
+                sched_setaffinity(0, sizeof(server_cpus), &server_cpus);
+            execl(server, server, "-f", "-m", mode, "-w", workers, "-p", port_arg, "-d", dir, "-S", "", "4", (char *)NULL);
+            _exit(127);
+        }
+
+        // Ready once it accepts a connection.
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int ready = 0;
+        for (int tries = 0; tries < 100 && !ready; tries++) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            ready = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+            close(fd);
+            if (!ready)
+                usleep(50000);
+        }
+        if (!ready) {
+            fprintf(stderr, "%s did not start on port %d\n", server, port);
+            kill(srv, SIGTERM);
+            waitpid(srv, NULL, 0);
+            return 1;
+        }
+
+        char *load_argv[] = { "load", "-p", port_arg, "-c", sessions, "-n", hands, binary_load ? "-b" : NULL, NULL };
+        pid_t pids[CPU_SETSIZE];
+        int   pipes[CPU_SETSIZE], failed = 0;
+        if (load_count > CPU_SETSIZE)
+            load_count = CPU_SETSIZE;
+        for (int i = 0; i < load_count; i++) {
+            int fds[2];
+            if (pipe(fds) < 0) {
+                perror("pipe failed");
+                return 1;
+            }
+            pids[i] = scale_load(fds[1], &load_cpus, load_argv);
+            close(fds[1]);
+            pipes[i] = fds[0];
+        }
+
+        // Every process's hands over the longest run.
+        unsigned long long total = 0;
+        double             longest = 0;
+        for (int i = 0; i < load_count; i++) {
+            char    out[4096], *line;
+            size_t  len = 0;
+            ssize_t n;
+            int     status;
+
+            while ((n = read(pipes[i], out + len, sizeof(out) - 1 - len)) > 0)
+                len += n;
+            out[len] = '\0';
+            close(pipes[i]);
+            waitpid(pids[i], &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failed++;
+
+            unsigned long long done;
+            double             secs;
+            if ((line = strstr(out, "hands: ")) != NULL && sscanf(line, "hands: %llu in %lfs", &done, &secs) == 2) {
+                total += done;
+                if (secs > longest)
+                    longest = secs;
+            }
+        }
+        kill(srv, SIGTERM);
+        waitpid(srv, NULL, 0);
+
+        DIR *d = opendir(dir);
+        struct dirent *e;
+        while (d && (e = readdir(d)) != NULL) {
+            char path[600];
+            if (e->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+        if (d)
+            closedir(d);
+        rmdir(dir);
+
+        double rate = longest > 0 ? total / longest : 0;
+        if (base == 0) {
+            base = rate;
+            base_cores = cores;
+        }
+        double speedup = base > 0 ? rate / base : 0;
+        printf("%-6d %8d %12.0f %8.2f %9.0f%% %s\n", cores, load_count, rate, speedup,
+               100 * speedup * base_cores / cores, failed ? "(sessions failed)" : "");
+        fflush(stdout);
+    }
+    if (ncpus < 2)
+        printf("only %d CPU available: the curve needs more cores than the largest count to mean anything\n", ncpus);
+    return 0;
+}
+
+// Update, top-K and rank throughput of the in-memory leaderboard.
+int bench_leaderboard(int argc, char *argv[]) {
+    long        updates = 10000000;
+    int         players = 1000000;
+    uint32_t    k = 10;
+    char        name[50];
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "n:P:k:")) != -1) {
+        switch (opt) {
+        case 'n': updates = atol(optarg); break;
+        case 'P': players = atoi(optarg); break;
+        case 'k': k = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (ranking_init() < 0) {
+        perror("ranking_init failed");
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < players; i++) {
+        snprintf(name, sizeof(name), "player%d", i);
+        ranking_lock();
+        update_player_stats(name, -1);
+        ranking_unlock();
+    }
+    printf("registered %d players in %.2fs\n", players, (now_ns() - start) / 1e9);
+
+    uint32_t x = 2463534242u;
+    start = now_ns();
+    for (long i = 0; i < updates; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        snprintf(name, sizeof(name), "player%u", x % players);
+        ranking_lock();
+        update_player_stats(name, (int)(x >> 8) % 3 - 1);
+        ranking_unlock();
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("updates: %ld in %.2fs (%.0f/sec)\n", updates, elapsed, updates / elapsed);
+
+    Player *top = malloc((size_t)players * sizeof(Player));
+    ranking_lock();
+    uint32_t n = ranking_top(players, top);
+    ranking_unlock();
+    for (uint32_t i = 1; i < n; i++) {
+        if (top[i].wins > top[i - 1].wins) {
+            fprintf(stderr, "leaderboard out of order at %u\n", i);
+            return 1;
+        }
+    }
+
+    long queries = 1000000;
+    start = now_ns();
+    for (long i = 0; i < queries; i++) {
+        ranking_lock();
+        ranking_top(k, top);
+        ranking_unlock();
+    }
+    elapsed = (now_ns() - start) / 1e9;
+    printf("top %u: %.0f queries/sec (leader has %d wins)\n", k, queries / elapsed, top[0].wins);
+
+    uint64_t ranks = 0;
+    start = now_ns();
+    for (long i = 0; i < queries; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        snprintf(name, sizeof(name), "player%u", x % players);
+        ranking_lock();
+        ranks += ranking_rank(name, top);
+        ranking_unlock();
+    }
+    elapsed = (now_ns() - start) / 1e9;
+    printf("my rank: %.0f queries/sec (mean rank %.0f)\n", queries / elapsed, (double)ranks / queries);
+
+    free(top);
+    return 0;
+}
+
+// Chi-square value with df degrees of freedom that is exceeded with
+// probability 0.001 (Wilson-Hilferty approximation).
+double chi2_critical(int df) {
+    double z = 3.090, k = 2.0 / (9.0 * df);
+    return df * pow(1 - k + z * sqrt(k), 3);
+}
+
+int bench_shoe(int argc, char *argv[]) {
+    long        cards = 100000000;
+    long        shuffles = 200000;
+    int         decks = SHOE_DEFAULT_DECKS;
+    int         cut = SHOE_DEFAULT_CUT;
+    int         opt;
+    Shoe        shoe;
+
+    while ((opt = getopt(argc, argv, "n:D:C:s:")) != -1) {
+        switch (opt) {
+        case 'n': cards = atol(optarg); break;
+        case 'D': decks = atoi(optarg); break;
+        case 'C': cut = atoi(optarg); break;
+        case 's': shuffles = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Throughput, with a hand boundary every three cards so the cut card
+    // and its reshuffles are paid for as they would be in play.
+    uint64_t counts[CARD_ACE + 1] = { 0 };
+    uint64_t start;
+    double   elapsed;
+
+    shoe_init(&shoe, decks, cut);
+    start = now_ns();
+    for (long i = 0; i < cards; i++) {
+        if (i % 3 == 0)
+            shoe_hand_start(&shoe);
+        counts[shoe_draw(&shoe)]++;
+    }
+    elapsed = (now_ns() - start) / 1e9;
+    printf("shoe (%d decks, cut at %d%%): %ld cards in %.2fs (%.0f cards/sec)\n",
+           decks, cut, cards, elapsed, cards / elapsed);
+
+    uint64_t sum = 0;
+    srand(time(0));
+    start = now_ns();
+    for (long i = 0; i < cards; i++)
+        sum += rand() % 11 + 1;
+    elapsed = (now_ns() - start) / 1e9;
+    printf("rand() %% 11 + 1: %.0f cards/sec (sum %llu)\n", cards / elapsed, (unsigned long long)sum);
+
+    // Card values against a deck's 1/13 per value and 4/13 for tens.
+    double chi2 = 0;
+    int    df = 0, failed = 0;
+    for (int v = 2; v <= CARD_ACE; v++) {
+        double expected = cards * (v == 10 ? 4.0 : 1.0) / 13;
+        chi2 += (counts[v] - expected) * (counts[v] - expected) / expected;
+        df++;
+    }
+    df--;
+    failed += chi2 >= chi2_critical(df);
+    printf("card values: chi2 %.1f, df %d, critical %.1f: %s\n",
+           chi2, df, chi2_critical(df), chi2 < chi2_critical(df) ? "ok" : "FAIL");
+
+    // Shuffle uniformity: over many shuffles of one deck of distinct cards,
+    // every card should land in every position equally often. Each shuffle
+    // starts from the same order, as a reshuffle starts from fresh decks, so
+    // a bias is not hidden by shuffling the last shuffle's result again.
+    static uint64_t where[52][52];
+    shoe_init(&shoe, 1, 100);
+    for (long t = 0; t < shuffles; t++) {
+        for (int i = 0; i < 52; i++)
+            shoe.cards[i] = i;
+        shoe_shuffle_cards(&shoe, rng_next(&shoe.rng));
+        for (int pos = 0; pos < 52; pos++)
+            where[shoe.cards[pos]][pos]++;
+    }
+    chi2 = 0;
+    for (int c = 0; c < 52; c++) {
+        for (int pos = 0; pos < 52; pos++) {
+            double expected = shuffles / 52.0;
+            chi2 += (where[c][pos] - expected) * (where[c][pos] - expected) / expected;
+        }
+    }
+    df = 51 * 51;
+    failed += chi2 >= chi2_critical(df);
+    printf("shuffle positions: %ld shuffles, chi2 %.1f, df %d, critical %.1f: %s\n",
+           shuffles, chi2, df, chi2_critical(df), chi2 < chi2_critical(df) ? "ok" : "FAIL");
+
+    return failed ? 1 : 0;
+}
+
+// The game engine alone: whole hands played by the bots' policy (hit
+// below 17, an ace is 11 unless that busts) with no sockets around them.
+int bench_engine(int argc, char *argv[]) {
+    long    hands = 100000000;
+    int     decks = SHOE_DEFAULT_DECKS;
+    int     opt;
+    Shoe    shoe;
+    Game    g;
+
+    while ((opt = getopt(argc, argv, "n:D:")) != -1) {
+        switch (opt) {
+        case 'n': hands = atol(optarg); break;
+        case 'D': decks = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int64_t  net = 0;
+    uint64_t start;
+
+    shoe_init(&shoe, decks, SHOE_DEFAULT_CUT);
+    start = now_ns();
+    for (long i = 0; i < hands; i++) {
+        game_deal(&g, &shoe);
+        while (g.phase == GAME_PLAYER && g.player_score < 17) {
+            game_hit(&g, &shoe);
+            if (g.phase == GAME_ACE)
+                game_choose_ace(&g, g.player_score + CARD_ACE > GAME_TARGET ? 1 : CARD_ACE);
+        }
+        net += game_resolve(&g, &shoe);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("engine: %ld hands in %.2fs, %.1f ns/hand (%.0f hands/sec), house edge %+.3f%%\n",
+           hands, elapsed, elapsed * 1e9 / hands, hands / elapsed, -100.0 * net / hands);
+    return 0;
+}
+
+static uint64_t thread_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Hands played as by bench engine, by players taking turns, each with a
+// shoe of their own as a session has. Each hand is also recorded as the
+// server records it: built step by step, then handed to the recorder's
+// ring. What is timed is the playing thread's CPU time, so the writer's
+// work is left out even where the two share a CPU; the bench waits for
+// the writer every half ring, so that nothing is dropped either way.
+int bench_record(int argc, char *argv[]) {
+    long        hands = 10000000;
+    int         decks = SHOE_DEFAULT_DECKS, players = 1000, rotate = RECORD_DEFAULT_ROTATE, keep = 0, opt;
+    const char *compress = NULL;
+    char        dir[PATH_MAX], name[RECORD_NAME_MAX];
+    Shoe       *shoes;
+    Game        g;
+    HandRecord  h;
+
+    snprintf(dir, sizeof(dir), "/tmp/bench-record.%d", (int)getpid());
+    while ((opt = getopt(argc, argv, "n:D:P:R:z:d:")) != -1) {
+        switch (opt) {
+        case 'n': hands = atol(optarg); break;
+        case 'D': decks = atoi(optarg); break;
+        case 'P': players = atoi(optarg); break;
+        case 'R': rotate = atoi(optarg); break;
+        case 'z': compress = optarg; break;
+        case 'd': snprintf(dir, sizeof(dir), "%s", optarg); keep = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (hands < 1 || players < 1 || rotate < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stats = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    shoes = malloc(players * sizeof(Shoe));
+    if (stats == MAP_FAILED || shoes == NULL || (mkdir(dir, 0755) < 0 && errno != EEXIST) ||
+        recorder_init(dir, rotate, compress, decks) < 0 || recorder_start() < 0) {
+        fprintf(stderr, "Failed to set up the recorder in %s : %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    for (int recording = 0; recording <= 1; recording++) {
+        uint64_t start, waited = 0;
+        int64_t  net = 0;
+
+        for (int p = 0; p < players; p++)
+            shoe_init(&shoes[p], decks, SHOE_DEFAULT_CUT);
+        start = thread_ns();
+        for (long i = 0; i < hands; i++) {
+            Shoe *shoe = &shoes[i % players];
+
+            game_deal(&g, shoe);
+            if (recording)
+                record_deal(&h, shoe, g.up_card, 0);
+            while (g.phase == GAME_PLAYER && g.player_score < 17) {
+                game_hit(&g, shoe);
+                if (recording)
+                    record_card(&h, shoe, g.card);
+                if (g.phase == GAME_ACE) {
+                    int value = g.player_score + CARD_ACE > GAME_TARGET ? 1 : CARD_ACE;
+                    game_choose_ace(&g, value);
+                    if (recording)
+                        record_step(&h, value == CARD_ACE ? RECORD_ACE_HIGH : RECORD_ACE_LOW);
+                }
+            }
+            if (!recording) {
+                net += game_resolve(&g, shoe);
+                continue;
+            }
+
+            int card;
+            game_stand(&g);
+            record_step(&h, RECORD_DEALER);
+            while ((card = game_dealer_draw(&g, shoe)) != 0)
+                record_card(&h, shoe, card);
+            net += g.result;
+            snprintf(name, sizeof(name), "player%ld", i % players);
+            recorder_put(name, &g, &h);
+
+            if ((i + 1) % (RECORD_RING_SIZE / 2) == 0) {
+                uint64_t  pause = thread_ns();
+                ServerStats t;
+                do {
+                    stats_total(stats, &t);
+                    if (t.hands_recorded + t.record_dropped + RECORD_RING_SIZE / 2 <= (uint64_t)i)
+                        sched_yield();
+                } while (t.hands_recorded + t.record_dropped + RECORD_RING_SIZE / 2 <= (uint64_t)i);
+                waited += thread_ns() - pause;
+            }
+        }
+        double elapsed = (thread_ns() - start - waited) / 1e9;
+
+        printf("%s: %ld hands, %.1f ns/hand of CPU (%.0f hands/sec), house edge %+.3f%%\n",
+               recording ? "engine and recording" : "engine alone", hands, elapsed * 1e9 / hands,
+               hands / elapsed, -100.0 * net / hands);
+    }
+
+    ServerStats t;
+    uint64_t    start = now_ns(), deadline = start + 60000000000ull;
+    do {
+        usleep(RECORD_FLUSH_MS * 1000);
+        stats_total(stats, &t);
+    } while (t.hands_recorded + t.record_dropped < (uint64_t)hands && now_ns() < deadline);
+    usleep(2 * RECORD_FLUSH_MS * 1000);
+    stats_total(stats, &t);
+
+    int  files = 0;
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d != NULL && (e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "hands-", 6) != 0)
+            continue;
+        files++;
+        if (!keep) {
+            char path[PATH_MAX + 256];
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+    }
+    if (d != NULL)
+        closedir(d);
+    printf("writer: %llu hands written, %llu dropped, %.1f bytes per hand, %d file(s)%s%s\n",
+           (unsigned long long)t.hands_recorded, (unsigned long long)t.record_dropped,
+           t.hands_recorded ? (double)t.record_bytes / t.hands_recorded : 0.0, files,
+           keep ? " in " : "", keep ? dir : "");
+    if (!keep)
+        rmdir(dir);
+    free(shoes);
+    return 0;
+}
+
+// A session's prompt deadline, on the wheel and as a plain number for the
+// scan the wheel replaced.
+typedef struct {
+    Timer    timer;
+    uint64_t deadline;
+} BenchTimer;
+
+// n deadlines spread over `spread` seconds, as many sessions' prompts
+// would be: arming them, moving each once (what every answered prompt
+// does), dropping a tenth (closed sessions), then running the clock tick by
+// tick until the last expires. A linear scan of every deadline is timed
+// for comparison: its cost per tick grows with n where the wheel's does
+// not.
+static void timers_row(long n, int spread) {
+    BenchTimer *t = calloc(n, sizeof(BenchTimer));
+    TimerWheel *w = malloc(sizeof(TimerWheel));
+    uint64_t    ticks = (uint64_t)spread * 1000 / TIMER_TICK_MS, start, worst = 0;
+    uint32_t    x = 2463534242u;
+    long        fired = 0, cancelled = 0, due = 0, scans;
+    double      arm, rearm, cancel, run, scan;
+    Timer      *timer;
+
+    if (t == NULL || w == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    wheel_init(w, 0);
+
+    start = now_ns();
+    for (long i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        t[i].deadline = 1 + x % ticks;
+        timer_arm(w, &t[i].timer, t[i].deadline);
+    }
+    arm = (double)(now_ns() - start) / n;
+
+    start = now_ns();
+    for (long i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        t[i].deadline = 1 + x % ticks;
+        timer_arm(w, &t[i].timer, t[i].deadline);
+    }
+    rearm = (double)(now_ns() - start) / n;
+
+    start = now_ns();
+    for (long i = 0; i < n; i += 10) {
+        timer_cancel(w, &t[i].timer);
+        cancelled++;
+    }
+    cancel = (double)(now_ns() - start) / cancelled;
+
+    start = now_ns();
+    for (uint64_t tick = 1; tick <= ticks; tick++) {
+        uint64_t t0 = now_ns();
+        while ((timer = wheel_expire(w, tick)) != NULL)
+            fired++;
+        if (now_ns() - t0 > worst)
+            worst = now_ns() - t0;
+    }
+    run = (double)(now_ns() - start);
+    if (fired != n - cancelled || w->armed != 0)
+        fprintf(stderr, "timers: %ld of %ld fired, %llu still armed\n",
+                fired, n - cancelled, (unsigned long long)w->armed);
+
+    // Enough scans to time, but no more than a second's worth at 1M.
+    scans = n >= 100000 ? 100 : 100000000 / n;
+    start = now_ns();
+    for (long k = 0; k < scans; k++) {
+        for (long i = 0; i < n; i++)
+            due += t[i].deadline <= (uint64_t)k;
+        __asm__ volatile("" : : "g"(due) : "memory");
+    }
+    scan = (double)(now_ns() - start) / scans;
+
+    printf("%9ld %8.1f %8.1f %8.1f %10.0f %10.1f %10.1f %12.1f\n",
+           n, arm, rearm, cancel, run / ticks, run / fired, worst / 1e3, scan / 1e3);
+    free(t);
+    free(w);
+}
+
+// The timer wheel alone, at a range of sizes unless -n gives one.
+int bench_timers(int argc, char *argv[]) {
+    long n = 0;
+    int  spread = 300, opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n': n = atol(optarg); break;
+        case 's': spread = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n < 0 || spread < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%d s of deadlines in %d ms ticks; times in ns unless marked us\n", spread, TIMER_TICK_MS);
+    printf("%9s %8s %8s %8s %10s %10s %10s %12s\n",
+           "timers", "arm", "re-arm", "cancel", "per tick", "per expiry", "worst us", "scan us/tick");
+    if (n > 0) {
+        timers_row(n, spread);
+    } else {
+        for (n = 1000; n <= 1000000; n *= 10)
+            timers_row(n, spread);
+    }
+    return 0;
+}
+
+typedef struct {
+    pthread_t tid;
+    long      ops;
+    int       shared;       // all threads on slot 0, as one global counter would be
+    double    add_ns, latency_ns;
+} StatsWorker;
+
+void *stats_worker(void *arg) {
+    StatsWorker *w = arg;
+    uint64_t     start;
+
+    stat_slot = w->shared ? &stats->slots[0] : stats_claim();
+
+    start = now_ns();
+    for (long i = 0; i < w->ops; i++)
+        STAT_ADD(messages, 1);
+    w->add_ns = (double)(now_ns() - start) / w->ops;
+
+    uint64_t last = stats_clock();
+    start = now_ns();
+    for (long i = 0; i < w->ops; i++) {
+        uint64_t now = stats_clock();
+        stat_latency(LAT_HIT, now - last);
+        last = now;
+    }
+    w->latency_ns = (double)(now_ns() - start) / w->ops;
+    return NULL;
+}
+
+// What the server's metrics cost: a counter update and a latency record
+// (with the one clock read the server's event loop spends on each), each thread on its own slot and then all on
+// one shared slot. With -p, the counts per hand of a server that has just
+// been loaded turn that into nanoseconds per hand, and -H (the hands/sec
+// one core managed under that load) into a share of a hand's time.
+int bench_stats(int argc, char *argv[]) {
+    long   ops = 10000000;
+    int    threads = 1, port = 0, opt;
+    double hands_per_sec = 0;
+
+    while ((opt = getopt(argc, argv, "n:t:p:H:")) != -1) {
+        switch (opt) {
+        case 'H': hands_per_sec = atof(optarg); break;
+        case 'n': ops = atol(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (ops < 1 || threads < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stats_clock_init();
+    stats = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    StatsWorker *workers = calloc(threads, sizeof(StatsWorker));
+    if (stats == MAP_FAILED || workers == NULL) {
+        perror("setup failed");
+        return 1;
+    }
+
+    double add_ns = 0, latency_ns = 0;
+    for (int shared = 0; shared <= 1; shared++) {
+        double add = 0, latency = 0;
+
+        for (int i = 0; i < threads; i++) {
+            workers[i].ops = ops;
+            workers[i].shared = shared;
+            pthread_create(&workers[i].tid, NULL, stats_worker, &workers[i]);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i].tid, NULL);
+            add += workers[i].add_ns / threads;
+            latency += workers[i].latency_ns / threads;
+        }
+        printf("%s, %d thread(s): %.2f ns per counter update, %.2f ns per latency record\n",
+               shared ? "one shared slot" : "per-thread slots", threads, add, latency);
+        if (!shared) {
+            add_ns = add;
+            latency_ns = latency;
+        }
+    }
+
+    const StatsRegion *server = port ? map_server_stats(port) : NULL;
+    if (port && server == NULL) {
+        fprintf(stderr, "No stats for a server on port %d\n", port);
+        return 1;
+    }
+    if (server != NULL) {
+        ServerStats t;
+        LatencyHist lat[LAT_KINDS];
+        uint64_t    records = 0;
+
+        stats_total(server, &t);
+        stats_latency_total(server, lat);
+        for (int k = 0; k < LAT_KINDS; k++)
+            for (int b = 0; b <= LATENCY_BUCKETS; b++)
+                records += lat[k].buckets[b];
+        if (t.hands == 0) {
+            fprintf(stderr, "The server has not played any hands yet\n");
+            return 1;
+        }
+
+        // Every counter a hand touches: one add per message, two per send
+        // and recv, and the hand, outcome, round and dealer-card counts.
+        double updates = (t.messages + 2.0 * t.send_calls + 2.0 * t.recv_calls + 2.0 * t.accepts +
+                          2.0 * t.hands + t.rounds + t.dealer_cards) / t.hands;
+        double per_hand = updates * add_ns + (double)records / t.hands * latency_ns;
+
+        printf("server on port %d: %.1f counter updates and %.1f latency records per hand, %.0f ns of metrics per hand\n",
+               port, updates, (double)records / t.hands, per_hand);
+        if (hands_per_sec > 0)
+            printf("at %.0f hands/sec per core a hand takes %.0f ns: metrics are %.3f%% of it\n",
+                   hands_per_sec, 1e9 / hands_per_sec, 100 * per_hand * hands_per_sec / 1e9);
+    }
+    return 0;
+}
+
+typedef struct {
+    pthread_t tid;
+    long      records;
+    Histogram calls;
+} LogWorker;
+
+void *log_worker(void *arg) {
+    LogWorker *w = arg;
+    char       name[16];
+
+    for (long i = 0; i < w->records; i++) {
+        snprintf(name, sizeof(name), "player%ld", i % 100000);
+        uint64_t start = now_ns();
+        log_event(LOG_INFO, LOG_EVENT_CONNECT, name);
+        hist_record(&w->calls, now_ns() - start);
+    }
+    return NULL;
+}
+
+// What a connect record costs the thread that logs it: first written at
+// once to the file, as the server used to, then handed to the logger ring.
+// The async run waits for the writer and reports what it wrote and dropped.
+int bench_log(int argc, char *argv[]) {
+    long        records = 200000;
+    int         threads = 1, opt;
+    char        path[64];
+
+    snprintf(path, sizeof(path), "/tmp/bench-log.%d", (int)getpid());
+    while ((opt = getopt(argc, argv, "n:t:l:")) != -1) {
+        switch (opt) {
+        case 'n': records = atol(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'l': snprintf(path, sizeof(path), "%s", optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (records < 1 || threads < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stats = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    LogWorker *workers = calloc(threads, sizeof(LogWorker));
+    if (stats == MAP_FAILED || workers == NULL) {
+        perror("setup failed");
+        return 1;
+    }
+
+    for (int async = 0; async <= 1; async++) {
+        Histogram calls = {0};
+        uint64_t  start;
+
+        if (logger_init(path, !async) < 0 || logger_start() < 0) {
+            fprintf(stderr, "Failed to open log %s : %s\n", path, strerror(errno));
+            return 1;
+        }
+        start = now_ns();
+        for (int i = 0; i < threads; i++) {
+            memset(&workers[i].calls, 0, sizeof(Histogram));
+            workers[i].records = records;
+            pthread_create(&workers[i].tid, NULL, log_worker, &workers[i]);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i].tid, NULL);
+            for (int b = 0; b < HIST_BUCKETS; b++)
+                calls.counts[b] += workers[i].calls.counts[b];
+            calls.total += workers[i].calls.total;
+            if (workers[i].calls.max > calls.max)
+                calls.max = workers[i].calls.max;
+        }
+        double elapsed = (now_ns() - start) / 1e9;
+
+        printf("%s, %d thread(s): %.0f records/sec, per call p50 %.2f us, p99 %.2f us, p999 %.2f us, max %.1f us\n",
+               async ? "async ring" : "synchronous write", threads, calls.total / elapsed,
+               hist_percentile(&calls, 0.50) / 1e3, hist_percentile(&calls, 0.99) / 1e3,
+               hist_percentile(&calls, 0.999) / 1e3, calls.max / 1e3);
+        if (async) {
+            ServerStats t;
+            uint64_t    deadline = now_ns() + 10000000000ull;
+
+            do {
+                usleep(LOG_FLUSH_MS * 1000);
+                stats_total(stats, &t);
+            } while (t.log_records + t.log_dropped < calls.total && now_ns() < deadline);
+            printf("writer: %llu records written, %llu dropped (ring of %d)\n",
+                   (unsigned long long)t.log_records, (unsigned long long)t.log_dropped, LOG_RING_SIZE);
+        }
+    }
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "scale") == 0)
+        return bench_scale(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "log") == 0)
+        return bench_log(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "stats") == 0)
+        return bench_stats(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "engine") == 0)
+        return bench_engine(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "shoe") == 0)
+        return bench_shoe(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "leaderboard") == 0)
+        return bench_leaderboard(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "journal") == 0)
+        return bench_journal(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "resume") == 0)
+        return bench_resume(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "timers") == 0)
+        return bench_timers(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "record") == 0)
+        return bench_record(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "load") == 0)
+        return bench_load(argc - 1, argv + 1);
+    return bench_load(argc, argv);
+}
@@ -1,289 +1,814 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <netinet/in.h>
-#include <errno.h>
-#include <sys/select.h>
-
-#define IPV4_MULTICAST_IP "239.255.255.250"
-#define IPV6_MULTICAST_IP "ff02::1"
-#define MULTICAST_PORT 12951
-#define MAXLINE 1024
-
-typedef enum {
-    IPV4,
-    IPV6
-} IP_VERSION;
-
-void receive_multicast(char *server_ip, IP_VERSION version) {
-    int sockfd;
-    char buffer[MAXLINE];
-
-    if (version == IPV4) {
-        struct sockaddr_in addr;
-        socklen_t addrlen = sizeof(addr);
-
-        if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-            perror("socket creation failed");
-            exit(EXIT_FAILURE);
-        }
-
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        addr.sin_port = htons(MULTICAST_PORT);
-
-        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-            perror("bind failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        struct ip_mreq mreq;
-        mreq.imr_multiaddr.s_addr = inet_addr(IPV4_MULTICAST_IP);
-        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
-
-        if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
-            perror("setsockopt failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        printf("Waiting for IPv4 server IP from multicast...\n");
-
-        if (recvfrom(sockfd, buffer, MAXLINE, 0, (struct sockaddr *)&addr, &addrlen) < 0) {
-            perror("recvfrom failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-    } else {  // IPv6
-        struct sockaddr_in6 addr;
-        socklen_t addrlen = sizeof(addr);
-
-        if ((sockfd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
-            perror("socket creation failed");
-            exit(EXIT_FAILURE);
-        }
-
-        memset(&addr, 0, sizeof(addr));
-        addr.sin6_family = AF_INET6;
-        addr.sin6_addr = in6addr_any;
-        addr.sin6_port = htons(MULTICAST_PORT);
-
-        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-            perror("bind failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        struct ipv6_mreq mreq6;
-        inet_pton(AF_INET6, IPV6_MULTICAST_IP, &mreq6.ipv6mr_multiaddr);
-        mreq6.ipv6mr_interface = 0;  // Use default interface
-
-        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof(mreq6)) < 0) {
-            perror("setsockopt failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        printf("Waiting for IPv6 server IP from multicast...\n");
-
-        if (recvfrom(sockfd, buffer, MAXLINE, 0, (struct sockaddr *)&addr, &addrlen) < 0) {
-            perror("recvfrom failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    strncpy(server_ip, buffer, MAXLINE);
-    printf("Received server IP: %s\n", server_ip);
-
-    close(sockfd);
-}
-
-void play_game(int sockfd) {
-    char buffer[MAXLINE];
-    int n;
-    fd_set readfds;
-    struct timeval tv;
-
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        FD_SET(STDIN_FILENO, &readfds);
-
-        tv.tv_sec = 30;
-        tv.tv_usec = 0;
-
-        int activity = select(sockfd + 1, &readfds, NULL, NULL, &tv);
-
-        if (activity < 0) {
-            perror("select failed");
-            break;
-        } else if (activity == 0) {
-            printf("Timeout, no data received\n");
-            continue;
-        }
-
-        if (FD_ISSET(sockfd, &readfds)) {
-            memset(buffer, 0, MAXLINE);
-            n = recv(sockfd, buffer, MAXLINE, 0);
-
-            if (n <= 0) {
-                if (n == 0) {
-                    printf("Server closed the connection\n");
-                } else {
-                    perror("recv failed");
-                }
-                break;
-            }
-
-            printf("Received from server: %s", buffer);
-
-
-            if (strstr(buffer, "Draw a card? (yes/no):")) {
-                memset(buffer, 0, MAXLINE);
-                fgets(buffer, MAXLINE, stdin);
-                buffer[strcspn(buffer, "\n")] = 0;
-
-                if (strcmp (buffer, "yes") != 0 && strcmp(buffer, "no") != 0) {
-                    printf("Invalid input. Please type 'yes' or 'no'.\n");
-                    continue;
-                }
-
-                if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
-                    perror("send failed");
-                    break;
-                }
-            } else if (strstr(buffer, "Do you want it to be 1 or 11? (1/11):")) {
-                memset(buffer, 0, MAXLINE);
-                fgets(buffer, MAXLINE, stdin);
-                buffer[strcspn(buffer, "\n")] = 0;
-                if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
-                    perror("send failed");
-                    break;
-                }
-            }
-        }
-
-        if (FD_ISSET(STDIN_FILENO, &readfds)) {
-            memset(buffer, 0, MAXLINE);
-            fgets(buffer, MAXLINE, stdin);
-            buffer[strcspn(buffer, "\n")] = 0;
-            if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
-                perror("send failed");
-                break;
-            }
-        }
-    }
-}
-
-int main() {
-    char server_ip[INET6_ADDRSTRLEN];
-    int sockfd;
-    IP_VERSION version;
-    int choice = 0;
-
-    printf("Choose IP version:\n");
-    printf("1. IPv4\n");
-    printf("2. IPv6\n");
-    printf("Choice: ");
-    
-    if (scanf("%d", &choice) != 1) {
-        fprintf(stderr, "Invalid input. Defaulting to IPv4.\n");
-        choice = 1;
-    }
-    getchar();
-    
-    version = (choice == 2) ? IPV6 : IPV4;
-    printf("Version selected: %s\n", (version == IPV6) ? "IPv6" : "IPv4");
-    
-    // Receive multicast with selected version
-    receive_multicast(server_ip, version);
-    
-    if (version == IPV6) {  // IPV6
-        struct sockaddr_in6 servaddr6;
-        
-        if ((sockfd = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
-            perror("socket creation failed");
-            exit(EXIT_FAILURE);
-        }
-
-        memset(&servaddr6, 0, sizeof(servaddr6));
-        servaddr6.sin6_family = AF_INET6;
-        servaddr6.sin6_port = htons(MULTICAST_PORT);
-
-        printf("Trying to connect using IPv6 address: %s\n", server_ip);
-
-        if (inet_pton(AF_INET6, server_ip, &servaddr6.sin6_addr) <= 0) {
-            perror("inet_pton failed for IPv6");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        if (connect(sockfd, (struct sockaddr *)&servaddr6, sizeof(servaddr6)) < 0) {
-            perror("connect failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-        
-        printf("Successfully connected using IPv6\n");
-    } 
-    else {  // IPV4
-        struct sockaddr_in servaddr;
-        
-        if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-            perror("socket creation failed");
-            exit(EXIT_FAILURE);
-        }
-
-        memset(&servaddr, 0, sizeof(servaddr));
-        servaddr.sin_family = AF_INET;
-        servaddr.sin_port = htons(MULTICAST_PORT);
-
-        printf("Trying to connect using IPv4 address: %s\n", server_ip);
-
-        if (inet_pton(AF_INET, server_ip, &servaddr.sin_addr) <= 0) {
-            perror("inet_pton failed for IPv4");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-
-        if (connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-            perror("connect failed");
-            close(sockfd);
-            exit(EXIT_FAILURE);
-        }
-        
-        printf("Successfully connected using IPv4\n");
-    }
-
-    printf("Connected to server at %s\n", server_ip);
-
-    char buffer[MAXLINE];
-    memset(buffer, 0, MAXLINE);
-    if (recv(sockfd, buffer, MAXLINE, 0) <= 0) {
-        perror("recv failed");
-        close(sockfd);
-        exit(EXIT_FAILURE);
-    }
-    printf("%s", buffer);
-
-    memset(buffer, 0, MAXLINE);
-    fgets(buffer, MAXLINE, stdin);
-    buffer[strcspn(buffer, "\n")] = 0;
-    if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
-        perror("send failed");
-        close(sockfd);
-        exit(EXIT_FAILURE);
-    }
-
-    play_game(sockfd);
-
-    close(sockfd);
-    return 0;
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <getopt.h>
+#include <time.h>
+#include <signal.h>
+#include "protocol.h"
+#include "engine.h"
+#include "ev.h"
+#include "discovery.h"
+
+#define RECONNECT_FIRST_MS 100      // the pause after a failed reconnect, doubling
+#define RECONNECT_MAX_MS 2000
+
+#define MAXLINE 1024
+
+// Waits for the servers' beacons on both groups and picks the least
+// loaded instance; `found` gets its addresses in either family.
+void receive_multicast(Discovered *found) {
+    printf("Looking for servers...\n");
+    if (discover(0, -1, found) < 0) {
+        perror("discovery failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Found %d server(s); the least loaded is %s port %d with %u of %u sessions\n",
+           found->heard, found->address, found->beacon.port, found->beacon.sessions, found->beacon.capacity);
+}
+
+// The addresses a name or literal given with -a resolves to, alternating
+// families with IPv6 first, as Happy Eyeballs wants them.
+int resolve_server(const char *address, int port, Discovered *found) {
+    struct addrinfo  hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+    char             service[16];
+
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(address, service, &hints, &res) != 0)
+        return -1;
+
+    memset(found, 0, sizeof(*found));
+    for (int family = AF_INET6; ; family = AF_INET) {
+        for (ai = res; ai != NULL && found->naddrs < 2; ai = ai->ai_next) {
+            if (ai->ai_family != family)
+                continue;
+            memcpy(&found->addrs[found->naddrs], ai->ai_addr, ai->ai_addrlen);
+            found->addrlens[found->naddrs++] = ai->ai_addrlen;
+            break;
+        }
+        if (family == AF_INET)
+            break;
+    }
+    freeaddrinfo(res);
+    return found->naddrs > 0 ? 0 : -1;
+}
+
+// Text mode: prints whatever the server sends and recognises its prompts.
+void play_game(int sockfd) {
+    char buffer[MAXLINE];
+    int n;
+    fd_set readfds;
+    struct timeval tv;
+
+    while (1) {
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+
+        tv.tv_sec = 30;
+        tv.tv_usec = 0;
+
+        int activity = select(sockfd + 1, &readfds, NULL, NULL, &tv);
+
+        if (activity < 0) {
+            perror("select failed");
+            break;
+        } else if (activity == 0) {
+            printf("Timeout, no data received\n");
+            continue;
+        }
+
+        if (FD_ISSET(sockfd, &readfds)) {
+            memset(buffer, 0, MAXLINE);
+            n = recv(sockfd, buffer, MAXLINE, 0);
+
+            if (n <= 0) {
+                if (n == 0) {
+                    printf("Server closed the connection\n");
+                } else {
+                    perror("recv failed");
+                }
+                break;
+            }
+
+            printf("Received from server: %s", buffer);
+
+
+            if (strstr(buffer, "Draw a card? (yes/no):")) {
+                memset(buffer, 0, MAXLINE);
+                fgets(buffer, MAXLINE, stdin);
+                buffer[strcspn(buffer, "\n")] = 0;
+
+                if (strcmp (buffer, "yes") != 0 && strcmp(buffer, "no") != 0 &&
+                    strcmp(buffer, "?") != 0 && strcmp(buffer, "hint") != 0) {
+                    printf("Invalid input. Please type 'yes' or 'no' ('?' for a hint).\n");
+                    continue;
+                }
+
+                if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
+                    perror("send failed");
+                    break;
+                }
+            } else if (strstr(buffer, "Do you want it to be 1 or 11? (1/11):")) {
+                memset(buffer, 0, MAXLINE);
+                fgets(buffer, MAXLINE, stdin);
+                buffer[strcspn(buffer, "\n")] = 0;
+                if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
+                    perror("send failed");
+                    break;
+                }
+            }
+        }
+
+        if (FD_ISSET(STDIN_FILENO, &readfds)) {
+            memset(buffer, 0, MAXLINE);
+            fgets(buffer, MAXLINE, stdin);
+            buffer[strcspn(buffer, "\n")] = 0;
+            if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
+                perror("send failed");
+                break;
+            }
+        }
+    }
+}
+
+int send_frame(int sockfd, int type, const void *payload, size_t len) {
+    uint8_t frame[FRAME_HEADER_LEN + FRAME_MAX_PAYLOAD];
+
+    if (len > FRAME_MAX_PAYLOAD)
+        len = FRAME_MAX_PAYLOAD;
+    len = frame_put(frame, type, payload, len);
+    if (send(sockfd, frame, len, 0) < 0) {
+        perror("send failed");
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    int      prompt;        // the MSG_PROMPT_* / MSG_MENU awaiting an answer, or 0
+    int      prompt_value;  // the score or card it showed
+    int      option;        // last menu option sent, to title ranking listings
+    uint32_t rows;          // rows of the current listing so far
+    uint32_t my_rank;
+    int      my_wins, my_draws, my_losses;
+    char     name[50];      // to log in again if a resume is refused
+    uint64_t token;         // to resume with after a dropped connection, or 0
+    int      grace;         // seconds the server keeps the session
+    int      resuming;
+} BinaryClient;
+
+void show_message(BinaryClient *c, int type, const uint8_t *p, size_t len) {
+    switch (type) {
+    case MSG_PROMPT_NAME:
+        printf("Enter your name: ");
+        c->prompt = type;
+        break;
+
+    case MSG_MENU:
+        printf("Welcome, %.*s! Choose an option:\n"
+               "1. Play Blackjack\n"
+               "2. View Rankings\n"
+               "3. Exit\n"
+               "4. Top Players\n"
+               "5. My Rank\n"
+               "> ", (int)len, (const char *)p);
+        c->prompt = type;
+        break;
+
+    case MSG_DEAL:
+        if (len < 3)
+            break;
+        if (p[0] == DEAL_DEALER_UP)
+            printf("The dealer's face-up card is: %d\n", p[1]);
+        else if (p[0] == DEAL_DEALER)
+            printf("The dealer drew a %d. Dealer's score: %d.\n", p[1], p[2]);
+        else if (p[2] == GAME_TARGET)
+            printf("You drew %d. Your total score is %d! BLACKJACK!\n", p[1], p[2]);
+        else if (game_busted(p[2]))
+            printf("You drew %d. Your total score is %d. BUST!\n", p[1], p[2]);
+        else
+            printf("You drew %d. Your total score is now %d.\n", p[1], p[2]);
+        break;
+
+    case MSG_PROMPT_HIT:
+        if (len < 1)
+            break;
+        printf("Your current score: %d. Draw a card? (yes/no): ", p[0]);
+        c->prompt = type;
+        c->prompt_value = p[0];
+        break;
+
+    case MSG_PROMPT_ACE:
+        if (len < 1)
+            break;
+        printf("You drew a %d. Do you want it to be 1 or 11? (1/11): ", p[0]);
+        c->prompt = type;
+        c->prompt_value = p[0];
+        break;
+
+    case MSG_RESULT:
+        if (len < 3 || game_busted(p[1]))
+            break;
+        if (game_busted(p[2]))
+            printf("Dealer BUST! You win with a score of %d!\n", p[1]);
+        else if ((int8_t)p[0] < 0)
+            printf("Dealer wins with a score of %d against your %d.\n", p[2], p[1]);
+        else if (p[0] > 0)
+            printf("You win with a score of %d against the dealer's %d.\n", p[1], p[2]);
+        else
+            printf("It's a tie! Both you and the dealer have a score of %d.\n", p[1]);
+        break;
+
+    case MSG_RANKING_ROW: {
+        if (len < RANKING_ROW_FIXED)
+            break;
+        uint32_t rank = get_u32(p);
+        int wins = get_u32(p + 4), draws = get_u32(p + 8), losses = get_u32(p + 12);
+        int name_len = len - RANKING_ROW_FIXED;
+        const char *name = (const char *)p + RANKING_ROW_FIXED;
+
+        if (c->option == 5) {
+            c->my_rank = rank;
+            c->my_wins = wins;
+            c->my_draws = draws;
+            c->my_losses = losses;
+            break;
+        }
+        if (c->rows++ == 0)
+            printf(c->option == 2 ? "Current Rankings:\n" : "Top Players:\n");
+        if (rank == 0)
+            printf("%.*s - W: %d, D: %d, L: %d\n", name_len, name, wins, draws, losses);
+        else
+            printf("%u. %.*s - W: %d, D: %d, L: %d\n", rank, name_len, name, wins, draws, losses);
+        break;
+    }
+
+    case MSG_RANKING_END:
+        if (len < 4)
+            break;
+        if (c->option == 5 && c->my_rank != 0)
+            printf("Your rank: %u of %u (W: %d, D: %d, L: %d)\n",
+                   c->my_rank, get_u32(p), c->my_wins, c->my_draws, c->my_losses);
+        else if (c->option == 5)
+            printf("You have no recorded games yet.\n");
+        else if (c->rows == 0)
+            printf("No players ranked yet.\n");
+        c->rows = 0;
+        c->my_rank = 0;
+        break;
+
+    case MSG_TEXT:
+        printf("%.*s", (int)len, (const char *)p);
+        break;
+
+    case MSG_QUEUE:
+        if (len < 6)
+            break;
+        printf("You are number %d in the lobby. Estimated wait: %.1f s.\n", get_u16(p), get_u32(p + 2) / 1000.0);
+        break;
+
+    case MSG_RESUME:
+        if (len < 10)
+            break;
+        c->token = get_u64(p);
+        c->grace = get_u16(p + 8);
+        if (c->resuming)
+            printf("Session resumed.\n");
+        c->resuming = 0;
+        break;
+
+    case MSG_HINT: {
+        if (len < 8)
+            break;
+        double stand = (int16_t)get_u16(p) / (double)EV_UNIT, hit = (int16_t)get_u16(p + 2) / (double)EV_UNIT;
+        double low = (int16_t)get_u16(p + 4) / (double)EV_UNIT, high = (int16_t)get_u16(p + 6) / (double)EV_UNIT;
+
+        if (c->prompt == MSG_PROMPT_ACE) {
+            printf("\nHint: counting it as 1 is worth %+.3f, as 11 %+.3f a bet. Count it as %d.\n"
+                   "You drew a %d. Do you want it to be 1 or 11? (1/11): ",
+                   low, high, high > low ? 11 : 1, c->prompt_value);
+        } else if (c->prompt == MSG_PROMPT_HIT) {
+            printf("\nHint: standing is worth %+.3f, drawing %+.3f a bet. %s.\n"
+                   "Your current score: %d. Draw a card? (yes/no): ",
+                   stand, hit, hit > stand ? "Draw a card" : "Stand", c->prompt_value);
+        }
+        break;
+    }
+    }
+    fflush(stdout);
+}
+
+// Turns a typed line into the frame the pending prompt expects.
+int send_answer(int sockfd, BinaryClient *c, const char *line) {
+    uint8_t payload[3];
+
+    switch (c->prompt) {
+    case MSG_PROMPT_NAME:
+        c->prompt = 0;
+        snprintf(c->name, sizeof(c->name), "%s", line);
+        return send_frame(sockfd, MSG_NAME, line, strlen(line));
+
+    case MSG_MENU: {
+        int option = 0, arg = 0;
+        sscanf(line, "%d %d", &option, &arg);   // "4 25": the top 25
+        c->option = option;
+        payload[0] = option > 0 && option < 256 ? option : 0;
+        put_u16(payload + 1, arg > 0 && arg < 65536 ? arg : 0);
+        c->prompt = 0;
+        return send_frame(sockfd, MSG_CHOOSE, payload, 3);
+    }
+
+    case MSG_PROMPT_HIT:
+        if (strcmp(line, "?") == 0 || strcmp(line, "hint") == 0)
+            return send_frame(sockfd, MSG_HINT, NULL, 0);
+        if (strcmp(line, "yes") != 0 && strcmp(line, "no") != 0) {
+            printf("Invalid input. Please type 'yes' or 'no' ('?' for a hint).\n");
+            return 0;
+        }
+        payload[0] = strcmp(line, "yes") == 0;
+        c->prompt = 0;
+        return send_frame(sockfd, MSG_HIT, payload, 1);
+
+    case MSG_PROMPT_ACE:
+        if (strcmp(line, "?") == 0 || strcmp(line, "hint") == 0)
+            return send_frame(sockfd, MSG_HINT, NULL, 0);
+        payload[0] = atoi(line) == 11 ? 11 : atoi(line) == 1 ? 1 : 0;
+        c->prompt = 0;
+        return send_frame(sockfd, MSG_ACE, payload, 1);
+    }
+
+    return 0;
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The connection dropped: connect to the same server again and send the
+// resume token with the hello, retrying with a growing pause until the
+// server's grace period is over. Returns the new socket, or -1.
+int reconnect(const Discovered *found, BinaryClient *c) {
+    uint64_t give_up = monotonic_ms() + (uint64_t)c->grace * 1000;
+    int      pause = RECONNECT_FIRST_MS;
+    uint8_t  hello[9];
+
+    hello[0] = PROTOCOL_VERSION;
+    put_u64(hello + 1, c->token);
+    printf("\nConnection lost. Reconnecting...\n");
+    fflush(stdout);
+
+    while (1) {
+        int sockfd = happy_connect(found->addrs, found->addrlens, found->naddrs, NULL);
+
+        if (sockfd >= 0) {
+            if (send_frame(sockfd, MSG_HELLO, hello, sizeof(hello)) == 0) {
+                c->prompt = 0;
+                c->resuming = 1;
+                return sockfd;
+            }
+            close(sockfd);
+        }
+        if (monotonic_ms() + pause > give_up)
+            return -1;
+        usleep(pause * 1000);
+        pause = pause * 2 < RECONNECT_MAX_MS ? pause * 2 : RECONNECT_MAX_MS;
+    }
+}
+
+// Binary mode: the server sends typed frames, which are rendered here, and
+// every answer goes back as a frame, so nothing depends on how TCP splits
+// the stream. A dropped connection is resumed where it left off. Returns
+// the socket it ended on.
+int play_binary(int sockfd, const Discovered *found) {
+    uint8_t      in[2 * (FRAME_HEADER_LEN + FRAME_MAX_PAYLOAD)];
+    size_t       in_len = 0;
+    int          framed = 0;    // seen the server's first frame
+    BinaryClient client;
+    char         line[MAXLINE];
+    uint8_t      version = PROTOCOL_VERSION;
+    fd_set       readfds;
+
+    memset(&client, 0, sizeof(client));
+    if (send_frame(sockfd, MSG_HELLO, &version, 1) < 0)
+        return sockfd;
+
+    while (1) {
+        int lost = 0;
+
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        if (client.prompt != 0)     // lines typed ahead wait for their prompt
+            FD_SET(STDIN_FILENO, &readfds);
+
+        if (select(sockfd + 1, &readfds, NULL, NULL, NULL) < 0) {
+            perror("select failed");
+            break;
+        }
+
+        if (FD_ISSET(sockfd, &readfds)) {
+            ssize_t n = recv(sockfd, in + in_len, sizeof(in) - in_len, 0);
+            if (n <= 0) {
+                // After a goodbye, or without a token, there is nothing to resume.
+                if (client.token == 0 || client.option == 3) {
+                    if (n == 0)
+                        printf("Server closed the connection\n");
+                    else
+                        perror("recv failed");
+                    break;
+                }
+                lost = 1;
+            } else {
+                in_len += n;
+            }
+
+            // The text greeting sent before our hello was read.
+            if (!framed) {
+                uint8_t *start = memchr(in, FRAME_MAGIC, in_len);
+                size_t skip = start ? (size_t)(start - in) : in_len;
+                memmove(in, in + skip, in_len - skip);
+                in_len -= skip;
+                framed = start != NULL;
+            }
+
+            uint8_t       *p = in;
+            const uint8_t *payload;
+            size_t         payload_len;
+            int            type;
+            long           used;
+
+            while ((used = frame_get(p, in + in_len - p, &type, &payload, &payload_len)) > 0) {
+                show_message(&client, type, payload, payload_len);
+                p += used;
+            }
+            if (used < 0) {
+                fprintf(stderr, "Malformed frame from server\n");
+                break;
+            }
+            in_len -= p - in;
+            memmove(in, p, in_len);
+
+            // The resume was refused: log in again under the same name.
+            if (client.resuming && client.prompt == MSG_PROMPT_NAME && client.name[0] != '\0') {
+                printf("%s\n", client.name);
+                client.resuming = 0;
+                lost = send_answer(sockfd, &client, client.name) < 0;
+            }
+        }
+
+        if (!lost && client.prompt != 0 && FD_ISSET(STDIN_FILENO, &readfds)) {
+            if (fgets(line, sizeof(line), stdin) == NULL)
+                break;
+            line[strcspn(line, "\n")] = 0;
+            lost = send_answer(sockfd, &client, line) < 0;
+        }
+
+        if (lost) {
+            if (client.token == 0 || client.option == 3)
+                break;
+            close(sockfd);
+            if ((sockfd = reconnect(found, &client)) < 0) {
+                fprintf(stderr, "Could not reconnect to the server\n");
+                break;
+            }
+            in_len = 0;
+            framed = 0;
+        }
+    }
+    return sockfd;
+}
+
+// Headless mode: a policy answers every prompt, so nothing waits on a
+// person. policy[score][up-card] is 'H' or 'S'.
+typedef struct {
+    char     policy[GAME_TARGET + 1][CARD_ACE + 1];
+    int      games;             // hands to play on this connection
+    int      started;           // hands asked for so far
+    int      choices_ahead;     // menu choices sent before their menu arrived
+    int      score, up_card;
+    int      quiet;
+    uint64_t wins, draws, losses, lobby_full;
+} Headless;
+
+void policy_default(Headless *h, int hit_below) {
+    for (int score = 0; score <= GAME_TARGET; score++)
+        for (int up = 0; up <= CARD_ACE; up++)
+            h->policy[score][up] = score < hit_below ? 'H' : 'S';
+}
+
+// Reads a strategy table in the layout sim_blackjack prints as "best move":
+// one row per player score, then H or S for dealer up-cards 2 to 11 ('-'
+// keeps the default). Any other line, such as a header, is skipped.
+int policy_load(Headless *h, const char *path) {
+    FILE *fp = fopen(path, "r");
+    char  line[MAXLINE];
+    int   rows = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s : %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char  moves[CARD_ACE + 1];
+        char *p = line, *end;
+        long  score = strtol(p, &end, 10);
+        int   up;
+
+        if (end == p || score < 0 || score > GAME_TARGET)
+            continue;
+        for (p = end, up = 2; up <= CARD_ACE; up++) {
+            while (*p == ' ' || *p == '\t')
+                p++;
+            if (*p != 'H' && *p != 'S' && *p != '-')
+                break;
+            moves[up] = *p++;
+        }
+        if (up <= CARD_ACE)
+            continue;
+        for (up = 2; up <= CARD_ACE; up++) {
+            if (moves[up] != '-')
+                h->policy[score][up] = moves[up];
+        }
+        rows++;
+    }
+    fclose(fp);
+
+    if (rows == 0) {
+        fprintf(stderr, "No strategy rows in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// The next menu choice: another hand, or goodbye once all are asked for.
+int headless_choose(int sockfd, Headless *h) {
+    uint8_t payload[3] = { 1, 0, 0 };
+
+    if (h->started < h->games)
+        h->started++;
+    else
+        payload[0] = 3;
+    return send_frame(sockfd, MSG_CHOOSE, payload, sizeof(payload));
+}
+
+int headless_message(int sockfd, Headless *h, int type, const uint8_t *p, size_t len) {
+    uint8_t answer;
+
+    switch (type) {
+    case MSG_MENU:
+        // Usually already answered: the choice went out with the stand.
+        if (h->choices_ahead > 0) {
+            h->choices_ahead--;
+            return 0;
+        }
+        return headless_choose(sockfd, h);
+
+    case MSG_DEAL:
+        if (len >= 3 && p[0] == DEAL_DEALER_UP)
+            h->up_card = p[1];
+        return 0;
+
+    case MSG_PROMPT_HIT:
+        if (len < 1)
+            return 0;
+        h->score = p[0];
+        answer = h->policy[h->score][h->up_card] == 'H';
+        if (send_frame(sockfd, MSG_HIT, &answer, 1) < 0)
+            return -1;
+        // Standing always ends the turn, so the next choice can follow in
+        // the same round trip instead of waiting for the menu.
+        if (answer)
+            return 0;
+        h->choices_ahead++;
+        return headless_choose(sockfd, h);
+
+    case MSG_PROMPT_ACE:
+        answer = h->score + CARD_ACE > GAME_TARGET ? 1 : CARD_ACE;
+        return send_frame(sockfd, MSG_ACE, &answer, 1);
+
+    case MSG_RESULT:
+        if (len < 1)
+            return 0;
+        if ((int8_t)p[0] > 0)
+            h->wins++;
+        else if ((int8_t)p[0] < 0)
+            h->losses++;
+        else
+            h->draws++;
+        return 0;
+
+    case MSG_TEXT:
+        if (len >= 18 && memcmp(p, "The lobby is full.", 18) == 0) {
+            h->lobby_full++;
+            h->started--;       // the menu that follows asks again
+        }
+        if (!h->quiet)
+            printf("%.*s", (int)len, (const char *)p);
+        return 0;
+    }
+    return 0;
+}
+
+// Plays h->games hands on one connection. The hello, the name and the first
+// menu choice go out together; afterwards every answer is sent the moment
+// its prompt arrives.
+int play_headless(int sockfd, Headless *h, const char *name) {
+    uint8_t         in[2 * (FRAME_HEADER_LEN + FRAME_MAX_PAYLOAD)];
+    size_t          in_len = 0;
+    int             framed = 0;
+    uint8_t         version = PROTOCOL_VERSION;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (send_frame(sockfd, MSG_HELLO, &version, 1) < 0 ||
+        send_frame(sockfd, MSG_NAME, name, strlen(name)) < 0)
+        return -1;
+    h->choices_ahead++;
+    if (headless_choose(sockfd, h) < 0)
+        return -1;
+
+    while (1) {
+        ssize_t n = recv(sockfd, in + in_len, sizeof(in) - in_len, 0);
+        if (n <= 0) {
+            if (n < 0)
+                perror("recv failed");
+            break;
+        }
+        in_len += n;
+
+        if (!framed) {
+            uint8_t *start = memchr(in, FRAME_MAGIC, in_len);
+            size_t skip = start ? (size_t)(start - in) : in_len;
+            memmove(in, in + skip, in_len - skip);
+            in_len -= skip;
+            framed = start != NULL;
+        }
+
+        uint8_t       *p = in;
+        const uint8_t *payload;
+        size_t         payload_len;
+        int            type;
+        long           used;
+
+        while ((used = frame_get(p, in + in_len - p, &type, &payload, &payload_len)) > 0) {
+            if (headless_message(sockfd, h, type, payload, payload_len) < 0)
+                return -1;
+            p += used;
+        }
+        if (used < 0) {
+            fprintf(stderr, "Malformed frame from server\n");
+            return -1;
+        }
+        in_len -= p - in;
+        memmove(in, p, in_len);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double   elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    uint64_t hands = h->wins + h->draws + h->losses;
+
+    printf("%llu hands in %.2fs (%.0f hands/sec): %llu won, %llu drawn, %llu lost",
+           (unsigned long long)hands, elapsed, hands / elapsed,
+           (unsigned long long)h->wins, (unsigned long long)h->draws, (unsigned long long)h->losses);
+    if (h->lobby_full > 0)
+        printf(", turned away by a full lobby %llu times", (unsigned long long)h->lobby_full);
+    printf("\n");
+    return hands == (uint64_t)h->games ? 0 : -1;
+}
+
+void usage(const char *pname) {
+    fprintf(stderr, "Usage: %s [-t] [-a address] [-p port]\n"
+                    "       %s -g hands [-a address] [-p port] [-N name] [-H hit below | -P strategy file] [-q]\n", pname, pname);
+}
+
+int main(int argc, char *argv[]) {
+    char server_ip[INET6_ADDRSTRLEN];
+    int sockfd, winner;
+    int text_mode = 0;
+    const char *address = NULL;
+    int port = MULTICAST_PORT;
+    Discovered found;
+    const char *name = "headless";
+    const char *policy_file = NULL;
+    int hit_below = 17;
+    Headless headless;
+    int opt;
+
+    // select() watches the descriptor, so no lines may hide in a stdio buffer.
+    setvbuf(stdin, NULL, _IONBF, 0);
+    // A connection that drops is reconnected, not a reason to die writing to it.
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&headless, 0, sizeof(headless));
+    while ((opt = getopt(argc, argv, "ta:p:g:N:H:P:q")) != -1) {
+        switch (opt) {
+        case 't':
+            text_mode = 1;
+            break;
+        case 'a':
+            address = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'g':
+            headless.games = atoi(optarg);
+            break;
+        case 'N':
+            name = optarg;
+            break;
+        case 'H':
+            hit_below = atoi(optarg);
+            break;
+        case 'P':
+            policy_file = optarg;
+            break;
+        case 'q':
+            headless.quiet = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (headless.games > 0) {
+        policy_default(&headless, hit_below);
+        if (policy_file != NULL && policy_load(&headless, policy_file) < 0)
+            return 1;
+        if (text_mode) {
+            fprintf(stderr, "Headless play speaks the binary protocol only\n");
+            return 1;
+        }
+    }
+
+    if (address != NULL) {
+        if (resolve_server(address, port, &found) < 0) {
+            fprintf(stderr, "Cannot resolve %s\n", address);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        receive_multicast(&found);
+    }
+
+    // Both families at once, the first to connect wins.
+    if ((sockfd = happy_connect(found.addrs, found.addrlens, found.naddrs, &winner)) < 0) {
+        perror("connect failed");
+        exit(EXIT_FAILURE);
+    }
+
+    const struct sockaddr_storage *peer = &found.addrs[winner];
+    if (peer->ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)peer)->sin6_addr, server_ip, sizeof(server_ip));
+    else
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)peer)->sin_addr, server_ip, sizeof(server_ip));
+    printf("Successfully connected using %s\n", peer->ss_family == AF_INET6 ? "IPv6" : "IPv4");
+    printf("Connected to server at %s\n", server_ip);
+
+    if (headless.games > 0) {
+        int rc = play_headless(sockfd, &headless, name);
+        close(sockfd);
+        return rc < 0 ? 1 : 0;
+    }
+
+    if (!text_mode) {
+        sockfd = play_binary(sockfd, &found);
+        if (sockfd >= 0)
+            close(sockfd);
+        return 0;
+    }
+
+    char buffer[MAXLINE];
+    memset(buffer, 0, MAXLINE);
+    if (recv(sockfd, buffer, MAXLINE, 0) <= 0) {
+        perror("recv failed");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    printf("%s", buffer);
+
+    memset(buffer, 0, MAXLINE);
+    fgets(buffer, MAXLINE, stdin);
+    buffer[strcspn(buffer, "\n")] = 0;
+    if (send(sockfd, buffer, strlen(buffer), 0) < 0) {
+        perror("send failed");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    play_game(sockfd);
+
+    close(sockfd);
+    return 0;
 }
\ No newline at end of file
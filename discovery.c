@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "discovery.h"
+#include "protocol.h"
+
+#define DISCOVER_QUERY_MS 1000      // how often a waiting client asks again
+
+size_t beacon_put(uint8_t *dst, int type, const Beacon *b) {
+    size_t len = BEACON_HEADER_LEN;
+
+    dst[0] = BEACON_MAGIC;
+    dst[1] = PROTOCOL_VERSION;
+    dst[2] = type;
+    if (type == BEACON_QUERY)
+        return 3;
+
+    dst[3] = b->count;
+    put_u16(dst + 4, b->port);
+    put_u32(dst + 6, b->instance);
+    put_u32(dst + 10, b->sessions);
+    put_u32(dst + 14, b->capacity);
+    for (int i = 0; i < b->count; i++) {
+        size_t size = b->addrs[i].family == 6 ? 16 : 4;
+        dst[len] = b->addrs[i].family;
+        memcpy(dst + len + 1, b->addrs[i].addr, size);
+        len += 1 + size;
+    }
+    return len;
+}
+
+// Returns the datagram's type, or -1 if it is not a well-formed beacon.
+int beacon_get(const uint8_t *buf, size_t len, Beacon *b) {
+    size_t off = BEACON_HEADER_LEN;
+
+    if (len < 3 || buf[0] != BEACON_MAGIC)
+        return -1;
+    b->version = buf[1];
+    if (buf[2] == BEACON_QUERY)
+        return BEACON_QUERY;
+    if (buf[2] != BEACON_ANNOUNCE || len < BEACON_HEADER_LEN || buf[3] > BEACON_MAX_ADDRS)
+        return -1;
+
+    b->count = buf[3];
+    b->port = get_u16(buf + 4);
+    b->instance = get_u32(buf + 6);
+    b->sessions = get_u32(buf + 10);
+    b->capacity = get_u32(buf + 14);
+    for (int i = 0; i < b->count; i++) {
+        size_t size = buf[off] == 6 ? 16 : 4;
+        if (off + 1 + size > len || (buf[off] != 4 && buf[off] != 6))
+            return -1;
+        b->addrs[i].family = buf[off];
+        memcpy(b->addrs[i].addr, buf + off + 1, size);
+        off += 1 + size;
+    }
+    return BEACON_ANNOUNCE;
+}
+
+// A UDP socket on the discovery port that has joined the group of
+// `version` (4 or 6), so it hears both beacons and queries, and whose own
+// datagrams stay on the local link.
+int discovery_socket(int version) {
+    int sockfd, one = 1;
+
+    if ((sockfd = socket(version == 6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (version == 6) {
+        struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_port = htons(MULTICAST_PORT) };
+        struct ipv6_mreq    mreq6 = { .ipv6mr_interface = 0 };
+        int                 hops = 1;
+
+        addr.sin6_addr = in6addr_any;
+        inet_pton(AF_INET6, IPV6_MULTICAST_IP, &mreq6.ipv6mr_multiaddr);
+        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            setsockopt(sockfd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof(mreq6)) < 0 ||
+            setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)) < 0) {
+            close(sockfd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(MULTICAST_PORT) };
+        struct ip_mreq     mreq;
+        unsigned char      ttl = 1;
+
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        mreq.imr_multiaddr.s_addr = inet_addr(IPV4_MULTICAST_IP);
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+            setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+            close(sockfd);
+            return -1;
+        }
+    }
+    return sockfd;
+}
+
+int discovery_send(int sockfd, int version, const uint8_t *buf, size_t len) {
+    if (version == 6) {
+        struct sockaddr_in6 group = { .sin6_family = AF_INET6, .sin6_port = htons(MULTICAST_PORT) };
+        inet_pton(AF_INET6, IPV6_MULTICAST_IP, &group.sin6_addr);
+        return sendto(sockfd, buf, len, 0, (struct sockaddr *)&group, sizeof(group)) < 0 ? -1 : 0;
+    }
+
+    struct sockaddr_in group = { .sin_family = AF_INET, .sin_port = htons(MULTICAST_PORT) };
+    group.sin_addr.s_addr = inet_addr(IPV4_MULTICAST_IP);
+    return sendto(sockfd, buf, len, 0, (struct sockaddr *)&group, sizeof(group)) < 0 ? -1 : 0;
+}
+
+static uint64_t discovery_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The address of family `family` (4 or 6) to reach an instance at. From a
+// beacon heard on that family's group: the address it came from if the
+// beacon announces it (it routes here, and keeps a link-local scope),
+// otherwise the first one announced. Heard on the other group (`from` is
+// NULL): the first one that needs no scope.
+static int beacon_address(const Beacon *b, int family, const struct sockaddr_storage *from,
+                          struct sockaddr_storage *out) {
+    const void *src = NULL;
+    size_t      size = family == 6 ? 16 : 4;
+    int         first = -1, matched = 0;
+
+    if (from != NULL)
+        src = family == 6 ? (const void *)&((const struct sockaddr_in6 *)from)->sin6_addr
+                          : (const void *)&((const struct sockaddr_in *)from)->sin_addr;
+    for (int i = 0; i < b->count; i++) {
+        if (b->addrs[i].family != family)
+            continue;
+        if (src == NULL && family == 6 && b->addrs[i].addr[0] == 0xfe && (b->addrs[i].addr[1] & 0xc0) == 0x80)
+            continue;
+        if (first < 0)
+            first = i;
+        if (src != NULL && memcmp(b->addrs[i].addr, src, size) == 0) {
+            first = i;
+            matched = 1;
+            break;
+        }
+    }
+    if (first < 0)
+        return -1;
+
+    memset(out, 0, sizeof(*out));
+    if (family == 6) {
+        struct sockaddr_in6 *a = (struct sockaddr_in6 *)out;
+        a->sin6_family = AF_INET6;
+        a->sin6_port = htons(b->port);
+        memcpy(&a->sin6_addr, b->addrs[first].addr, 16);
+        a->sin6_scope_id = matched ? ((const struct sockaddr_in6 *)from)->sin6_scope_id : 0;
+    } else {
+        struct sockaddr_in *a = (struct sockaddr_in *)out;
+        a->sin_family = AF_INET;
+        a->sin_port = htons(b->port);
+        memcpy(&a->sin_addr, b->addrs[first].addr, 4);
+    }
+    return 0;
+}
+
+// An instance heard so far, and the best address known in each family:
+// [0] IPv6, [1] IPv4 (family 0 if none). One learned on the family's own
+// group beats one guessed from a beacon heard on the other.
+typedef struct {
+    Beacon                  beacon;
+    struct sockaddr_storage addr[2];
+    int                     from_group[2];
+} Heard;
+
+static void heard_beacon(Heard *h, const Beacon *b, int family, const struct sockaddr_storage *from, int both) {
+    int                     i = family == 6 ? 0 : 1;
+    struct sockaddr_storage a;
+
+    h->beacon = *b;
+    if (beacon_address(b, family, from, &a) == 0) {
+        h->addr[i] = a;
+        h->from_group[i] = 1;
+    }
+    if (both && !h->from_group[1 - i] && beacon_address(b, family == 6 ? 4 : 6, NULL, &a) == 0)
+        h->addr[1 - i] = a;
+}
+
+// Queries the group of `version` (4 or 6, or 0 for both) and collects
+// beacons until DISCOVER_WINDOW_MS after the first one, waiting up to
+// timeout_ms for it (forever if negative). Picks the instance with the
+// lowest share of its capacity in use, at random among equals so that
+// clients starting together spread over idle servers, and gives its
+// addresses in the families asked for, IPv6 first. Returns -1 if none
+// answered.
+int discover(int version, int timeout_ms, Discovered *found) {
+    static Heard seen[DISCOVER_MAX_INSTANCES];
+    uint8_t      buf[BEACON_MAX_LEN];
+    uint64_t     start = discovery_ms(), queried = 0, window_end = 0;
+    unsigned     seed = (unsigned)start ^ (unsigned)getpid();
+    int          socks[2], families[2], nsocks = 0, count = 0;
+
+    for (int f = 6; f >= 4; f -= 2) {
+        if (version != 0 && version != f)
+            continue;
+        if ((socks[nsocks] = discovery_socket(f)) >= 0)
+            families[nsocks++] = f;
+    }
+    if (nsocks == 0)
+        return -1;
+    memset(seen, 0, sizeof(seen));
+
+    while (1) {
+        uint64_t now = discovery_ms();
+        int      wait;
+
+        if (count > 0 && now >= window_end)
+            break;
+        if (count == 0 && timeout_ms >= 0 && now >= start + timeout_ms)
+            break;
+        if (count == 0 && now >= queried + DISCOVER_QUERY_MS) {
+            for (int i = 0; i < nsocks; i++)
+                discovery_send(socks[i], families[i], buf, beacon_put(buf, BEACON_QUERY, NULL));
+            queried = now;
+        }
+
+        if (count > 0)
+            wait = window_end - now;
+        else
+            wait = queried + DISCOVER_QUERY_MS - now;
+        if (count == 0 && timeout_ms >= 0 && start + timeout_ms - now < (uint64_t)wait)
+            wait = start + timeout_ms - now;
+
+        struct pollfd pfd[2] = { { .fd = socks[0], .events = POLLIN }, { .fd = nsocks > 1 ? socks[1] : -1, .events = POLLIN } };
+        if (poll(pfd, 2, wait) <= 0)
+            continue;
+
+        for (int s = 0; s < nsocks; s++) {
+            struct sockaddr_storage from;
+            socklen_t               fromlen = sizeof(from);
+            Beacon                  b;
+            ssize_t                 n;
+
+            if (!(pfd[s].revents & POLLIN))
+                continue;
+            n = recvfrom(socks[s], buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+            if (n <= 0 || beacon_get(buf, n, &b) != BEACON_ANNOUNCE)
+                continue;
+
+            int i = 0;
+            while (i < count && (seen[i].beacon.instance != b.instance || seen[i].beacon.port != b.port))
+                i++;
+            if (i == DISCOVER_MAX_INSTANCES)
+                continue;
+            heard_beacon(&seen[i], &b, families[s], &from, version == 0);
+            if (seen[i].addr[0].ss_family == 0 && seen[i].addr[1].ss_family == 0)
+                continue;
+            if (i == count && count++ == 0)
+                window_end = discovery_ms() + DISCOVER_WINDOW_MS;
+        }
+    }
+    for (int i = 0; i < nsocks; i++)
+        close(socks[i]);
+
+    if (count == 0)
+        return -1;
+
+    int    best = -1, ties = 0;
+    double best_load = 0;
+    for (int i = 0; i < count; i++) {
+        const Beacon *b = &seen[i].beacon;
+        double        load = b->capacity > 0 ? (double)b->sessions / b->capacity : b->sessions;
+
+        if (best < 0 || load < best_load) {
+            best = i;
+            best_load = load;
+            ties = 1;
+        } else if (load == best_load && rand_r(&seed) % ++ties == 0) {
+            best = i;
+        }
+    }
+
+    const Heard *h = &seen[best];
+    memset(found, 0, sizeof(*found));
+    found->beacon = h->beacon;
+    for (int i = 0; i < 2; i++) {
+        if (h->addr[i].ss_family == 0)
+            continue;
+        found->addrs[found->naddrs] = h->addr[i];
+        found->addrlens[found->naddrs++] = i == 0 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    }
+    if (found->addrs[0].ss_family == AF_INET6) {
+        const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)&found->addrs[0];
+        inet_ntop(AF_INET6, &a->sin6_addr, found->address, sizeof(found->address));
+        found->scope = a->sin6_scope_id;
+    } else {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)&found->addrs[0])->sin_addr, found->address, sizeof(found->address));
+    }
+    found->heard = count;
+    return 0;
+}
+
+// Happy Eyeballs (RFC 8305): connects to the addresses in order, giving
+// each CONNECT_ATTEMPT_DELAY_MS (or until it fails) before starting the
+// next one too, and keeps whichever completes first. A family that works
+// costs nothing over connecting to it alone; one that is broken costs at
+// most the delay. Returns the connected socket, blocking again, with the
+// winner's index in *which; or -1 with errno from the last failure.
+int happy_connect(const struct sockaddr_storage *addrs, const socklen_t *lens, int n, int *which) {
+    int      fds[8], started = 0, live = 0, winner = -1, err = ECONNREFUSED;
+    uint64_t next_start = 0;
+
+    if (n > 8)
+        n = 8;
+    while (winner < 0) {
+        uint64_t now = discovery_ms();
+
+        if (started < n && (live == 0 || now >= next_start)) {
+            int fd = socket(addrs[started].ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+            fds[started] = -1;
+            if (fd >= 0 && connect(fd, (const struct sockaddr *)&addrs[started], lens[started]) == 0) {
+                fds[started] = fd;
+                winner = started;
+            } else if (fd >= 0 && errno == EINPROGRESS) {
+                fds[started] = fd;
+                live++;
+            } else {
+                err = errno;
+                if (fd >= 0)
+                    close(fd);
+            }
+            started++;
+            next_start = now + CONNECT_ATTEMPT_DELAY_MS;
+            continue;
+        }
+        if (live == 0)
+            break;
+
+        struct pollfd pfd[8];
+        for (int i = 0; i < started; i++)
+            pfd[i] = (struct pollfd){ .fd = fds[i], .events = POLLOUT };
+        if (poll(pfd, started, started < n ? (int)(next_start - now) : -1) <= 0)
+            continue;
+
+        for (int i = 0; i < started && winner < 0; i++) {
+            int       so_error = 0;
+            socklen_t len = sizeof(so_error);
+
+            if (fds[i] < 0 || pfd[i].revents == 0)
+                continue;
+            getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &so_error, &len);
+            if (so_error == 0) {
+                winner = i;
+                break;
+            }
+            // Failed: the next address need not wait out the delay.
+            err = so_error;
+            close(fds[i]);
+            fds[i] = -1;
+            live--;
+            next_start = now;
+        }
+    }
+
+    for (int i = 0; i < started; i++)
+        if (i != winner && fds[i] >= 0)
+            close(fds[i]);
+    if (winner < 0) {
+        errno = err;
+        return -1;
+    }
+    fcntl(fds[winner], F_SETFL, fcntl(fds[winner], F_GETFL) & ~O_NONBLOCK);
+    if (which != NULL)
+        *which = winner;
+    return fds[winner];
+}
@@ -0,0 +1,70 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define IPV4_MULTICAST_IP "239.255.255.250"
+#define IPV6_MULTICAST_IP "ff02::1"
+#define MULTICAST_PORT 12951
+#define DISCOVER_WINDOW_MS 250      // how long a client listens after the first beacon
+#define DISCOVER_MAX_INSTANCES 64
+#define CONNECT_ATTEMPT_DELAY_MS 250    // Happy Eyeballs: head start of each address over the next
+
+// Discovery. Every server multicasts a beacon every few seconds on both
+// groups, and right away when a client multicasts a query, so a client
+// hears all instances within a short window and picks the least loaded one.
+//
+// A beacon is one datagram: BEACON_MAGIC, the protocol version, its type,
+// the number of addresses, u16 TCP port, u32 instance id, u32 sessions
+// connected and u32 capacity (all in network order), then per address a
+// family byte (4 or 6) and its 4 or 16 bytes. A query is just the first
+// three bytes with BEACON_QUERY. Datagrams that do not start with the
+// magic, such as the old text announcements, are ignored.
+#define BEACON_MAGIC 0xB8
+#define BEACON_HEADER_LEN 18
+#define BEACON_MAX_ADDRS 16        // of both families
+#define BEACON_MAX_LEN (BEACON_HEADER_LEN + BEACON_MAX_ADDRS * 17)
+
+enum {
+    BEACON_ANNOUNCE = 1,
+    BEACON_QUERY
+};
+
+typedef struct {
+    uint8_t family;         // 4 or 6
+    uint8_t addr[16];
+} BeaconAddr;
+
+typedef struct {
+    uint8_t    version;
+    uint8_t    count;
+    uint16_t   port;
+    uint32_t   instance;    // random per server process
+    uint32_t   sessions;
+    uint32_t   capacity;
+    BeaconAddr addrs[BEACON_MAX_ADDRS];
+} Beacon;
+
+// What a client found: the chosen instance and where to reach it, one
+// address per family it can be reached in, in the order to try them.
+typedef struct {
+    Beacon                  beacon;
+    struct sockaddr_storage addrs[2];
+    socklen_t               addrlens[2];
+    int                     naddrs;
+    char                    address[INET6_ADDRSTRLEN];  // the first one, as text
+    uint32_t                scope;          // its interface, if IPv6 link-local
+    int                     heard;          // instances that answered
+} Discovered;
+
+size_t beacon_put(uint8_t *dst, int type, const Beacon *b);
+int beacon_get(const uint8_t *buf, size_t len, Beacon *b);
+int discovery_socket(int version);
+int discovery_send(int sockfd, int version, const uint8_t *buf, size_t len);
+int discover(int version, int timeout_ms, Discovered *found);
+int happy_connect(const struct sockaddr_storage *addrs, const socklen_t *lens, int n, int *which);
+
+#endif
@@ -0,0 +1,92 @@
+#include "engine.h"
+
+// After the player's score changes: bust ends the hand, 21 ends the turn.
+static void player_scored(Game *g) {
+    if (g->player_score > GAME_TARGET) {
+        g->result = -1;
+        g->phase = GAME_OVER;
+    } else if (g->player_score == GAME_TARGET) {
+        g->phase = GAME_DEALER;
+    } else {
+        g->phase = GAME_PLAYER;
+    }
+}
+
+// Starts a hand. The shoe is reshuffled here if the cut card has come out.
+void game_deal(Game *g, Shoe *shoe) {
+    shoe_hand_start(shoe);
+    game_join(g, shoe_draw(shoe));
+}
+
+// Starts a hand against an up-card that was already drawn.
+void game_join(Game *g, int up_card) {
+    g->player_score = 0;
+    g->up_card = g->dealer_score = g->card = up_card;
+    g->result = 0;
+    g->phase = GAME_PLAYER;
+}
+
+// Draws a card for the player and returns it. An ace is not counted until
+// game_choose_ace().
+int game_hit(Game *g, Shoe *shoe) {
+    g->card = shoe_draw(shoe);
+
+    if (g->card == CARD_ACE) {
+        g->phase = GAME_ACE;
+    } else {
+        g->player_score += g->card;
+        player_scored(g);
+    }
+    return g->card;
+}
+
+// Counts the pending ace as 11 or, for any other value, as 1.
+void game_choose_ace(Game *g, int value) {
+    g->player_score += value == CARD_ACE ? CARD_ACE : 1;
+    player_scored(g);
+}
+
+// Ends the player's turn. From GAME_ACE the pending ace is dropped, which
+// is what happens when a player leaves in the middle of that choice.
+void game_stand(Game *g) {
+    if (g->phase == GAME_PLAYER || g->phase == GAME_ACE)
+        g->phase = GAME_DEALER;
+}
+
+// One step of the dealer's turn: draws and returns a card while the dealer
+// is below 17 (an ace counts 11 unless that busts, and is returned as
+// counted), otherwise settles the hand and returns 0.
+int game_dealer_draw(Game *g, Shoe *shoe) {
+    if (g->phase != GAME_DEALER)
+        return 0;
+
+    if (g->dealer_score < DEALER_STANDS) {
+        int card = shoe_draw(shoe);
+        if (DEALER_ACE_LOW && card == CARD_ACE && g->dealer_score + CARD_ACE > GAME_TARGET)
+            card = 1;
+        g->dealer_score += card;
+        g->card = card;
+        return card;
+    }
+
+    g->result = game_settle(g->player_score, g->dealer_score);
+    g->phase = GAME_OVER;
+    return 0;
+}
+
+// Plays whatever is left of the dealer's turn. Returns the result.
+int game_resolve(Game *g, Shoe *shoe) {
+    game_stand(g);
+    while (game_dealer_draw(g, shoe) != 0)
+        ;
+    return g->result;
+}
+
+// Ends the hand against a dealer played out elsewhere. A bust stays a loss.
+void game_settle_dealer(Game *g, int dealer_score) {
+    g->dealer_score = dealer_score;
+    if (g->phase != GAME_OVER) {
+        g->result = game_settle(g->player_score, dealer_score);
+        g->phase = GAME_OVER;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "shoe.h"
+
+#define GAME_TARGET 21
+#define DEALER_STANDS 17
+#define DEALER_ACE_LOW 1        // the dealer counts an ace 1 where 11 would bust
+
+// The game without any I/O: a Game is a plain value that the step
+// functions below move through one hand, drawing from a caller-owned shoe.
+// Nothing here allocates or blocks, so the server, the client and the
+// simulators all play exactly the same rules.
+//
+// A hand: game_deal() shows the dealer's up-card, then the player hits or
+// stands. A drawn ace waits in GAME_ACE for game_choose_ace(). Reaching 21
+// or standing hands over to the dealer, who draws to 17 one
+// game_dealer_draw() at a time; busting ends the hand at once as a loss.
+// At a table several players share one dealer: each joins the same up-card
+// with game_join() and is settled against the dealer's final score with
+// game_settle_dealer().
+typedef enum {
+    GAME_PLAYER,    // waiting for hit or stand
+    GAME_ACE,       // waiting for the drawn ace's value
+    GAME_DEALER,    // the dealer still has to draw
+    GAME_OVER       // result is final
+} GamePhase;
+
+typedef struct {
+    uint8_t phase;
+    uint8_t player_score;
+    uint8_t dealer_score;
+    uint8_t up_card;
+    uint8_t card;           // the last card drawn, or the ace waiting for a value
+    int8_t  result;         // once GAME_OVER: 1 win, 0 draw, -1 loss
+} Game;
+
+void game_deal(Game *g, Shoe *shoe);
+void game_join(Game *g, int up_card);
+int game_hit(Game *g, Shoe *shoe);
+void game_choose_ace(Game *g, int value);
+void game_stand(Game *g);
+int game_dealer_draw(Game *g, Shoe *shoe);
+int game_resolve(Game *g, Shoe *shoe);
+void game_settle_dealer(Game *g, int dealer_score);
+
+static inline int game_busted(int score) {
+    return score > GAME_TARGET;
+}
+
+// Win, draw or loss for final scores.
+static inline int game_settle(int player, int dealer) {
+    if (player > GAME_TARGET)
+        return -1;
+    if (dealer > GAME_TARGET || player > dealer)
+        return 1;
+    return player < dealer ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include <math.h>
+#include <string.h>
+#include "ev.h"
+
+#define DEALER_SCORES (GAME_TARGET + CARD_ACE)     // the most the dealer can reach, plus one
+
+// A card's odds in one deck (shoe.h).
+static double card_p(int card) {
+    static const uint8_t deck[] = { SHOE_DECK };
+    int                  n = 0;
+
+    for (size_t i = 0; i < sizeof(deck); i++)
+        n += deck[i] == card;
+    return (double)n / sizeof(deck);
+}
+
+// The value of the player landing on score t: bust, the forced stand on
+// 21, or the better of standing and hitting.
+static double landed(const EvAnalysis *a, int t, int u) {
+    if (game_busted(t))
+        return -1;
+    if (t == GAME_TARGET)
+        return a->stand[t][u];
+    return fmax(a->stand[t][u], a->hit[t][u]);
+}
+
+void ev_analyze(EvAnalysis *a) {
+    double final[DEALER_SCORES][EV_FINALS];
+
+    memset(a, 0, sizeof(*a));
+    memset(final, 0, sizeof(final));
+
+    // Where the dealer ends from each score, from the highest it can draw
+    // on down, so every card leads to a score already worked out.
+    for (int d = DEALER_SCORES - 1; d >= EV_UP_MIN; d--) {
+        if (d >= DEALER_STANDS) {
+            final[d][game_busted(d) ? EV_BUST : d - DEALER_STANDS] = 1;
+            continue;
+        }
+        for (int c = EV_UP_MIN; c <= CARD_ACE; c++) {
+            int next = d + (DEALER_ACE_LOW && c == CARD_ACE && game_busted(d + CARD_ACE) ? 1 : c);
+            for (int f = 0; f < EV_FINALS; f++)
+                final[d][f] += card_p(c) * final[next][f];
+        }
+    }
+
+    for (int u = 0; u < EV_UPS; u++) {
+        memcpy(a->dealer[u], final[u + EV_UP_MIN], sizeof(a->dealer[u]));
+
+        for (int s = GAME_TARGET; s >= 0; s--) {
+            double stand = a->dealer[u][EV_BUST], hit = 0;
+
+            for (int f = 0; f < EV_BUST; f++)
+                stand += a->dealer[u][f] * game_settle(s, f + DEALER_STANDS);
+            a->stand[s][u] = stand;
+
+            a->ace_low[s][u] = landed(a, s + 1, u);
+            a->ace_high[s][u] = landed(a, s + CARD_ACE, u);
+            for (int c = EV_UP_MIN; c < CARD_ACE; c++)
+                hit += card_p(c) * landed(a, s + c, u);
+            hit += card_p(CARD_ACE) * fmax(a->ace_low[s][u], a->ace_high[s][u]);
+            a->hit[s][u] = hit;
+        }
+        a->game += card_p(u + EV_UP_MIN) * landed(a, 0, u);
+    }
+}
+
+static int16_t ev_units(double ev) {
+    return (int16_t)lround(ev * EV_UNIT);
+}
+
+void ev_fill(EvTable *t, const EvAnalysis *a) {
+    for (int s = 0; s < EV_SCORES; s++) {
+        for (int u = 0; u < EV_UPS; u++) {
+            EvHint *h = &t->hints[s][u];
+            h->stand = ev_units(a->stand[s][u]);
+            h->hit = ev_units(a->hit[s][u]);
+            h->ace_low = ev_units(a->ace_low[s][u]);
+            h->ace_high = ev_units(a->ace_high[s][u]);
+        }
+    }
+}
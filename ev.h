@@ -0,0 +1,56 @@
+#ifndef EV_H
+#define EV_H
+
+#include <stdint.h>
+#include "engine.h"
+
+#define EV_SCORES (GAME_TARGET + 1)                     // player scores 0-21
+#define EV_UP_MIN 2
+#define EV_UPS (CARD_ACE - EV_UP_MIN + 1)               // up-cards 2-CARD_ACE
+#define EV_FINALS (GAME_TARGET - DEALER_STANDS + 2)     // dealer ends on 17-21 or busts
+#define EV_BUST (EV_FINALS - 1)
+#define EV_UNIT 10000                                   // table EVs are in 1/10000 of a bet
+
+// Exact expected values under the engine's rules, for every decision a
+// player can face: a score and the dealer's up-card. Cards come from an
+// infinite shoe in a deck's proportions (SHOE_DECK: each rank 1/13, tens 4/13); a
+// freshly shuffled six-deck shoe deals within a fraction of a percent of
+// that, and it makes every value depend on the score alone.
+//
+// The dealer's final score is worked out once per score it can stand on
+// and reused (memoized), the player's values from 21 down, so the whole
+// analysis is a few thousand multiplications.
+typedef struct {
+    double dealer[EV_UPS][EV_FINALS];   // P(dealer ends on 17+i), EV_BUST last
+    double stand[EV_SCORES][EV_UPS];
+    double hit[EV_SCORES][EV_UPS];      // hitting, then playing on perfectly
+    double ace_low[EV_SCORES][EV_UPS];  // an ace drawn here, counted 1
+    double ace_high[EV_SCORES][EV_UPS]; // ... counted 11
+    double game;                        // one hand played perfectly
+} EvAnalysis;
+
+// One decision, rounded for the table.
+typedef struct {
+    int16_t stand;
+    int16_t hit;
+    int16_t ace_low;
+    int16_t ace_high;
+} EvHint;
+
+typedef struct {
+    EvHint hints[EV_SCORES][EV_UPS];
+} EvTable;
+
+void ev_analyze(EvAnalysis *a);
+void ev_fill(EvTable *t, const EvAnalysis *a);
+
+// The table ev_gen wrote (ev_table.c). It is committed, not built: after a
+// change to the rules it checks (GAME_TARGET, DEALER_STANDS, DEALER_ACE_LOW,
+// CARD_ACE and SHOE_DECK) it fails to compile until it is generated again.
+extern const EvTable ev_table;
+
+static inline const EvHint *ev_hint(int score, int up_card) {
+    return &ev_table.hints[score][up_card - EV_UP_MIN];
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ev.h"
+
+// Writes ev_table.c, the hint table the server links, from the rules in
+// engine.h and the deck in shoe.h. Run it again whenever they change:
+//
+//     gcc -O2 ev_gen.c ev.c -o ev_gen -lm && ./ev_gen > ev_table.c
+//
+// With -r it prints the analysis instead: the dealer's final scores, the
+// EV of each decision and how long the whole thing took.
+
+static void print_table(const char *title, const double ev[EV_SCORES][EV_UPS]) {
+    printf("\n%s\nscore", title);
+    for (int u = 0; u < EV_UPS; u++)
+        printf(" %7d", u + EV_UP_MIN);
+    printf("\n");
+    for (int s = 0; s < GAME_TARGET; s++) {
+        printf("%5d", s);
+        for (int u = 0; u < EV_UPS; u++)
+            printf(" %+7.4f", ev[s][u]);
+        printf("\n");
+    }
+}
+
+static void report(const EvAnalysis *a, double elapsed) {
+    printf("analysis in %.3f ms (infinite shoe, dealer stands on %d)\n", elapsed * 1e3, DEALER_STANDS);
+    printf("house edge with perfect play: %+.4f%%\n", -100 * a->game);
+
+    printf("\ndealer's final score\n   up");
+    for (int f = 0; f < EV_BUST; f++)
+        printf(" %7d", f + DEALER_STANDS);
+    printf("    bust\n");
+    for (int u = 0; u < EV_UPS; u++) {
+        printf("%5d", u + EV_UP_MIN);
+        for (int f = 0; f < EV_FINALS; f++)
+            printf(" %7.4f", a->dealer[u][f]);
+        printf("\n");
+    }
+
+    print_table("EV of standing", a->stand);
+    print_table("EV of hitting, then playing perfectly", a->hit);
+
+    printf("\nbest move (H: hit, S: stand; an ace drawn: 1 or B for 11)\nscore");
+    for (int u = 0; u < EV_UPS; u++)
+        printf(" %2d", u + EV_UP_MIN);
+    printf("\n");
+    for (int s = 0; s < GAME_TARGET; s++) {
+        printf("%5d", s);
+        for (int u = 0; u < EV_UPS; u++)
+            printf(" %c%c", a->hit[s][u] > a->stand[s][u] ? 'H' : 'S',
+                   a->ace_high[s][u] > a->ace_low[s][u] ? 'B' : '1');
+        printf("\n");
+    }
+}
+
+static void emit(const EvTable *t) {
+    printf("// Generated by ev_gen from the rules in engine.h and shoe.h; do not edit.\n"
+           "// gcc -O2 ev_gen.c ev.c -o ev_gen -lm && ./ev_gen > ev_table.c\n"
+           "#include \"ev.h\"\n\n"
+           "_Static_assert(GAME_TARGET == %d && DEALER_STANDS == %d && DEALER_ACE_LOW == %d && CARD_ACE == %d &&\n"
+           "               SHOE_DECK_ID == 0x%llxull,\n"
+           "               \"the rules changed: regenerate ev_table.c with ev_gen\");\n\n"
+           "// { stand, hit, ace as 1, ace as 11 } in 1/%d of a bet, by score and up-card %d-%d.\n"
+           "const EvTable ev_table = { {\n",
+           GAME_TARGET, DEALER_STANDS, DEALER_ACE_LOW, CARD_ACE, SHOE_DECK_ID, EV_UNIT, EV_UP_MIN, CARD_ACE);
+    for (int s = 0; s < EV_SCORES; s++) {
+        printf("    {   // %d\n", s);
+        for (int u = 0; u < EV_UPS; u++) {
+            const EvHint *h = &t->hints[s][u];
+            printf("        { %6d, %6d, %6d, %6d },\n", h->stand, h->hit, h->ace_low, h->ace_high);
+        }
+        printf("    },\n");
+    }
+    printf("} };\n");
+}
+
+int main(int argc, char *argv[]) {
+    static EvAnalysis analysis;
+    static EvTable    table;
+    struct timespec   t0, t1;
+    int               opt, show_report = 0;
+
+    while ((opt = getopt(argc, argv, "r")) != -1) {
+        switch (opt) {
+        case 'r': show_report = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-r] > ev_table.c\n", argv[0]);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ev_analyze(&analysis);
+    ev_fill(&table, &analysis);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (show_report)
+        report(&analysis, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    else
+        emit(&table);
+    return 0;
+}
@@ -0,0 +1,275 @@
+// Generated by ev_gen from the rules in engine.h and shoe.h; do not edit.
+// gcc -O2 ev_gen.c ev.c -o ev_gen -lm && ./ev_gen > ev_table.c
+#include "ev.h"
+
+_Static_assert(GAME_TARGET == 21 && DEALER_STANDS == 17 && DEALER_ACE_LOW == 1 && CARD_ACE == 11 &&
+               SHOE_DECK_ID == 0xb23456789aaaaull,
+               "the rules changed: regenerate ev_table.c with ev_gen");
+
+// { stand, hit, ace as 1, ace as 11 } in 1/10000 of a bet, by score and up-card 2-11.
+const EvTable ev_table = { {
+    {   // 0
+        {  -2486,    540,    664,   2632 },
+        {  -2101,    808,    929,   2842 },
+        {  -1713,   1101,   1218,   3069 },
+        {  -1270,   1420,   1534,   3315 },
+        {  -1537,   1410,   1516,   3337 },
+        {  -4754,    763,    845,   2921 },
+        {  -5105,    -16,     58,   2300 },
+        {  -5431,   -928,   -832,   1583 },
+        {  -5758,  -2109,  -1867,    597 },
+        {  -5758,  -2755,  -2514,   -420 },
+    },
+    {   // 1
+        {  -2486,    664,   -608,  -2313 },
+        {  -2101,    929,   -347,  -2101 },
+        {  -1713,   1218,    -16,  -1713 },
+        {  -1270,   1534,    351,  -1270 },
+        {  -1537,   1516,    253,  -1537 },
+        {  -4754,    845,   -450,  -2128 },
+        {  -5105,     58,  -1215,  -2716 },
+        {  -5431,   -832,  -2083,  -3400 },
+        {  -5758,  -1867,  -3064,  -4207 },
+        {  -5758,  -2514,  -3575,  -4657 },
+    },
+    {   // 2
+        {  -2486,   -608,   -779,  -2486 },
+        {  -2101,   -347,   -472,  -2101 },
+        {  -1713,    -16,   -137,  -1713 },
+        {  -1270,    351,    235,  -1270 },
+        {  -1537,    253,    125,  -1537 },
+        {  -4754,   -450,   -730,  -2691 },
+        {  -5105,  -1215,  -1471,  -3236 },
+        {  -5431,  -2083,  -2312,  -3872 },
+        {  -5758,  -3064,  -3263,  -4621 },
+        {  -5758,  -3575,  -3761,  -5038 },
+    },
+    {   // 3
+        {  -2486,   -779,   -901,  -2486 },
+        {  -2101,   -472,   -588,  -2101 },
+        {  -1713,   -137,   -250,  -1713 },
+        {  -1270,    235,    128,  -1270 },
+        {  -1537,    125,      7,  -1537 },
+        {  -4754,   -730,  -1020,  -3213 },
+        {  -5105,  -1471,  -1735,  -3719 },
+        {  -5431,  -2312,  -2548,  -4309 },
+        {  -5758,  -3263,  -3470,  -5005 },
+        {  -5758,  -3761,  -3953,  -5393 },
+    },
+    {   // 4
+        {  -2486,   -901,  -1014,  -2486 },
+        {  -2101,   -588,   -696,  -2101 },
+        {  -1713,   -250,   -354,  -1713 },
+        {  -1270,    128,     28,  -1270 },
+        {  -1537,      7,   -104,  -1537 },
+        {  -4754,  -1020,  -1315,  -3698 },
+        {  -5105,  -1735,  -2005,  -4168 },
+        {  -5431,  -2548,  -2790,  -4716 },
+        {  -5758,  -3470,  -3682,  -5362 },
+        {  -5758,  -3953,  -4150,  -5722 },
+    },
+    {   // 5
+        {  -2486,  -1014,  -1120,  -2486 },
+        {  -2101,   -696,   -797,  -2101 },
+        {  -1713,   -354,   -451,  -1713 },
+        {  -1270,     28,    -65,  -1270 },
+        {  -1537,   -104,   -206,  -1537 },
+        {  -4754,  -1315,  -1614,  -4148 },
+        {  -5105,  -2005,  -2278,  -4584 },
+        {  -5431,  -2790,  -3036,  -5093 },
+        {  -5758,  -3682,  -3896,  -5693 },
+        {  -5758,  -4150,  -4273,  -5758 },
+    },
+    {   // 6
+        {  -2486,  -1120,   -730,  -1132 },
+        {  -2101,   -797,   -418,   -793 },
+        {  -1713,   -451,    -85,   -448 },
+        {  -1270,    -65,    276,    -88 },
+        {  -1537,   -206,    292,    117 },
+        {  -4754,  -1614,   -688,  -1068 },
+        {  -5105,  -2278,  -2106,  -3820 },
+        {  -5431,  -3036,  -2917,  -4232 },
+        {  -5758,  -3896,  -3682,  -4644 },
+        {  -5758,  -4273,  -3997,  -4644 },
+    },
+    {   // 7
+        {  -2486,   -730,    117,   1527 },
+        {  -2101,   -418,    402,   1778 },
+        {  -1713,    -85,    708,   2037 },
+        {  -1270,    276,   1031,   2277 },
+        {  -1537,    292,   1150,   2834 },
+        {  -4754,   -688,    822,   3996 },
+        {  -5105,  -2106,   -599,   1060 },
+        {  -5431,  -2917,  -2102,  -1832 },
+        {  -5758,  -3682,  -3018,  -2415 },
+        {  -5758,  -3997,  -3303,  -2415 },
+    },
+    {   // 8
+        {  -2486,    117,   1049,   4084 },
+        {  -2101,    402,   1305,   4254 },
+        {  -1713,    708,   1581,   4431 },
+        {  -1270,   1031,   1874,   4596 },
+        {  -1537,   1150,   1960,   4960 },
+        {  -4754,    822,   1719,   6160 },
+        {  -5105,   -599,    984,   5939 },
+        {  -5431,  -2102,   -522,   2876 },
+        {  -5758,  -3018,  -2134,   -187 },
+        {  -5758,  -3303,  -2519,   -187 },
+    },
+    {   // 9
+        {  -2486,   1049,   2093,   6532 },
+        {  -2101,   1305,   2319,   6629 },
+        {  -1713,   1581,   2562,   6730 },
+        {  -1270,   1874,   2822,   6824 },
+        {  -1537,   1960,   2878,   7040 },
+        {  -4754,   1719,   2569,   7732 },
+        {  -5105,    984,   1980,   7918 },
+        {  -5431,   -522,   1165,   7584 },
+        {  -5758,  -2134,   -450,   4350 },
+        {  -5758,  -2519,  -1467,   2042 },
+    },
+    {   // 10
+        {  -2486,   2093,   2632,   8864 },
+        {  -2101,   2319,   2842,   8895 },
+        {  -1713,   2562,   3069,   8927 },
+        {  -1270,   2822,   3315,   8958 },
+        {  -1537,   2878,   3337,   9028 },
+        {  -4754,   2569,   2921,   9259 },
+        {  -5105,   1980,   2300,   9306 },
+        {  -5431,   1165,   1583,   9392 },
+        {  -5758,   -450,    597,   8886 },
+        {  -5758,  -1467,   -420,   6578 },
+    },
+    {   // 11
+        {  -2486,   2632,  -2313, -10000 },
+        {  -2101,   2842,  -2101, -10000 },
+        {  -1713,   3069,  -1713, -10000 },
+        {  -1270,   3315,  -1270, -10000 },
+        {  -1537,   3337,  -1537, -10000 },
+        {  -4754,   2921,  -2128, -10000 },
+        {  -5105,   2300,  -2716, -10000 },
+        {  -5431,   1583,  -3400, -10000 },
+        {  -5758,    597,  -4207, -10000 },
+        {  -5758,   -420,  -4657, -10000 },
+    },
+    {   // 12
+        {  -2486,  -2313,  -2486, -10000 },
+        {  -2101,  -2126,  -2101, -10000 },
+        {  -1713,  -1936,  -1713, -10000 },
+        {  -1270,  -1732,  -1270, -10000 },
+        {  -1537,  -1705,  -1537, -10000 },
+        {  -4754,  -2128,  -2691, -10000 },
+        {  -5105,  -2716,  -3236, -10000 },
+        {  -5431,  -3400,  -3872, -10000 },
+        {  -5758,  -4207,  -4621, -10000 },
+        {  -5758,  -4657,  -5038, -10000 },
+    },
+    {   // 13
+        {  -2486,  -2891,  -2486, -10000 },
+        {  -2101,  -2734,  -2101, -10000 },
+        {  -1713,  -2574,  -1713, -10000 },
+        {  -1270,  -2403,  -1270, -10000 },
+        {  -1537,  -2356,  -1537, -10000 },
+        {  -4754,  -2691,  -3213, -10000 },
+        {  -5105,  -3236,  -3719, -10000 },
+        {  -5431,  -3872,  -4309, -10000 },
+        {  -5758,  -4621,  -5005, -10000 },
+        {  -5758,  -5038,  -5393, -10000 },
+    },
+    {   // 14
+        {  -2486,  -3469,  -2486, -10000 },
+        {  -2101,  -3341,  -2101, -10000 },
+        {  -1713,  -3211,  -1713, -10000 },
+        {  -1270,  -3075,  -1270, -10000 },
+        {  -1537,  -3007,  -1537, -10000 },
+        {  -4754,  -3213,  -3698, -10000 },
+        {  -5105,  -3719,  -4168, -10000 },
+        {  -5431,  -4309,  -4716, -10000 },
+        {  -5758,  -5005,  -5362, -10000 },
+        {  -5758,  -5393,  -5722, -10000 },
+    },
+    {   // 15
+        {  -2486,  -4047,  -2486, -10000 },
+        {  -2101,  -3949,  -2101, -10000 },
+        {  -1713,  -3849,  -1713, -10000 },
+        {  -1270,  -3746,  -1270, -10000 },
+        {  -1537,  -3658,  -1537, -10000 },
+        {  -4754,  -3698,  -4148, -10000 },
+        {  -5105,  -4168,  -4584, -10000 },
+        {  -5431,  -4716,  -5093, -10000 },
+        {  -5758,  -5362,  -5693, -10000 },
+        {  -5758,  -5722,  -5758, -10000 },
+    },
+    {   // 16
+        {  -2486,  -4625,  -1132, -10000 },
+        {  -2101,  -4557,   -793, -10000 },
+        {  -1713,  -4486,   -448, -10000 },
+        {  -1270,  -4418,    -88, -10000 },
+        {  -1537,  -4309,    117, -10000 },
+        {  -4754,  -4148,  -1068, -10000 },
+        {  -5105,  -4584,  -3820, -10000 },
+        {  -5431,  -5093,  -4232, -10000 },
+        {  -5758,  -5693,  -4644, -10000 },
+        {  -5758,  -6048,  -4644, -10000 },
+    },
+    {   // 17
+        {  -1132,  -5307,   1527, -10000 },
+        {   -793,  -5265,   1778, -10000 },
+        {   -448,  -5221,   2037, -10000 },
+        {    -88,  -5180,   2277, -10000 },
+        {    117,  -5088,   2834, -10000 },
+        {  -1068,  -4835,   3996, -10000 },
+        {  -3820,  -5060,   1060, -10000 },
+        {  -4232,  -5537,  -1832, -10000 },
+        {  -4644,  -6105,  -2415, -10000 },
+        {  -4644,  -6460,  -2415, -10000 },
+    },
+    {   // 18
+        {   1527,  -6194,   4084, -10000 },
+        {   1778,  -6171,   4254, -10000 },
+        {   2037,  -6147,   4431, -10000 },
+        {   2277,  -6125,   4596, -10000 },
+        {   2834,  -6075,   4960, -10000 },
+        {   3996,  -5911,   6160, -10000 },
+        {   1060,  -5911,   5939, -10000 },
+        {  -1832,  -6165,   2876, -10000 },
+        {  -2415,  -6689,   -187, -10000 },
+        {  -2415,  -7044,   -187, -10000 },
+    },
+    {   // 19
+        {   4084,  -7277,   6532, -10000 },
+        {   4254,  -7267,   6629, -10000 },
+        {   4431,  -7257,   6730, -10000 },
+        {   4596,  -7248,   6824, -10000 },
+        {   4960,  -7226,   7040, -10000 },
+        {   6160,  -7154,   7732, -10000 },
+        {   5939,  -7137,   7918, -10000 },
+        {   2876,  -7156,   7584, -10000 },
+        {   -187,  -7443,   4350, -10000 },
+        {   -187,  -7798,   2042, -10000 },
+    },
+    {   // 20
+        {   6532,  -8549,   8864, -10000 },
+        {   6629,  -8547,   8895, -10000 },
+        {   6730,  -8544,   8927, -10000 },
+        {   6824,  -8542,   8958, -10000 },
+        {   7040,  -8536,   9028, -10000 },
+        {   7732,  -8519,   9259, -10000 },
+        {   7918,  -8515,   9306, -10000 },
+        {   7584,  -8508,   9392, -10000 },
+        {   4350,  -8547,   8886, -10000 },
+        {   2042,  -8725,   6578, -10000 },
+    },
+    {   // 21
+        {   8864, -10000, -10000, -10000 },
+        {   8895, -10000, -10000, -10000 },
+        {   8927, -10000, -10000, -10000 },
+        {   8958, -10000, -10000, -10000 },
+        {   9028, -10000, -10000, -10000 },
+        {   9259, -10000, -10000, -10000 },
+        {   9306, -10000, -10000, -10000 },
+        {   9392, -10000, -10000, -10000 },
+        {   8886, -10000, -10000, -10000 },
+        {   6578, -10000, -10000, -10000 },
+    },
+} };
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+#include "stats.h"
+
+#define LOG_LINE_MAX 512
+#define LOG_BATCH_BYTES (64 * 1024)
+
+// One slot of the ring. `seq` is the slot's turn (Vyukov's bounded queue):
+// equal to a position, the slot is free for the producer that claimed that
+// position; one past it, the record is there for the writer to take.
+typedef struct {
+    uint64_t  seq;
+    LogRecord record;
+} LogCell;
+
+typedef struct {
+    _Alignas(64) uint64_t head;     // next position to claim
+    _Alignas(64) uint64_t dropped;
+    uint64_t written;               // positions before it are out of the ring
+    LogCell  cells[LOG_RING_SIZE];
+} LogRing;
+
+static LogRing  *ring;              // NULL: write synchronously
+static uint64_t  ring_tail;         // the writer's next position
+static uint64_t  ring_lost;         // records skipped as never written
+static uint64_t  stall_pos = UINT64_MAX, stall_ms;
+static int       log_fd = -1;       // -1: syslog
+static int       started;           // the writer thread runs
+
+static const char *priorities[] = { "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug" };
+
+int logger_init(const char *path, int synchronous) {
+    if (path != NULL) {
+        log_fd = strcmp(path, "-") == 0 ? STDOUT_FILENO
+                                        : open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (log_fd < 0)
+            return -1;
+    }
+    if (synchronous)
+        return 0;
+
+    LogRing *r = mmap(NULL, sizeof(LogRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+        return -1;
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++)
+        r->cells[i].seq = i;
+    ring = r;
+    return 0;
+}
+
+static void log_record(LogRecord *r, int priority, LogEvent event) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    r->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    r->pid = getpid();
+    r->priority = priority;
+    r->event = event;
+}
+
+static int log_message(const LogRecord *r, char *buff, size_t size) {
+    switch (r->event) {
+    case LOG_EVENT_CONNECT:
+        return snprintf(buff, size, "Player connected: %.*s", r->len, r->text);
+    case LOG_EVENT_DISCONNECT:
+        return snprintf(buff, size, "Player %.*s disconnected.", r->len, r->text);
+    case LOG_EVENT_BEACON:
+        return snprintf(buff, size, "Announcing %.*s", r->len, r->text);
+    default:
+        return snprintf(buff, size, "%.*s", r->len, r->text);
+    }
+}
+
+// Appends the record's line for a file sink to buff; returns the new length.
+static size_t log_line(const LogRecord *r, char *buff, size_t len, size_t size) {
+    static __thread time_t last_sec;
+    static __thread char   stamp[32];
+    time_t                 sec = r->time_ns / 1000000000ull;
+    int                    n;
+
+    // Records come in bursts from the same second: format it once.
+    if (sec != last_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        last_sec = sec;
+    }
+    n = snprintf(buff + len, size - len, "%s", stamp);
+    len += n;
+    n = snprintf(buff + len, size - len, ".%03d blackjackd[%d] %s: ", (int)(r->time_ns / 1000000 % 1000),
+                 (int)r->pid, priorities[r->priority & 7]);
+    len += n;
+    n = log_message(r, buff + len, size - len - 1);
+    len += (size_t)n < size - len - 1 ? (size_t)n : size - len - 2;
+    buff[len++] = '\n';
+    return len;
+}
+
+static void log_write(const char *buff, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(log_fd, buff, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buff += n;
+        len -= n;
+    }
+}
+
+static void log_sync(const LogRecord *r) {
+    char buff[LOG_LINE_MAX];
+
+    if (log_fd < 0) {
+        log_message(r, buff, sizeof(buff));
+        syslog(r->priority, "%s", buff);
+    } else {
+        log_write(buff, log_line(r, buff, 0, sizeof(buff)));
+    }
+}
+
+// Claims the next position, or returns NULL if the writer is a whole ring
+// behind. Lock-free: producers only race on the CAS of `head`.
+static LogCell *ring_claim(uint64_t *pos) {
+    uint64_t p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        LogCell *cell = &ring->cells[p & (LOG_RING_SIZE - 1)];
+        int64_t  dif = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - p);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &p, p + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return cell;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void log_put(int priority, LogEvent event, const char *text, size_t len) {
+    if (len > LOG_TEXT_MAX)
+        len = LOG_TEXT_MAX;
+
+    if (ring == NULL) {
+        LogRecord r;
+        log_record(&r, priority, event);
+        memcpy(r.text, text, len);
+        r.len = len;
+        log_sync(&r);
+        return;
+    }
+
+    uint64_t pos;
+    LogCell *cell = ring_claim(&pos);
+    if (cell == NULL) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    log_record(&cell->record, priority, event);
+    memcpy(cell->record.text, text, len);
+    cell->record.len = len;
+    // Fails only if the writer gave up on this record (ring_take()).
+    __atomic_compare_exchange_n(&cell->seq, &pos, pos + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+void log_event(int priority, LogEvent event, const char *text) {
+    log_put(priority, event, text, strlen(text));
+}
+
+void log_printf(int priority, const char *fmt, ...) {
+    char    text[LOG_TEXT_MAX + 1];
+    va_list ap;
+    int     n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    log_put(priority, LOG_EVENT_TEXT, text, (size_t)n);
+}
+
+uint64_t logger_dropped(void) {
+    return ring == NULL ? 0 : __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+// Whether the writer has waited LOG_STALL_MS on the record at `pos`.
+static int ring_stalled(uint64_t pos) {
+    struct timespec ts;
+    uint64_t        now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (stall_pos != pos) {
+        stall_pos = pos;
+        stall_ms = now;
+    }
+    return now - stall_ms >= LOG_STALL_MS;
+}
+
+static int ring_take(LogRecord *r) {
+    LogCell *cell;
+
+    while (1) {
+        uint64_t seq;
+
+        cell = &ring->cells[ring_tail & (LOG_RING_SIZE - 1)];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == ring_tail + 1)
+            break;
+        // Claimed (head is past it) but not written yet. A forked child
+        // killed between the two never will, so past the deadline the
+        // record is given up on; the CAS settles a race with a late write.
+        if (seq != ring_tail || __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring_tail ||
+            !ring_stalled(ring_tail))
+            return 0;
+        if (__atomic_compare_exchange_n(&cell->seq, &seq, ring_tail + LOG_RING_SIZE, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            ring_tail++;
+            ring_lost++;
+        }
+    }
+    *r = cell->record;
+    __atomic_store_n(&cell->seq, ring_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    ring_tail++;
+    return 1;
+}
+
+// The writer's own warning, added to its batch; returns the new length.
+static size_t writer_note(char *buff, size_t len, const char *fmt, ...) {
+    LogRecord r;
+    va_list   ap;
+    int       n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(r.text, sizeof(r.text), fmt, ap);
+    va_end(ap);
+    log_record(&r, LOG_WARNING, LOG_EVENT_TEXT);
+    r.len = n;
+    if (log_fd < 0) {
+        log_sync(&r);
+        return len;
+    }
+    if (len > LOG_BATCH_BYTES - LOG_LINE_MAX) {
+        log_write(buff, len);
+        len = 0;
+    }
+    return log_line(&r, buff, len, len + LOG_LINE_MAX);
+}
+
+// The writer: drains whatever is in the ring, formats it into one buffer
+// and writes it with one system call (syslog gets one call per record),
+// then sleeps a little when there was nothing to do.
+static void *logger_run(void *arg) {
+    static char buff[LOG_BATCH_BYTES];
+    uint64_t    dropped_seen = 0;
+    LogRecord   r;
+
+    (void)arg;
+    while (1) {
+        size_t   len = 0;
+        uint64_t taken = 0, dropped;
+
+        while (ring_take(&r)) {
+            taken++;
+            if (log_fd < 0) {
+                log_sync(&r);
+                continue;
+            }
+            if (len > sizeof(buff) - LOG_LINE_MAX) {
+                log_write(buff, len);
+                len = 0;
+            }
+            len = log_line(&r, buff, len, len + LOG_LINE_MAX);
+        }
+
+        dropped = logger_dropped();
+        if (dropped != dropped_seen) {
+            len = writer_note(buff, len, "%llu log records dropped: the ring was full",
+                              (unsigned long long)(dropped - dropped_seen));
+            STAT_ADD(log_dropped, dropped - dropped_seen);
+            dropped_seen = dropped;
+        }
+        if (ring_lost > 0) {
+            len = writer_note(buff, len, "%llu log records lost: a process died writing them",
+                              (unsigned long long)ring_lost);
+            STAT_ADD(log_dropped, ring_lost);
+            ring_lost = 0;
+        }
+
+        if (len > 0)
+            log_write(buff, len);
+        __atomic_store_n(&ring->written, ring_tail, __ATOMIC_RELEASE);
+        if (taken > 0) {
+            STAT_ADD(log_records, taken);
+        } else {
+            struct timespec pause = { 0, LOG_FLUSH_MS * 1000000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+int logger_start(void) {
+    pthread_t tid;
+
+    if (ring == NULL)
+        return 0;
+    if (pthread_create(&tid, NULL, logger_run, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    started = 1;
+    return 0;
+}
+
+// Returns once what was logged before the call is written out, or after
+// LOG_STALL_MS: for the last records of a process about to exit. Before
+// logger_start() the ring is drained here.
+void logger_flush(void) {
+    uint64_t        head;
+    LogRecord       r;
+    struct timespec pause = { 0, 1000000 };
+
+    if (ring == NULL)
+        return;
+    if (!started) {
+        while (ring_take(&r))
+            log_sync(&r);
+        return;
+    }
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < LOG_STALL_MS && (int64_t)(__atomic_load_n(&ring->written, __ATOMIC_ACQUIRE) - head) < 0; i++)
+        nanosleep(&pause, NULL);
+}
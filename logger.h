@@ -0,0 +1,48 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <syslog.h>
+
+#define LOG_RING_SIZE 4096      // records; a power of two
+#define LOG_TEXT_MAX 232        // a record is 248 bytes
+#define LOG_FLUSH_MS 10         // how long the writer sleeps on an empty ring
+#define LOG_STALL_MS 1000       // how long a claimed record may stay unwritten
+
+// What a record says. Producers only copy their arguments into the ring;
+// the writer thread turns them into text.
+typedef enum {
+    LOG_EVENT_TEXT,             // text is the whole message
+    LOG_EVENT_CONNECT,          // text is a player's name
+    LOG_EVENT_DISCONNECT,
+    LOG_EVENT_BEACON            // text is the address announced
+} LogEvent;
+
+typedef struct {
+    uint64_t time_ns;           // CLOCK_REALTIME
+    int32_t  pid;
+    uint8_t  priority;          // syslog's
+    uint8_t  event;
+    uint16_t len;
+    char     text[LOG_TEXT_MAX];
+} LogRecord;
+
+// Asynchronous logging: records go through a bounded lock-free ring that
+// is mapped shared before any fork, so session threads and forked children
+// all enqueue without a system call, and one writer thread in the parent
+// formats and writes them in batches. A full ring drops the record and
+// counts it rather than making the request wait. So does a record that a
+// process claimed and never finished, because it died in between: after
+// LOG_STALL_MS the writer skips it instead of waiting on it for good.
+//
+// The sink is syslog (path NULL), standard output ("-") or a file.
+// Until logger_init() is called, and with `synchronous` set, every call
+// writes its line at once as before.
+int logger_init(const char *path, int synchronous);
+int logger_start(void);
+void logger_flush(void);
+void log_event(int priority, LogEvent event, const char *text);
+void log_printf(int priority, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+uint64_t logger_dropped(void);
+
+#endif
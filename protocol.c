@@ -0,0 +1,51 @@
+#include <string.h>
+#include "protocol.h"
+
+static void frame_header(uint8_t *dst, int type, size_t len) {
+    dst[0] = FRAME_MAGIC;
+    dst[1] = type;
+    put_u16(dst + 2, len);
+}
+
+// Writes a whole frame to dst, which must hold FRAME_HEADER_LEN + len bytes.
+// Returns the bytes written.
+size_t frame_put(uint8_t *dst, int type, const void *payload, size_t len) {
+    frame_header(dst, type, len);
+    if (len > 0)
+        memcpy(dst + FRAME_HEADER_LEN, payload, len);
+    return FRAME_HEADER_LEN + len;
+}
+
+size_t frame_ranking_row(uint8_t *dst, uint32_t rank, const char *name, int wins, int draws, int losses) {
+    uint8_t *p = dst + FRAME_HEADER_LEN;
+    size_t   len = strlen(name);
+
+    put_u32(p, rank);
+    put_u32(p + 4, wins);
+    put_u32(p + 8, draws);
+    put_u32(p + 12, losses);
+    memcpy(p + RANKING_ROW_FIXED, name, len);
+
+    frame_header(dst, MSG_RANKING_ROW, RANKING_ROW_FIXED + len);
+    return FRAME_HEADER_LEN + RANKING_ROW_FIXED + len;
+}
+
+// Looks for one complete frame at the start of buf. Returns its total size,
+// 0 if more bytes are needed, or -1 if buf does not start with a frame.
+long frame_get(const uint8_t *buf, size_t len, int *type, const uint8_t **payload, size_t *payload_len) {
+    if (len < FRAME_HEADER_LEN)
+        return len > 0 && buf[0] != FRAME_MAGIC ? -1 : 0;
+    if (buf[0] != FRAME_MAGIC)
+        return -1;
+
+    size_t n = get_u16(buf + 2);
+    if (n > FRAME_MAX_PAYLOAD)
+        return -1;
+    if (len < FRAME_HEADER_LEN + n)
+        return 0;
+
+    *type = buf[1];
+    *payload = buf + FRAME_HEADER_LEN;
+    *payload_len = n;
+    return FRAME_HEADER_LEN + n;
+}
@@ -0,0 +1,90 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary protocol. Every message is a frame: FRAME_MAGIC, the message type,
+// the payload length (16 bits, network order) and the payload. Integers in
+// payloads are in network order too; strings run to the end of the payload.
+//
+// The server greets every connection in text. A client that wants frames
+// sends MSG_HELLO as its very first message; the server answers with
+// MSG_HELLO and MSG_PROMPT_NAME and speaks frames from then on. Clients skip
+// whatever arrives before the first FRAME_MAGIC byte, which the text
+// greeting never contains (it cannot start a UTF-8 character either, so a
+// typed name is never mistaken for a hello).
+#define FRAME_MAGIC 0xB7
+#define FRAME_HEADER_LEN 4
+#define FRAME_MAX_PAYLOAD 1024
+#define PROTOCOL_VERSION 1
+
+enum {
+    // Both directions.
+    MSG_HELLO = 1,          // u8 version; from a client resuming, then its u64 resume token
+    // Server to client.
+    MSG_PROMPT_NAME,        // -
+    MSG_MENU,               // player name
+    MSG_DEAL,               // u8 DEAL_*, u8 card, u8 new score
+    MSG_PROMPT_HIT,         // u8 score
+    MSG_PROMPT_ACE,         // u8 card
+    MSG_RESULT,             // i8 outcome (1 win, 0 draw, -1 loss), u8 player score, u8 dealer score
+    MSG_RANKING_ROW,        // u32 rank (0 in the full listing), u32 wins, draws, losses, name
+    MSG_RANKING_END,        // u32 players in the ranking
+    MSG_TEXT,               // a notice for the player
+    // Client to server.
+    MSG_NAME,               // name
+    MSG_CHOOSE,             // u8 menu option, u16 argument (K for the top players)
+    MSG_HIT,                // u8 1: draw, 0: stand
+    MSG_ACE,                // u8 1 or 11
+    // Added after the first release.
+    MSG_QUEUE,              // to client: u16 place in the lobby, u32 estimated wait in ms
+    MSG_HINT,               // to server, at a hit or ace prompt: -
+                            // to client: i16 EV of standing, hitting, an ace as 1, as 11
+                            // (1/10000 of a bet; ev.h)
+    MSG_RESUME              // to client, after login or a resume: u64 token, u16 grace period in s;
+                            // token 0 before a close: the session is over, do not reconnect
+};
+
+enum {
+    DEAL_PLAYER,
+    DEAL_DEALER_UP,         // the dealer's face-up card
+    DEAL_DEALER
+};
+
+#define RANKING_ROW_FIXED 16
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, v >> 32);
+    put_u32(p + 4, v);
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) << 32 | get_u32(p + 4);
+}
+
+size_t frame_put(uint8_t *dst, int type, const void *payload, size_t len);
+size_t frame_ranking_row(uint8_t *dst, uint32_t rank, const char *name, int wins, int draws, int losses);
+long frame_get(const uint8_t *buf, size_t len, int *type, const uint8_t **payload, size_t *payload_len);
+
+#endif
@@ -0,0 +1,813 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rankings.h"
+#include "logger.h"
+
+#define SNAPSHOT_MAGIC "BJSNAP1"
+
+// rankings.snap: this header followed by Player[count], in store order, and
+// in a cluster by their PlayerCounts[count].
+typedef struct {
+    char     magic[8];
+    uint32_t count;
+    uint32_t nodes;         // 0: no counts follow
+    uint64_t journal_gen;   // first journal segment not folded in
+} SnapshotHeader;
+
+_Static_assert(sizeof(JournalRecord) == 16, "journal records are 16 bytes");
+_Static_assert(sizeof(((Player *)0)->name) < JOURNAL_NAME_SLOTS * sizeof(JournalRecord),
+               "a player name fits its journal slots");
+
+RankingHeader  *ranking;            // fixed address, reserved up front
+int             ranking_node;
+int             ranking_nodes = 1;
+static int      ranking_fd = -1;
+static size_t   ranking_mapped;     // bytes of the region this process has mapped
+static char     ranking_dir[256];   // empty: nothing is persisted
+static int      journal_fd = -1;
+static uint64_t journal_fd_gen;     // segment journal_fd has open
+static uint64_t journal_synced;     // records in it at the last fdatasync
+
+static size_t ranking_size(uint32_t capacity) {
+    size_t size = sizeof(RankingHeader) + capacity * (sizeof(Player) + 4 * sizeof(uint32_t));
+    return ranking_nodes > 1 ? size + capacity * sizeof(PlayerCounts) : size;
+}
+
+Player *ranking_players(void) {
+    return (Player *)(ranking + 1);
+}
+
+// Leaderboard: order[] lists player indexes by wins, most first, and pos[]
+// is its inverse. Wins only ever grow by one, so a win moves the player to
+// the front of their old wins group with a single swap; only finding that
+// group's start needs a binary search.
+static uint32_t *ranking_order(void) {
+    return (uint32_t *)(ranking_players() + ranking->capacity);
+}
+
+static uint32_t *ranking_pos(void) {
+    return ranking_order() + ranking->capacity;
+}
+
+static uint32_t *ranking_slots(void) {
+    return ranking_pos() + ranking->capacity;
+}
+
+// A player's G-counter columns; only in a cluster.
+PlayerCounts *ranking_counts(uint32_t index) {
+    return (PlayerCounts *)(ranking_slots() + 2 * ranking->capacity) + index;
+}
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;   // FNV-1a
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Another process may have grown the region since we last looked.
+static int ranking_map(void) {
+    size_t size = ranking_size(ranking->capacity);
+
+    if (size <= ranking_mapped)
+        return 0;
+    if (mmap(ranking, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ranking_fd, 0) == MAP_FAILED) {
+        log_printf(LOG_ERR, "Failed to map rankings: %s", strerror(errno));
+        return -1;
+    }
+    __atomic_store_n(&ranking_mapped, size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ranking_lock(void) {
+    if (pthread_mutex_lock(&ranking->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&ranking->lock);   // a child died mid-update
+    ranking_map();
+}
+
+void ranking_unlock(void) {
+    pthread_mutex_unlock(&ranking->lock);
+}
+
+int ranking_init(void) {
+    char name[64];
+    pthread_mutexattr_t attr;
+
+    if (ranking != NULL) {
+        munmap(ranking, RANKING_MAX_BYTES);
+        close(ranking_fd);
+        ranking = NULL;
+    }
+
+    snprintf(name, sizeof(name), "/blackjackd.%d", (int)getpid());
+    if ((ranking_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return -1;
+    shm_unlink(name);   /* children inherit the descriptor, nobody needs the name */
+
+    if (ftruncate(ranking_fd, ranking_size(RANKING_INITIAL_CAPACITY)) < 0)
+        return -1;
+
+    // Reserve address space for the largest region we will ever grow to, so
+    // growing never moves the mapping under another thread's feet.
+    ranking = mmap(NULL, RANKING_MAX_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ranking == MAP_FAILED) {
+        ranking = NULL;
+        return -1;
+    }
+
+    if (mmap(ranking, ranking_size(RANKING_INITIAL_CAPACITY), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, ranking_fd, 0) == MAP_FAILED)
+        return -1;
+    ranking_mapped = ranking_size(RANKING_INITIAL_CAPACITY);
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&ranking->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    ranking->capacity = RANKING_INITIAL_CAPACITY;
+    ranking->count = 0;
+    return 0;
+}
+
+static void ranking_index(uint32_t index) {
+    uint32_t  mask = 2 * ranking->capacity - 1;
+    uint32_t *slots = ranking_slots();
+    uint32_t  i = name_hash(ranking_players()[index].name) & mask;
+
+    while (slots[i] != 0)
+        i = (i + 1) & mask;
+    slots[i] = index + 1;
+}
+
+static void ranking_reindex(void) {
+    memset(ranking_slots(), 0, 2 * ranking->capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < ranking->count; i++)
+        ranking_index(i);
+}
+
+static int ranking_grow(void) {
+    uint32_t      capacity = ranking->capacity * 2;
+    uint32_t     *old_order = ranking_order();
+    uint32_t     *old_pos = ranking_pos();
+    PlayerCounts *old_counts = ranking_counts(0);
+
+    if (ranking_size(capacity) > RANKING_MAX_BYTES)
+        return -1;
+    if (ftruncate(ranking_fd, ranking_size(capacity)) < 0) {
+        log_printf(LOG_ERR, "Failed to grow rankings: %s", strerror(errno));
+        return -1;
+    }
+
+    ranking->capacity = capacity;
+    if (ranking_map() < 0)
+        return -1;
+
+    // The player array now runs over the old leaderboard and index: move the
+    // counts and the leaderboard past it (the furthest first) and rebuild the
+    // index behind that.
+    if (ranking_nodes > 1)
+        memmove(ranking_counts(0), old_counts, ranking->count * sizeof(PlayerCounts));
+    memmove(ranking_pos(), old_pos, ranking->count * sizeof(uint32_t));
+    memmove(ranking_order(), old_order, ranking->count * sizeof(uint32_t));
+    ranking_reindex();
+    return 0;
+}
+
+// First position in order[] whose player has at most `wins` wins; that is
+// also how many players have more wins.
+static uint32_t leaderboard_find(int wins, uint32_t end) {
+    Player   *players = ranking_players();
+    uint32_t *order = ranking_order();
+    uint32_t  lo = 0, hi = end;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (players[order[mid]].wins > wins)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Called just before the player's wins go up by one.
+static void leaderboard_win(uint32_t index) {
+    uint32_t *order = ranking_order();
+    uint32_t *pos = ranking_pos();
+    uint32_t  from = pos[index];
+    uint32_t  to = leaderboard_find(ranking_players()[index].wins, from);
+
+    order[from] = order[to];
+    pos[order[from]] = from;
+    order[to] = index;
+    pos[index] = to;
+}
+
+static Player *sort_players;
+
+static int by_wins(const void *a, const void *b) {
+    int wa = sort_players[*(const uint32_t *)a].wins;
+    int wb = sort_players[*(const uint32_t *)b].wins;
+    return (wa < wb) - (wa > wb);
+}
+
+// Recovery sets counters directly; order everyone once at the end instead.
+static void leaderboard_rebuild(void) {
+    uint32_t *order = ranking_order();
+    uint32_t *pos = ranking_pos();
+
+    for (uint32_t i = 0; i < ranking->count; i++)
+        order[i] = i;
+    sort_players = ranking_players();
+    qsort(order, ranking->count, sizeof(uint32_t), by_wins);
+    for (uint32_t i = 0; i < ranking->count; i++)
+        pos[order[i]] = i;
+}
+
+// Copies out up to k leaders, most wins first. The caller holds the lock.
+uint32_t ranking_top(uint32_t k, Player *out) {
+    Player   *players = ranking_players();
+    uint32_t *order = ranking_order();
+
+    if (k > ranking->count)
+        k = ranking->count;
+    for (uint32_t i = 0; i < k; i++)
+        out[i] = players[order[i]];
+    return k;
+}
+
+// Competition rank (1 + players with more wins) of a player, 0 if unknown.
+// The caller holds the lock.
+uint32_t ranking_rank(const char *name, Player *out) {
+    Player *p = ranking_find(name, 0);
+
+    if (p == NULL)
+        return 0;
+    *out = *p;
+    return leaderboard_find(p->wins, ranking_pos()[p - ranking_players()]) + 1;
+}
+
+// Looks a player up through the name index, adding them if asked to.
+// The caller holds the ranking lock.
+Player *ranking_find(const char *name, int create) {
+    uint32_t  mask = 2 * ranking->capacity - 1;
+    uint32_t *slots = ranking_slots();
+
+    for (uint32_t i = name_hash(name) & mask; slots[i] != 0; i = (i + 1) & mask) {
+        Player *p = &ranking_players()[slots[i] - 1];
+        if (strcmp(p->name, name) == 0)
+            return p;
+    }
+
+    if (!create)
+        return NULL;
+    if (ranking->count == ranking->capacity && ranking_grow() < 0)
+        return NULL;
+
+    uint32_t index = ranking->count;
+    Player  *p = &ranking_players()[index];
+    memset(p, 0, sizeof(*p));
+    strncpy(p->name, name, sizeof(p->name) - 1);
+    if (ranking_nodes > 1)
+        memset(ranking_counts(index), 0, sizeof(PlayerCounts));
+    ranking_index(index);
+    ranking_order()[index] = index;     // no wins yet: the end is in order
+    ranking_pos()[index] = index;
+    __atomic_store_n(&ranking->count, index + 1, __ATOMIC_RELEASE);  // publish to ranking_view()
+    return p;
+}
+
+// Read-only access without the lock. Records never move (the address range
+// is reserved up front) and a name never changes once count covers it, so
+// a view can walk [0, count) of the mapping directly. Counters read this way
+// may be one hand behind, which a ranking view can live with.
+Player *ranking_view(uint32_t *count) {
+    uint32_t n = __atomic_load_n(&ranking->count, __ATOMIC_ACQUIRE);
+
+    // Another process may have grown the region: extend our mapping first.
+    if (sizeof(RankingHeader) + (size_t)n * sizeof(Player) > __atomic_load_n(&ranking_mapped, __ATOMIC_ACQUIRE)) {
+        ranking_lock();
+        ranking_unlock();
+    }
+
+    *count = n;
+    return ranking_players();
+}
+
+static void journal_path(char *path, size_t size, uint64_t gen) {
+    snprintf(path, size, "%s/journal.%llu", ranking_dir, (unsigned long long)gen);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Follows a rotation done by the compactor, possibly in another process.
+// The caller holds the ranking lock.
+static int journal_reopen(void) {
+    char path[300];
+
+    if (journal_fd >= 0 && journal_fd_gen == ranking->journal_gen)
+        return 0;
+
+    journal_path(path, sizeof(path), ranking->journal_gen);
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_printf(LOG_ERR, "Failed to open journal %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (journal_fd >= 0)
+        close(journal_fd);
+    journal_fd = fd;
+    journal_fd_gen = ranking->journal_gen;
+    journal_synced = 0;
+    return 0;
+}
+
+static uint64_t journal_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Fills the records that introduce a new player; returns how many.
+static int journal_player(JournalRecord *rec, uint32_t player_id, const char *name, uint64_t now) {
+    memset(rec, 0, (1 + JOURNAL_NAME_SLOTS) * sizeof(JournalRecord));
+    rec[0].player_id = player_id;
+    rec[0].type = JOURNAL_PLAYER;
+    rec[0].timestamp = now;
+    strncpy((char *)&rec[1], name, JOURNAL_NAME_SLOTS * sizeof(JournalRecord) - 1);
+    return 1 + JOURNAL_NAME_SLOTS;
+}
+
+// One write() per call: O_APPEND keeps records from concurrent processes
+// whole, and durability comes from the compactor's batched fdatasync.
+static void journal_write(const JournalRecord *rec, int n) {
+    if (ranking_dir[0] == '\0' || journal_reopen() < 0)
+        return;
+
+    if (write_all(journal_fd, rec, n * sizeof(JournalRecord)) < 0) {
+        log_printf(LOG_ERR, "Failed to append to journal: %s", strerror(errno));
+        return;
+    }
+    ranking->journal_records += n;
+}
+
+// A player's totals over every node's column.
+static void ranking_sum(uint32_t index, Player *out) {
+    const PlayerCounts *c = ranking_counts(index);
+
+    out->wins = out->draws = out->losses = 0;
+    for (int i = 0; i < RANKING_MAX_NODES; i++) {
+        out->wins += c->counts[i][0];
+        out->draws += c->counts[i][1];
+        out->losses += c->counts[i][2];
+    }
+}
+
+// Which column of a node's counts an outcome goes to, or -1.
+static int outcome_counter(int outcome) {
+    return outcome == 1 ? 0 : outcome == 0 ? 1 : outcome == -1 ? 2 : -1;
+}
+
+// Applies one journal segment to the store. Returns the records applied, or
+// -1 if the segment does not exist. A torn tail from a crash is ignored.
+static long journal_replay(const char *path) {
+    struct stat st;
+    long        i = 0;
+    int         fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(JournalRecord)) {
+        close(fd);
+        return 0;
+    }
+
+    long n = st.st_size / sizeof(JournalRecord);
+    const JournalRecord *rec = mmap(NULL, n * sizeof(JournalRecord), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rec == MAP_FAILED) {
+        log_printf(LOG_ERR, "Failed to map journal %s: %s", path, strerror(errno));
+        return 0;
+    }
+    madvise((void *)rec, n * sizeof(JournalRecord), MADV_SEQUENTIAL);
+
+    Player *players = ranking_players();
+    for (; i < n; i++) {
+        int k = outcome_counter(rec[i].outcome);
+
+        if (rec[i].type == JOURNAL_RESULT) {
+            if (rec[i].player_id >= ranking->count)
+                continue;
+            Player *p = &players[rec[i].player_id];
+            if (rec[i].outcome == 1) p->wins++;
+            else if (rec[i].outcome == 0) p->draws++;
+            else if (rec[i].outcome == -1) p->losses++;
+            if (ranking_nodes > 1 && k >= 0)
+                ranking_counts(rec[i].player_id)->counts[ranking_node][k]++;
+        } else if (rec[i].type == JOURNAL_MERGE) {
+            // Without a cluster there are no columns to merge into.
+            if (ranking_nodes == 1 || rec[i].player_id >= ranking->count || rec[i].node >= RANKING_MAX_NODES || k < 0)
+                continue;
+            uint32_t *c = &ranking_counts(rec[i].player_id)->counts[rec[i].node][k];
+            if (rec[i].timestamp > *c)
+                *c = rec[i].timestamp;
+        } else if (rec[i].type == JOURNAL_PLAYER && i + JOURNAL_NAME_SLOTS < n) {
+            char name[sizeof(players->name)];
+            strncpy(name, (const char *)&rec[i + 1], sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+
+            Player *p = ranking_find(name, 1);
+            if (p == NULL)
+                break;
+            if ((uint32_t)(p - players) != rec[i].player_id)
+                log_printf(LOG_WARNING, "Journal id %u for %s replayed as %u", rec[i].player_id, name, (unsigned)(p - players));
+            i += JOURNAL_NAME_SLOTS;
+        } else {
+            break;
+        }
+    }
+
+    munmap((void *)rec, n * sizeof(JournalRecord));
+    return i;
+}
+
+// The snapshot has the store's own record layout, so loading it is one copy
+// out of the mapped file: nothing is parsed.
+static int snapshot_load(const char *path, uint64_t *journal_gen, uint32_t *nodes) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    const SnapshotHeader *hdr = MAP_FAILED;
+    if (st.st_size >= (off_t)sizeof(SnapshotHeader))
+        hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if (hdr == MAP_FAILED || memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        (size_t)st.st_size < sizeof(*hdr) + (size_t)hdr->count * (sizeof(Player) + (hdr->nodes ? sizeof(PlayerCounts) : 0))) {
+        log_printf(LOG_ERR, "Rankings snapshot %s is corrupt", path);
+        if (hdr != MAP_FAILED)
+            munmap((void *)hdr, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (ranking->capacity < hdr->count) {
+        if (ranking_grow() < 0) {
+            munmap((void *)hdr, st.st_size);
+            return -1;
+        }
+    }
+
+    memcpy(ranking_players(), hdr + 1, (size_t)hdr->count * sizeof(Player));
+    ranking->count = hdr->count;
+    ranking_reindex();
+    *journal_gen = hdr->journal_gen;
+    *nodes = ranking_nodes > 1 ? hdr->nodes : 0;
+    if (*nodes > 0)
+        memcpy(ranking_counts(0), (const Player *)(hdr + 1) + hdr->count, (size_t)hdr->count * sizeof(PlayerCounts));
+
+    munmap((void *)hdr, st.st_size);
+    return 1;
+}
+
+// Recovers the store from dir: the snapshot, then every journal segment
+// after it. Without a snapshot the legacy text file is imported instead.
+// Returns the number of records that are not in a snapshot yet, or -1.
+long ranking_open(const char *dir, const char *legacy_file) {
+    char     path[300];
+    uint64_t gen = 1, last;
+    long     pending = 0, n = 0;
+    uint32_t nodes = 0;
+    int      found;
+
+    snprintf(ranking_dir, sizeof(ranking_dir), "%s", dir);
+    snprintf(path, sizeof(path), "%s/rankings.snap", ranking_dir);
+
+    ranking_lock();
+    if ((found = snapshot_load(path, &gen, &nodes)) < 0) {
+        ranking_unlock();
+        return -1;
+    }
+    if (!found && legacy_file != NULL) {
+        load_rankings(legacy_file);
+        pending = ranking->count;
+    }
+
+    // Joining a cluster: what this node recorded alone becomes its column.
+    if (ranking_nodes > 1 && nodes == 0) {
+        for (uint32_t i = 0; i < ranking->count; i++) {
+            const Player *p = &ranking_players()[i];
+            uint32_t     *c = ranking_counts(i)->counts[ranking_node];
+            memset(ranking_counts(i), 0, sizeof(PlayerCounts));
+            c[0] = p->wins;
+            c[1] = p->draws;
+            c[2] = p->losses;
+        }
+    }
+
+    for (last = gen; ; gen++) {
+        journal_path(path, sizeof(path), gen);
+        long replayed = journal_replay(path);
+        if (replayed < 0)
+            break;
+        pending += replayed;
+        n = replayed;
+        last = gen;
+    }
+
+    if (ranking_nodes > 1)
+        for (uint32_t i = 0; i < ranking->count; i++)
+            ranking_sum(i, &ranking_players()[i]);
+    leaderboard_rebuild();
+    ranking->journal_gen = last;
+    ranking->journal_records = n;
+    int ok = journal_reopen();
+    ranking_unlock();
+
+    log_printf(LOG_INFO, "Rankings recovered from %s: %u players, %ld journal records", dir, ranking->count, pending);
+    return ok < 0 ? -1 : pending;
+}
+
+// Folds the journal into a new snapshot. Appends switch to a fresh segment
+// under the lock, so the copied store matches exactly the segments the new
+// snapshot replaces; the slow part runs without holding up any session.
+int ranking_compact(void) {
+    char     path[300], tmp[300];
+    Player  *copy;
+    uint32_t count;
+
+    ranking_lock();
+    uint64_t old_gen = ranking->journal_gen;
+    ranking->journal_gen = old_gen + 1;
+    if (journal_reopen() < 0) {
+        ranking->journal_gen = old_gen;
+        ranking_unlock();
+        return -1;
+    }
+    ranking->journal_records = 0;
+
+    count = ranking->count;
+    size_t counts_size = ranking_nodes > 1 ? (size_t)count * sizeof(PlayerCounts) : 0;
+    if ((copy = malloc((size_t)count * sizeof(Player) + counts_size + 1)) == NULL) {
+        ranking_unlock();
+        return -1;
+    }
+    memcpy(copy, ranking_players(), (size_t)count * sizeof(Player));
+    if (counts_size > 0)
+        memcpy(copy + count, ranking_counts(0), counts_size);
+    ranking_unlock();
+
+    SnapshotHeader hdr = { .magic = SNAPSHOT_MAGIC, .count = count, .journal_gen = old_gen + 1,
+                           .nodes = ranking_nodes > 1 ? ranking_nodes : 0 };
+    snprintf(path, sizeof(path), "%s/rankings.snap", ranking_dir);
+    snprintf(tmp, sizeof(tmp), "%s/rankings.snap.tmp", ranking_dir);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+        write_all(fd, copy, (size_t)count * sizeof(Player) + counts_size) < 0 || fsync(fd) < 0) {
+        log_printf(LOG_ERR, "Failed to write rankings snapshot: %s", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        free(copy);
+        return -1;
+    }
+    close(fd);
+    free(copy);
+
+    if (rename(tmp, path) < 0) {
+        log_printf(LOG_ERR, "Failed to install rankings snapshot: %s", strerror(errno));
+        return -1;
+    }
+    if ((fd = open(ranking_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    for (uint64_t gen = old_gen; gen > 0; gen--) {
+        journal_path(path, sizeof(path), gen);
+        if (unlink(path) < 0)
+            break;
+    }
+
+    log_printf(LOG_INFO, "Rankings snapshot written: %u players", count);
+    return 0;
+}
+
+// Only the compactor thread rotates journal_fd, so it can sync it unlocked.
+void ranking_sync(void) {
+    uint64_t records = __atomic_load_n(&ranking->journal_records, __ATOMIC_RELAXED);
+
+    if (journal_fd < 0 || records == journal_synced)
+        return;
+    if (fdatasync(journal_fd) < 0)
+        log_printf(LOG_ERR, "Failed to sync journal: %s", strerror(errno));
+    journal_synced = records;
+}
+
+void *ranking_compactor(void *arg) {
+    (void)arg;
+
+    while (1) {
+        usleep(JOURNAL_SYNC_MS * 1000);
+        ranking_sync();
+        if (__atomic_load_n(&ranking->journal_records, __ATOMIC_RELAXED) >= JOURNAL_COMPACT_RECORDS)
+            ranking_compact();
+    }
+    return NULL;
+}
+
+// Imports the text format older servers rewrote after every hand.
+void load_rankings(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            log_printf(LOG_ERR, "Failed to open rankings file for reading: %s", strerror(errno));
+        }
+        return;
+    }
+
+    Player player;
+    while (fscanf(file, "%49s %d %d %d", player.name, &player.wins, &player.draws, &player.losses) == 4) {
+        Player *p = ranking_find(player.name, 1);
+        if (p == NULL)
+            break;
+        p->wins = player.wins;
+        p->draws = player.draws;
+        p->losses = player.losses;
+    }
+
+    fclose(file);
+    log_printf(LOG_INFO, "Rankings loaded from file: %s", filename);
+}
+
+// The caller holds the ranking lock.
+// Applies one result and fills in its journal records; returns how many.
+static int player_result(const char *name, int result, JournalRecord *rec, uint64_t now) {
+    uint32_t count = ranking->count;
+    Player  *p = ranking_find(name, 1);
+    int      n = 0;
+
+    if (p == NULL)
+        return 0;
+
+    if (result == 1) {
+        leaderboard_win(p - ranking_players());
+        p->wins++;
+    } else if (result == 0) {
+        p->draws++;
+    } else if (result == -1) {
+        p->losses++;
+    }
+    if (ranking_nodes > 1 && outcome_counter(result) >= 0) {
+        ranking_counts(p - ranking_players())->counts[ranking_node][outcome_counter(result)]++;
+        ranking_mark(p - ranking_players());
+    }
+
+    if (ranking->count != count)
+        n = journal_player(rec, p - ranking_players(), p->name, now);
+    memset(&rec[n], 0, sizeof(rec[n]));
+    rec[n].player_id = p - ranking_players();
+    rec[n].type = JOURNAL_RESULT;
+    rec[n].outcome = result;
+    rec[n].timestamp = now;
+    return n + 1;
+}
+
+void update_player_stats(const char *name, int result) {
+    JournalRecord rec[1 + JOURNAL_NAME_SLOTS + 1];
+    int           n = player_result(name, result, rec, journal_now());
+
+    if (n > 0)
+        journal_write(rec, n);
+}
+
+// Applies up to RANKING_BATCH_MAX results with one journal write. The
+// caller holds the lock.
+void ranking_record(const RankingUpdate *u, int count) {
+    static __thread JournalRecord rec[RANKING_BATCH_MAX * (2 + JOURNAL_NAME_SLOTS)];
+    uint64_t                      now = journal_now();
+    int                           n = 0;
+
+    for (int i = 0; i < count; i++)
+        n += player_result(u[i].name, u[i].result, rec + n, now);
+    if (n > 0)
+        journal_write(rec, n);
+}
+
+uint32_t ranking_hash(const char *name) {
+    return name_hash(name);
+}
+
+int ranking_owner(const char *name) {
+    return name_hash(name) % ranking_nodes;
+}
+
+// Queues a player for the replicator. The caller holds the lock.
+void ranking_mark(uint32_t index) {
+    PlayerCounts *c = ranking_counts(index);
+
+    if (c->queued)
+        return;
+    if (ranking->dirty_len == RANKING_DIRTY_MAX) {
+        ranking->dirty_all = 1;
+        return;
+    }
+    c->queued = 1;
+    ranking->dirty[ranking->dirty_len++] = index;
+}
+
+// Takes up to max players off the dirty list. The caller holds the lock.
+uint32_t ranking_take_dirty(uint32_t *out, uint32_t max) {
+    uint32_t n = ranking->dirty_len < max ? ranking->dirty_len : max;
+
+    ranking->dirty_len -= n;
+    memcpy(out, ranking->dirty + ranking->dirty_len, n * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++)
+        ranking_counts(out[i])->queued = 0;
+    return n;
+}
+
+// Merges columns [node, node + n) of another replica's counts into a
+// player's (creating the player if need be), journals what grew and
+// updates the totals. Returns whether anything grew. The owner queues the
+// player to publish the result. The caller holds the lock.
+int ranking_merge(const char *name, int node, int n, const uint32_t counts[][3]) {
+    JournalRecord rec[1 + JOURNAL_NAME_SLOTS + RANKING_MAX_NODES * 3];
+    uint32_t      count = ranking->count;
+    uint64_t      now = journal_now();
+    Player       *p = ranking_find(name, 1);
+    int           len = 0;
+
+    if (p == NULL)
+        return 0;
+    uint32_t      index = p - ranking_players();
+    PlayerCounts *c = ranking_counts(index);
+
+    if (ranking->count != count)
+        len = journal_player(rec, index, p->name, now);
+    for (int i = node; i < node + n && i < RANKING_MAX_NODES; i++) {
+        for (int k = 0; k < 3; k++) {
+            if (counts[i - node][k] <= c->counts[i][k])
+                continue;
+            c->counts[i][k] = counts[i - node][k];
+            memset(&rec[len], 0, sizeof(rec[len]));
+            rec[len].player_id = index;
+            rec[len].type = JOURNAL_MERGE;
+            rec[len].outcome = k == 0 ? 1 : k == 1 ? 0 : -1;
+            rec[len].node = i;
+            rec[len].timestamp = c->counts[i][k];
+            len++;
+        }
+    }
+    if (len == 0)
+        return 0;
+
+    journal_write(rec, len);
+    Player sum;
+    ranking_sum(index, &sum);
+    while (p->wins < sum.wins) {
+        leaderboard_win(index);
+        p->wins++;
+    }
+    p->draws = sum.draws;
+    p->losses = sum.losses;
+    if (ranking_owner(p->name) == ranking_node)
+        ranking_mark(index);
+    return 1;
+}
@@ -0,0 +1,108 @@
+#ifndef RANKINGS_H
+#define RANKINGS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define RANKING_INITIAL_CAPACITY 64
+#define RANKING_MAX_BYTES (1ULL << 36)
+#define JOURNAL_SYNC_MS 100
+#define JOURNAL_COMPACT_RECORDS (1 << 20)
+#define RANKING_MAX_NODES 8
+#define RANKING_DIRTY_MAX 4096
+#define RANKING_BATCH_MAX 256
+
+typedef struct {
+    char name[50];
+    int wins, draws, losses;
+} Player;
+
+// One result waiting to be applied with others in a batch.
+typedef struct {
+    char   name[50];
+    int8_t result;
+} RankingUpdate;
+
+// Shared ranking store. One shm region holds every player; it is mapped by
+// the parent before any fork and therefore by every child too, and epoll
+// workers share the same mapping, so all sessions update the same counters.
+// Layout: RankingHeader, Player[capacity], the leaderboard's order[capacity]
+// and pos[capacity], then the name index: 2 * capacity open-addressing slots
+// holding a player index + 1 (0 marks an empty slot), and in a cluster
+// each player's PlayerCounts[capacity].
+// Apart from ranking_view(), everything in it is only touched with the lock
+// held.
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t        capacity;   // always a power of two
+    uint32_t        count;
+    uint64_t        journal_gen;        // segment every process appends to
+    uint64_t        journal_records;    // records in that segment
+    uint32_t        dirty_len;          // players changed since the replicator looked
+    int             dirty_all;          // dirty[] overflowed: look at everyone
+    uint32_t        dirty[RANKING_DIRTY_MAX];
+} RankingHeader;
+
+// A cluster of nodes shares one ranking. Each player's results are a
+// G-counter: every node only ever adds to its own column, a column is
+// merged by taking the larger value, and the Player's totals are the sums,
+// so replicas converge whatever order updates arrive in, and however often.
+// Players are partitioned by name hash: a node sends its columns to the
+// player's owner, which merges them and publishes the whole vector to the
+// cluster, so every node can answer reads from its own copy.
+typedef struct {
+    uint32_t counts[RANKING_MAX_NODES][3];  // wins, draws, losses per node
+    uint32_t queued;                        // on the dirty list
+} PlayerCounts;
+
+// Results journal. Every hand appends one fixed 16-byte record; the first
+// result of a new player is preceded by a JOURNAL_PLAYER record followed by
+// JOURNAL_NAME_SLOTS records' worth of name. Player ids are store indexes,
+// which replay reproduces because players are journaled in creation order.
+// It is also the node's replication log: a column merged from another node
+// is a JOURNAL_MERGE record per counter that grew.
+enum {
+    JOURNAL_RESULT = 1,
+    JOURNAL_PLAYER = 2,
+    JOURNAL_MERGE = 3
+};
+
+#define JOURNAL_NAME_SLOTS 4
+
+typedef struct {
+    uint32_t player_id;
+    uint8_t  type;
+    int8_t   outcome;       // 1: win, 0: draw, -1: loss
+    uint16_t node;          // JOURNAL_MERGE: whose column
+    uint64_t timestamp;     // milliseconds since the epoch; JOURNAL_MERGE: the new count
+} JournalRecord;
+
+extern RankingHeader *ranking;
+extern int ranking_node, ranking_nodes;    // this node, and how many (1: no cluster)
+
+int ranking_init(void);
+void ranking_lock(void);
+void ranking_unlock(void);
+Player *ranking_players(void);
+Player *ranking_find(const char *name, int create);
+Player *ranking_view(uint32_t *count);
+uint32_t ranking_top(uint32_t k, Player *out);
+uint32_t ranking_rank(const char *name, Player *out);
+
+long ranking_open(const char *dir, const char *legacy_file);
+int ranking_compact(void);
+void ranking_sync(void);
+void *ranking_compactor(void *arg);
+
+void load_rankings(const char *filename);
+void update_player_stats(const char *name, int result);
+void ranking_record(const RankingUpdate *u, int count);
+uint32_t ranking_hash(const char *name);
+
+PlayerCounts *ranking_counts(uint32_t index);
+int ranking_owner(const char *name);
+int ranking_merge(const char *name, int node, int n, const uint32_t counts[][3]);
+uint32_t ranking_take_dirty(uint32_t *out, uint32_t max);
+void ranking_mark(uint32_t index);
+
+#endif
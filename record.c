@@ -0,0 +1,646 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+#include "record.h"
+#include "stats.h"
+
+#define RECORD_BATCH_BYTES (256 * 1024)
+#define RECORD_DICT_SIZE 65536      // players per file, at most 3/4 of it; a power of two
+#define RECORD_SPAWNS 8             // compressors running at once
+
+extern char **environ;
+
+// Starts a hand's record once the up-card is out.
+void record_deal(HandRecord *h, const Shoe *shoe, int up_card, int flags) {
+    memset(h, 0, sizeof(*h));
+    h->seed = shoe->seed;
+    h->pos = shoe->next - 1;
+    h->next = shoe->next;
+    h->flags = flags | RECORD_CONTIGUOUS;
+    record_step(h, up_card);
+}
+
+// Adds a card just drawn from shoe. A card from anywhere but the next place
+// of the hand's shuffle (another seat's turn came between, the shoe ran
+// out, or the hand moved to another shoe) makes the hand non-contiguous.
+void record_card(HandRecord *h, const Shoe *shoe, int card) {
+    if (shoe->seed == h->seed && shoe->next - 1 == h->next)
+        h->next = shoe->next;
+    else
+        h->flags &= ~RECORD_CONTIGUOUS;
+    record_step(h, card);
+}
+
+// The dealer's turn from the cards left in shoe, which must be exactly the
+// ones it draws.
+static int dealer_play(Game *g, Shoe *shoe) {
+    while (g->phase == GAME_DEALER) {
+        if (g->dealer_score < DEALER_STANDS && shoe->next == shoe->size)
+            return -1;
+        game_dealer_draw(g, shoe);
+    }
+    return shoe->next == shoe->size ? 0 : -1;
+}
+
+// Plays the hand again through the engine, dealing its cards in the
+// recorded order and making the recorded choices. Returns 0 if it ends
+// exactly as recorded, -1 if it ends otherwise or the steps are not a hand
+// the engine would play.
+int record_replay(const RecordedHand *r, Game *g) {
+    const HandRecord *h = &r->hand;
+    Shoe              shoe;
+    int               i;
+
+    if (h->len == 0)
+        return -1;
+    game_join(g, record_get(h, 0));
+
+    for (i = 1; i < h->len; i++) {
+        int step = record_get(h, i);
+
+        if (step == RECORD_DEALER)
+            break;
+        if (step >= 2 && step <= CARD_ACE && g->phase == GAME_PLAYER) {
+            shoe.cards[0] = step;
+            shoe.next = 0;
+            shoe.size = 1;
+            game_hit(g, &shoe);
+        } else if ((step == RECORD_ACE_HIGH || step == RECORD_ACE_LOW) && g->phase == GAME_ACE) {
+            game_choose_ace(g, step == RECORD_ACE_HIGH ? CARD_ACE : 1);
+        } else {
+            return -1;
+        }
+    }
+    if (i == h->len)
+        return -1;
+
+    shoe.next = shoe.size = 0;
+    for (i++; i < h->len; i++) {
+        int step = record_get(h, i);
+        if (step < 1 || step > CARD_ACE)
+            return -1;
+        shoe.cards[shoe.size++] = step == 1 ? CARD_ACE : step;
+    }
+
+    game_stand(g);
+    if (h->flags & RECORD_TABLE) {
+        // The dealer played the table's hand, or not at all if every seat
+        // had busted.
+        Game dealer;
+
+        game_join(&dealer, g->up_card);
+        game_stand(&dealer);
+        if (shoe.size > 0 && dealer_play(&dealer, &shoe) < 0)
+            return -1;
+        game_settle_dealer(g, dealer.dealer_score);
+    } else if (dealer_play(g, &shoe) < 0) {
+        return -1;
+    }
+
+    if (g->phase != GAME_OVER || g->result != r->game.result || g->player_score != r->game.player_score ||
+        g->dealer_score != r->game.dealer_score)
+        return -1;
+    return 0;
+}
+
+// Checks the cards against the shuffle the seed gives: all of them for a
+// contiguous hand, the up-card alone for any other. shoe (shoe_init() with
+// the file's decks) is reshuffled unless it holds that seed's order
+// already. Returns 0 if they match.
+int record_audit(const RecordedHand *r, Shoe *shoe) {
+    const HandRecord *h = &r->hand;
+    int               pos = h->pos, last = h->flags & RECORD_CONTIGUOUS ? h->len : 1;
+
+    if (shoe->seed != h->seed)
+        shoe_shuffle_seed(shoe, h->seed);
+    for (int i = 0; i < last; i++) {
+        int step = record_get(h, i);
+
+        if (step > CARD_ACE)
+            continue;
+        if (pos >= shoe->size || shoe->cards[pos++] != (step == 1 ? CARD_ACE : step))
+            return -1;
+    }
+    return 0;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        *p++ = v >> (8 * i);
+    return p;
+}
+
+static int get_varint_long(RecordReader *r, uint64_t *v) {
+    uint64_t x = 0;
+
+    for (int shift = 0; r->p < r->end && shift < 64; shift += 7) {
+        uint8_t b = *r->p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Most values written take one byte.
+static inline int get_varint(RecordReader *r, uint64_t *v) {
+    if (r->p < r->end && *r->p < 0x80) {
+        *v = *r->p++;
+        return 0;
+    }
+    return get_varint_long(r, v);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+int record_open(RecordReader *r, const uint8_t *data, size_t len) {
+    memset(r, 0, sizeof(*r));
+    if (len < RECORD_HEADER_LEN || memcmp(data, RECORD_MAGIC, 4) != 0 || data[4] != RECORD_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+    r->decks = data[5];
+    r->time_ms = get_u64(data + 8);
+    r->p = data + RECORD_HEADER_LEN;
+    r->end = data + len;
+    return 0;
+}
+
+// Decodes the next hand. Returns 1 with it, 0 at the end of the data, and
+// -1 if what is left is not a whole entry, which is how a file cut short
+// by a crash ends.
+int record_next(RecordReader *r, RecordedHand *out, uint32_t *player) {
+    while (r->p < r->end) {
+        uint8_t       tag = *r->p++;
+        uint64_t      id, delta;
+        int           pos;
+        RecordPlayer *pl;
+        int           len, bytes;
+        uint16_t      o;
+
+        if (tag == RECORD_PLAYER) {
+            if (get_varint(r, &id) < 0 || id != r->count || r->p >= r->end)
+                return -1;
+            len = *r->p++;
+            if (len >= RECORD_NAME_MAX || r->end - r->p < len)
+                return -1;
+            if (r->count == r->cap) {
+                uint32_t      cap = r->cap ? 2 * r->cap : 1024;
+                RecordPlayer *grown = realloc(r->players, cap * sizeof(RecordPlayer));
+                if (grown == NULL)
+                    return -1;
+                r->players = grown;
+                r->cap = cap;
+            }
+            pl = &r->players[r->count++];
+            memcpy(pl->name, r->p, len);
+            pl->name[len] = '\0';
+            pl->seed = 0;
+            r->p += len;
+            continue;
+        }
+
+        if (!(tag & RECORD_HAND) || get_varint(r, &id) < 0 || id >= r->count || get_varint(r, &delta) < 0)
+            return -1;
+        pl = &r->players[id];
+        if (tag & RECORD_NEW_SEED) {
+            if (r->end - r->p < 8)
+                return -1;
+            pl->seed = get_u64(r->p);
+            r->p += 8;
+        }
+        if (r->end - r->p < 2)
+            return -1;
+        pos = r->p[0] | (r->p[1] & 1) << 8;
+        len = r->p[1] >> 1;
+        r->p += 2;
+        bytes = (len + 1) / 2;
+        if (len > RECORD_STEPS || r->end - r->p < bytes + 2)
+            return -1;
+
+        r->time_ms += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+        out->time_ms = r->time_ms;
+        out->hand.seed = pl->seed;
+        out->hand.pos = pos;
+        out->hand.next = 0;
+        out->hand.flags = tag & (RECORD_TABLE | RECORD_CONTIGUOUS);
+        out->hand.len = len;
+        // Short hands, nearly all, are one fixed-size copy.
+        if (bytes <= 8 && r->end - r->p >= 8)
+            memcpy(out->hand.step, r->p, 8);
+        else
+            memcpy(out->hand.step, r->p, bytes);
+        r->p += bytes;
+
+        o = r->p[0] | r->p[1] << 8;
+        r->p += 2;
+        out->game.phase = GAME_OVER;
+        out->game.result = (int)(o & 3) - 1;
+        out->game.player_score = o >> 2 & 31;
+        out->game.dealer_score = o >> 7 & 31;
+        out->game.up_card = len > 0 ? record_get(&out->hand, 0) : 0;
+        out->game.card = 0;
+        *player = id;
+        return 1;
+    }
+    return 0;
+}
+
+void record_close(RecordReader *r) {
+    free(r->players);
+    memset(r, 0, sizeof(*r));
+}
+
+// The ring between the game threads and the writer, the log ring's
+// (logger.c) with hands in its cells.
+typedef struct {
+    uint64_t     seq;
+    RecordedHand hand;
+} RecordCell;
+
+typedef struct {
+    _Alignas(64) uint64_t head;
+    _Alignas(64) uint64_t dropped;
+    RecordCell cells[RECORD_RING_SIZE];
+} RecordRing;
+
+typedef struct {
+    char     name[RECORD_NAME_MAX];
+    uint32_t id;
+    uint8_t  used;
+    uint64_t seed;                  // last written
+} RecordEntry;
+
+static RecordRing  *ring;           // NULL: not recording
+static uint64_t     ring_tail;
+static uint64_t     ring_lost;      // hands skipped as never written
+static uint64_t     stall_pos = UINT64_MAX, stall_ms;
+static const char  *record_dir;
+static const char  *record_compress;
+static size_t       rotate_bytes;
+static int          record_decks;
+
+// The writer's file. Players are numbered per file.
+static int          out_fd = -1;
+static char         out_path[PATH_MAX];
+static size_t       out_bytes;
+static uint64_t     out_time;       // of the last hand written
+static RecordEntry *dict;
+static uint32_t     dict_count;
+static pid_t        spawned[RECORD_SPAWNS];
+
+int recorder_init(const char *dir, int rotate_mb, const char *compress, int decks) {
+    RecordRing *r;
+
+    if ((dict = calloc(RECORD_DICT_SIZE, sizeof(RecordEntry))) == NULL)
+        return -1;
+    r = mmap(NULL, sizeof(RecordRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+        return -1;
+    for (uint64_t i = 0; i < RECORD_RING_SIZE; i++)
+        r->cells[i].seq = i;
+    record_dir = dir;
+    record_compress = compress;
+    rotate_bytes = (size_t)(rotate_mb > 0 ? rotate_mb : RECORD_DEFAULT_ROTATE) << 20;
+    record_decks = decks;
+    ring = r;
+    return 0;
+}
+
+static RecordCell *ring_claim(uint64_t *pos) {
+    uint64_t p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        RecordCell *cell = &ring->cells[p & (RECORD_RING_SIZE - 1)];
+        int64_t     dif = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - p);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &p, p + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return cell;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            p = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void recorder_put(const char *name, const Game *g, const HandRecord *h) {
+    struct timespec ts;
+    RecordCell     *cell;
+    uint64_t        pos;
+
+    if (ring == NULL)
+        return;
+    if ((cell = ring_claim(&pos)) == NULL) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    cell->hand.time_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    cell->hand.hand = *h;
+    cell->hand.game = *g;
+    strncpy(cell->hand.name, name, RECORD_NAME_MAX - 1);
+    cell->hand.name[RECORD_NAME_MAX - 1] = '\0';
+    // Fails only if the writer gave up on this hand (ring_take()).
+    __atomic_compare_exchange_n(&cell->seq, &pos, pos + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+uint64_t recorder_dropped(void) {
+    return ring == NULL ? 0 : __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+// Whether the writer has waited RECORD_STALL_MS on the hand at `pos`.
+static int ring_stalled(uint64_t pos) {
+    struct timespec ts;
+    uint64_t        now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (stall_pos != pos) {
+        stall_pos = pos;
+        stall_ms = now;
+    }
+    return now - stall_ms >= RECORD_STALL_MS;
+}
+
+// As the logger's (logger.c): a hand claimed and not written past the
+// deadline was claimed by a child that died, and is given up on.
+static int ring_take(RecordedHand *r) {
+    while (1) {
+        RecordCell *cell = &ring->cells[ring_tail & (RECORD_RING_SIZE - 1)];
+        uint64_t    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == ring_tail + 1) {
+            *r = cell->hand;
+            __atomic_store_n(&cell->seq, ring_tail + RECORD_RING_SIZE, __ATOMIC_RELEASE);
+            ring_tail++;
+            // A write that lost the race with the CAS below may have torn it.
+            if (r->hand.len > RECORD_STEPS) {
+                ring_lost++;
+                continue;
+            }
+            r->name[RECORD_NAME_MAX - 1] = '\0';
+            return 1;
+        }
+        if (seq != ring_tail || __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring_tail ||
+            !ring_stalled(ring_tail))
+            return 0;
+        if (__atomic_compare_exchange_n(&cell->seq, &seq, ring_tail + RECORD_RING_SIZE, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            ring_tail++;
+            ring_lost++;
+        }
+    }
+}
+
+static void spawn_reap(int block) {
+    for (int i = 0; i < RECORD_SPAWNS; i++) {
+        if (spawned[i] > 0 && (waitpid(spawned[i], NULL, block ? 0 : WNOHANG) != 0 || block))
+            spawned[i] = 0;
+    }
+}
+
+// Ends the current file, and starts its compression if asked to. The
+// compressor gets a process group of its own: fork mode's SIGCHLD handler
+// reaps the server's group only, so these are left to spawn_reap().
+static void file_close(void) {
+    posix_spawnattr_t attr;
+    char             *argv[3];
+    int               i;
+
+    close(out_fd);
+    out_fd = -1;
+    if (record_compress == NULL)
+        return;
+
+    spawn_reap(0);
+    for (i = 0; i < RECORD_SPAWNS && spawned[i] > 0; i++)
+        ;
+    if (i == RECORD_SPAWNS) {
+        spawn_reap(1);
+        i = 0;
+    }
+    argv[0] = (char *)record_compress;
+    argv[1] = out_path;
+    argv[2] = NULL;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    errno = posix_spawnp(&spawned[i], record_compress, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (errno != 0) {
+        spawned[i] = 0;
+        log_printf(LOG_WARNING, "Failed to run %s on %s: %s", record_compress, out_path, strerror(errno));
+    }
+}
+
+// Starts a file named for the time of its first hand, with the header in
+// buff.
+static int file_open(uint64_t now, uint8_t *buff, size_t *len) {
+    static unsigned seq;
+    time_t          sec = now / 1000;
+    struct tm       tm;
+    char            stamp[32];
+
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    for (int tries = 0; out_fd < 0 && tries < 100; tries++) {
+        snprintf(out_path, sizeof(out_path), "%s/hands-%s-%u.bjh", record_dir, stamp, seq++);
+        out_fd = open(out_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out_fd < 0 && errno != EEXIST)
+            break;
+    }
+    if (out_fd < 0)
+        return -1;
+
+    memcpy(buff, RECORD_MAGIC, 4);
+    buff[4] = RECORD_VERSION;
+    buff[5] = record_decks;
+    buff[6] = buff[7] = 0;
+    put_u64(buff + 8, now);
+    *len = RECORD_HEADER_LEN;
+    out_bytes = 0;
+    out_time = now;
+    memset(dict, 0, RECORD_DICT_SIZE * sizeof(RecordEntry));
+    dict_count = 0;
+    return 0;
+}
+
+// Writes out the batch, and ends the file once it is large enough.
+static void file_flush(const uint8_t *buff, size_t len) {
+    while (len > 0 && out_fd >= 0) {
+        ssize_t n = write(out_fd, buff, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_printf(LOG_WARNING, "Failed to write hand records to %s: %s", out_path, strerror(errno));
+            file_close();
+            return;
+        }
+        STAT_ADD(record_bytes, n);
+        out_bytes += n;
+        buff += n;
+        len -= n;
+    }
+    if (out_fd >= 0 && out_bytes >= rotate_bytes)
+        file_close();
+}
+
+// The player's entry in this file's dictionary, added (and its player
+// entry written to p) the first time.
+static RecordEntry *dict_find(const char *name, uint8_t **p) {
+    uint32_t h = 2166136261u, len = 0;
+
+    for (const char *c = name; *c != '\0'; c++, len++)
+        h = (h ^ (uint8_t)*c) * 16777619u;
+    for (uint32_t i = h & (RECORD_DICT_SIZE - 1);; i = (i + 1) & (RECORD_DICT_SIZE - 1)) {
+        RecordEntry *e = &dict[i];
+
+        if (e->used && strcmp(e->name, name) == 0)
+            return e;
+        if (e->used)
+            continue;
+        memcpy(e->name, name, len + 1);
+        e->id = dict_count++;
+        e->used = 1;
+        *(*p)++ = RECORD_PLAYER;
+        *p = put_varint(*p, e->id);
+        *(*p)++ = len;
+        memcpy(*p, name, len);
+        *p += len;
+        return e;
+    }
+}
+
+// Appends a hand's entries to buff at p; returns the new end.
+static uint8_t *record_encode(const RecordedHand *r, uint8_t *p) {
+    const HandRecord *h = &r->hand;
+    RecordEntry      *e = dict_find(r->name, &p);
+    int64_t           delta = (int64_t)(r->time_ms - out_time);
+    uint8_t           flags = h->flags & (RECORD_TABLE | RECORD_CONTIGUOUS);
+    uint16_t          o;
+
+    if (e->seed != h->seed)
+        flags |= RECORD_NEW_SEED;
+    *p++ = RECORD_HAND | flags;
+    p = put_varint(p, e->id);
+    p = put_varint(p, (uint64_t)(delta << 1) ^ (uint64_t)(delta >> 63));
+    if (flags & RECORD_NEW_SEED)
+        p = put_u64(p, h->seed);
+    *p++ = h->pos;
+    *p++ = (h->pos >> 8 & 1) | h->len << 1;
+    memcpy(p, h->step, (h->len + 1) / 2);
+    p += (h->len + 1) / 2;
+
+    o = (r->game.result + 1) | (r->game.player_score & 31) << 2 | (r->game.dealer_score & 31) << 7;
+    *p++ = o;
+    *p++ = o >> 8;
+    e->seed = h->seed;
+    out_time = r->time_ms;
+    return p;
+}
+
+// The writer: drains the ring into one buffer, a file's worth of entries at
+// most, and writes it with one system call per batch; then sleeps a little
+// when there was nothing to do.
+static void *recorder_run(void *arg) {
+    static uint8_t buff[RECORD_BATCH_BYTES];
+    uint64_t       dropped_seen = 0, dropped;
+    RecordedHand   r;
+    int            failing = 0;     // warned that no file could be opened
+
+    (void)arg;
+    while (1) {
+        uint64_t taken = 0;
+        size_t   len = 0;
+
+        while (ring_take(&r)) {
+            taken++;
+            if (out_fd >= 0 && dict_count >= RECORD_DICT_SIZE / 4 * 3) {
+                file_flush(buff, len);
+                len = 0;
+                if (out_fd >= 0)
+                    file_close();
+            }
+            if (out_fd < 0 && file_open(r.time_ms, buff, &len) < 0) {
+                if (!failing)
+                    log_printf(LOG_WARNING, "Failed to open a hand record file in %s: %s", record_dir, strerror(errno));
+                failing = 1;
+                STAT_ADD(record_dropped, 1);
+                continue;
+            }
+            failing = 0;
+            len = record_encode(&r, buff + len) - buff;
+            if (len > sizeof(buff) - 2 * RECORD_ENTRY_MAX || out_bytes + len >= rotate_bytes) {
+                file_flush(buff, len);
+                len = 0;
+            }
+        }
+        if (len > 0)
+            file_flush(buff, len);
+
+        dropped = recorder_dropped();
+        if (dropped != dropped_seen) {
+            log_printf(LOG_WARNING, "%llu hand records dropped: the ring was full",
+                       (unsigned long long)(dropped - dropped_seen));
+            STAT_ADD(record_dropped, dropped - dropped_seen);
+            dropped_seen = dropped;
+        }
+        if (ring_lost > 0) {
+            log_printf(LOG_WARNING, "%llu hand records lost: a process died writing them",
+                       (unsigned long long)ring_lost);
+            STAT_ADD(record_dropped, ring_lost);
+            ring_lost = 0;
+        }
+
+        spawn_reap(0);
+        if (taken > 0) {
+            STAT_ADD(hands_recorded, taken);
+        } else {
+            struct timespec pause = { 0, RECORD_FLUSH_MS * 1000000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+int recorder_start(void) {
+    pthread_t tid;
+
+    if (ring == NULL)
+        return 0;
+    if (pthread_create(&tid, NULL, recorder_run, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    return 0;
+}
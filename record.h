@@ -0,0 +1,125 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "engine.h"
+
+#define RECORD_STEPS 64             // steps a hand can hold; more than any hand takes
+#define RECORD_NAME_MAX 50
+#define RECORD_RING_SIZE 16384      // hands; a power of two
+#define RECORD_FLUSH_MS 10          // how long the writer sleeps on an empty ring
+#define RECORD_STALL_MS 1000        // how long a claimed hand may stay unwritten
+#define RECORD_DEFAULT_ROTATE 64    // MB per file
+
+// A hand as it is played: the shuffle it was dealt from and every step, as
+// one 4-bit code each. The first step is the up-card. The player's cards
+// follow, each drawn ace followed by the value it was counted as, unless
+// the player stood on it. Then RECORD_DEALER and the dealer's cards, an
+// ace that would bust the dealer as 1. A stand is not a step: the turn ends
+// wherever the dealer's begins.
+//
+// At a table every card comes from the table's shoe, the other seats'
+// between this one's, and the dealer plays once for everyone, even for a
+// seat that busted.
+enum {
+    RECORD_ACE_HIGH = 12,           // steps 1-11 are card values
+    RECORD_ACE_LOW,
+    RECORD_DEALER
+};
+
+// Flags of a hand.
+#define RECORD_TABLE 1              // played at a table
+#define RECORD_CONTIGUOUS 2         // every card came from the shoe in order, from `pos` on
+
+typedef struct {
+    uint64_t seed;                  // the shuffle the up-card came from (shoe.h)
+    uint16_t pos;                   // ... and its place in the shoe
+    uint16_t next;                  // where the next card is if contiguous
+    uint8_t  flags;
+    uint8_t  len;                   // steps
+    uint8_t  step[RECORD_STEPS / 2];
+} HandRecord;
+
+// A finished hand: what was played and how it ended.
+typedef struct {
+    uint64_t   time_ms;             // CLOCK_REALTIME
+    HandRecord hand;
+    Game       game;
+    char       name[RECORD_NAME_MAX];
+} RecordedHand;
+
+static inline int record_get(const HandRecord *h, int i) {
+    return h->step[i >> 1] >> ((i & 1) * 4) & 15;
+}
+
+static inline void record_step(HandRecord *h, int step) {
+    if (h->len < RECORD_STEPS) {
+        h->step[h->len >> 1] |= step << ((h->len & 1) * 4);
+        h->len++;
+    }
+}
+
+void record_deal(HandRecord *h, const Shoe *shoe, int up_card, int flags);
+void record_card(HandRecord *h, const Shoe *shoe, int card);
+int record_replay(const RecordedHand *r, Game *g);
+int record_audit(const RecordedHand *r, Shoe *shoe);
+
+// The stream. A file starts with a header (RECORD_MAGIC, the format's
+// version, the decks per shoe, and the time it was opened in ms), and holds
+// two kinds of entries:
+//
+//   player:  0x01, id (varint), name length (1 byte), name
+//   hand:    0x80 | flags, player id (varint), ms since the previous hand
+//            (zigzag varint), the seed (8 bytes) if RECORD_NEW_SEED, the
+//            up-card's place in the shoe and the number of steps (2 bytes:
+//            9 and 7 bits), the steps two to a byte, and the outcome (2
+//            bytes: result + 1, then the player's and the dealer's final
+//            scores in 5 bits each)
+//
+// Players are numbered from 0 in each file, in the order they first
+// appear. A seed is written when it differs from the last one written for
+// the same player, which is about once per shoe. A typical hand takes 11
+// bytes. Each file is complete by itself, so any one can be replayed.
+// Multi-byte fields are little-endian.
+#define RECORD_MAGIC "BJHR"
+#define RECORD_VERSION 1
+#define RECORD_HEADER_LEN 16
+#define RECORD_PLAYER 0x01
+#define RECORD_HAND 0x80
+#define RECORD_NEW_SEED 4           // hand entry flag
+#define RECORD_ENTRY_MAX (1 + 5 + 10 + 8 + 2 + RECORD_STEPS / 2 + 2)
+
+typedef struct {
+    char     name[RECORD_NAME_MAX];
+    uint64_t seed;                  // last written
+} RecordPlayer;
+
+// Reads a file held in memory.
+typedef struct {
+    const uint8_t *p, *end;
+    int            decks;
+    uint64_t       time_ms;         // of the last hand read
+    RecordPlayer  *players;
+    uint32_t       count, cap;
+} RecordReader;
+
+int record_open(RecordReader *r, const uint8_t *data, size_t len);
+int record_next(RecordReader *r, RecordedHand *out, uint32_t *player);
+void record_close(RecordReader *r);
+
+// Recording a server's hands. Finished hands go through a bounded
+// lock-free ring mapped shared before any fork, as log records do
+// (logger.h): the thread that played the hand only copies it in. A writer
+// thread in the parent encodes them into a buffer, writes it out in large
+// batches and starts a new file in `dir` every rotate_mb megabytes. With
+// `compress` set, each finished file is handed to that command (gzip, xz,
+// zstd ...), run in the background as `compress file`. A full ring drops
+// the hand and counts it rather than making the game wait, and a hand that
+// a process died copying in is skipped after RECORD_STALL_MS.
+int recorder_init(const char *dir, int rotate_mb, const char *compress, int decks);
+int recorder_start(void);
+void recorder_put(const char *name, const Game *g, const HandRecord *h);
+uint64_t recorder_dropped(void);
+
+#endif
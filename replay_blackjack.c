@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "record.h"
+
+#define AUDIT_SHOES 8192    // shuffles kept for -s, by seed; a power of two and
+                            // more than the shoes in play at once
+
+// Replays the server's hand record (record.h). Every hand is played again
+// through the engine with its recorded cards and choices, and has to end
+// exactly as recorded. With -s the cards are also checked against the
+// shuffles their seeds give. With -p one player's hands are printed, step
+// by step, as the answer to "what happened in that hand?".
+
+typedef struct {
+    uint64_t hands, players, mismatched, unaudited, audit_failed, broken;
+    uint64_t bytes;
+} ReplayStats;
+
+static int         audit;
+static const char *who;
+static Shoe       *shoes;
+static int         shoe_decks;
+
+// Runs `tool -dc -- path` with its output on a pipe; no shell sees the
+// path. Returns the read end, or NULL.
+static FILE *decompress(const char *tool, const char *path, pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    char *argv[] = { (char *)tool, "-dc", "--", (char *)path, NULL };
+    int   fds[2], rc;
+    FILE *in;
+
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return NULL;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    rc = posix_spawnp(pid, tool, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (rc != 0 || (in = fdopen(fds[0], "r")) == NULL) {
+        close(fds[0]);
+        if (rc == 0)
+            waitpid(*pid, NULL, 0);
+        errno = rc != 0 ? rc : errno;
+        return NULL;
+    }
+    return in;
+}
+
+// A file's bytes: mapped if it is a plain file, else read whole from a
+// decompressor (by suffix) or standard input ("-"). A decompressor that
+// fails, on a file cut short say, sets *damaged and leaves what it gave.
+static uint8_t *load(const char *path, size_t *len, int *mapped, int *damaged) {
+    static const char *const tools[][2] = { { ".gz", "gzip" }, { ".xz", "xz" }, { ".zst", "zstd" } };
+    size_t   plen = strlen(path), cap = 0;
+    uint8_t *data = NULL;
+    FILE    *in = NULL;
+    pid_t    pid = 0;
+    int      status;
+
+    for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++) {
+        size_t slen = strlen(tools[i][0]);
+        if (plen > slen && strcmp(path + plen - slen, tools[i][0]) == 0 &&
+            (in = decompress(tools[i][1], path, &pid)) == NULL)
+            return NULL;
+    }
+
+    if (in == NULL && strcmp(path, "-") == 0) {
+        in = stdin;
+    } else if (in == NULL) {
+        struct stat st;
+        int         fd = open(path, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+        *len = st.st_size;
+        data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (data == MAP_FAILED) {
+            errno = st.st_size > 0 ? errno : EINVAL;
+            return NULL;
+        }
+        *mapped = 1;
+        return data;
+    }
+    if (in == NULL)
+        return NULL;
+
+    *len = 0;
+    *mapped = 0;
+    while (1) {
+        if (*len == cap) {
+            uint8_t *grown = realloc(data, cap = cap ? 2 * cap : 1 << 20);
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+        }
+        size_t n = fread(data + *len, 1, cap - *len, in);
+        if (n == 0)
+            break;
+        *len += n;
+    }
+    if (pid > 0) {
+        fclose(in);
+        *damaged = waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    return data;
+}
+
+static const char *step_text(int step, char *buff) {
+    if (step == RECORD_ACE_HIGH)
+        return "=11";
+    if (step == RECORD_ACE_LOW)
+        return "=1";
+    if (step == CARD_ACE)
+        return "A";
+    snprintf(buff, 4, "%d", step);
+    return buff;
+}
+
+static void print_hand(const RecordedHand *r, const char *name, const char *verdict) {
+    const HandRecord *h = &r->hand;
+    time_t            sec = r->time_ms / 1000;
+    struct tm         tm;
+    char              stamp[32], buff[4];
+
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%03d %s%s seed %016llx card %d: up %d, player",
+           stamp, (int)(r->time_ms % 1000), name, h->flags & RECORD_TABLE ? " (table)" : "",
+           (unsigned long long)h->seed, h->pos, record_get(h, 0));
+    for (int i = 1; i < h->len; i++) {
+        int step = record_get(h, i);
+        if (step == RECORD_DEALER)
+            printf(", dealer");
+        else
+            printf("%s%s", step == RECORD_ACE_HIGH || step == RECORD_ACE_LOW ? "" : " ", step_text(step, buff));
+    }
+    printf(" -> %s %d against %d, %s\n", r->game.result > 0 ? "won" : r->game.result < 0 ? "lost" : "drew",
+           r->game.player_score, r->game.dealer_score, verdict);
+}
+
+static void replay(const char *path, const uint8_t *data, size_t len, ReplayStats *st) {
+    RecordReader reader;
+    RecordedHand r;
+    Game         g;
+    uint32_t     player;
+    int          rc;
+
+    if (record_open(&reader, data, len) < 0) {
+        fprintf(stderr, "%s: not a hand record\n", path);
+        st->broken++;
+        return;
+    }
+    // Shoes are set up as seeds first land on them (size 0 until then).
+    if (audit && reader.decks != shoe_decks) {
+        memset(shoes, 0, AUDIT_SHOES * sizeof(Shoe));
+        shoe_decks = reader.decks;
+    }
+
+    while ((rc = record_next(&reader, &r, &player)) > 0) {
+        int bad = record_replay(&r, &g) < 0, unsound = 0;
+
+        st->hands++;
+        st->mismatched += bad;
+        if (audit) {
+            Shoe *shoe = &shoes[(r.hand.seed * 0x9e3779b97f4a7c15ull) >> 51];
+
+            if (shoe->size == 0)
+                shoe_init(shoe, reader.decks, SHOE_DEFAULT_CUT);
+            unsound = record_audit(&r, shoe) < 0;
+            st->audit_failed += unsound;
+            st->unaudited += !(r.hand.flags & RECORD_CONTIGUOUS);
+        }
+        if (who != NULL && strcmp(reader.players[player].name, who) == 0)
+            print_hand(&r, who, bad ? "REPLAY DIFFERS" : unsound ? "CARDS DIFFER FROM THE SEED" : "replayed");
+        else if (bad || unsound)
+            print_hand(&r, reader.players[player].name, bad ? "REPLAY DIFFERS" : "CARDS DIFFER FROM THE SEED");
+    }
+    if (rc < 0) {
+        fprintf(stderr, "%s: cut short after %zu of %zu bytes\n", path, (size_t)(reader.p - data), len);
+        st->broken++;
+    }
+    st->players += reader.count;
+    st->bytes += len;
+    record_close(&reader);
+}
+
+static void usage(const char *pname) {
+    fprintf(stderr, "Usage: %s [-s] [-p player] file...   (\"-\" reads standard input; .gz, .xz and .zst are decompressed)\n", pname);
+}
+
+int main(int argc, char *argv[]) {
+    ReplayStats     st = {0};
+    struct timespec t0, t1;
+    double          busy = 0;
+    int             opt;
+
+    while ((opt = getopt(argc, argv, "sp:")) != -1) {
+        switch (opt) {
+        case 's': audit = 1; break;
+        case 'p': who = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (audit && (shoes = malloc(AUDIT_SHOES * sizeof(Shoe))) == NULL) {
+        fprintf(stderr, "malloc error : %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        size_t   len = 0;
+        int      mapped = 0, damaged = 0;
+        uint8_t *data = load(argv[i], &len, &mapped, &damaged);
+
+        uint64_t broken = st.broken;
+
+        if (damaged)
+            fprintf(stderr, "%s: not decompressed whole\n", argv[i]);
+        if (data == NULL) {
+            if (!damaged)
+                fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            st.broken++;
+            continue;
+        }
+        // Only the replay is timed, not reading the file.
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        replay(argv[i], data, len, &st);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        busy += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (damaged && st.broken == broken)
+            st.broken++;
+        if (mapped)
+            munmap(data, len);
+        else
+            free(data);
+    }
+
+    printf("%llu hands of %llu players in %d file(s), %.1f bytes per hand\n",
+           (unsigned long long)st.hands, (unsigned long long)st.players, argc - optind,
+           st.hands ? (double)st.bytes / st.hands : 0.0);
+    printf("replayed in %.3fs: %.0f hands/sec, %.0f MB/s\n", busy, busy > 0 ? st.hands / busy : 0.0,
+           busy > 0 ? st.bytes / busy / 1e6 : 0.0);
+    printf("%llu ended otherwise than recorded", (unsigned long long)st.mismatched);
+    if (audit)
+        printf(", %llu dealt otherwise than their seed gives (%llu checked by up-card only)",
+               (unsigned long long)st.audit_failed, (unsigned long long)st.unaudited);
+    printf(", %llu file(s) unreadable or cut short\n", (unsigned long long)st.broken);
+    return st.mismatched || st.audit_failed || st.broken ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "logger.h"
+#include "protocol.h"
+#include "rankings.h"
+#include "replica.h"
+
+#define REPLICA_BATCH 64
+
+typedef struct {
+    char     name[50];
+    int      first, n;
+    uint32_t counts[RANKING_MAX_NODES][3];
+} ReplicaEntry;
+
+static int replica_fd = -1;
+
+static uint64_t replica_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int replica_socket(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(REPLICA_PORT) };
+    struct ip_mreq     mreq;
+    unsigned char      ttl = 1, loop = 1;
+    int                sockfd, one = 1;
+
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    mreq.imr_multiaddr.s_addr = inet_addr(REPLICA_MULTICAST_IP);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static void replica_send(const uint8_t *buf, size_t len) {
+    struct sockaddr_in group = { .sin_family = AF_INET, .sin_port = htons(REPLICA_PORT) };
+
+    group.sin_addr.s_addr = inet_addr(REPLICA_MULTICAST_IP);
+    if (sendto(replica_fd, buf, len, 0, (struct sockaddr *)&group, sizeof(group)) < 0)
+        log_printf(LOG_WARNING, "replica sendto error : %s", strerror(errno));
+}
+
+// Packs the entries of one type into as few datagrams as they fit in.
+static void replica_flush(int type, const ReplicaEntry *e, int count) {
+    uint8_t buf[REPLICA_MAX_LEN];
+    size_t  len = 0;
+
+    for (int i = 0; i <= count; i++) {
+        size_t name_len = i < count ? strlen(e[i].name) : 0;
+        size_t size = i < count ? 3 + name_len + 12 * e[i].n : 0;
+
+        if (len > 0 && (i == count || len + size > sizeof(buf))) {
+            replica_send(buf, len);
+            len = 0;
+        }
+        if (i == count)
+            break;
+        if (len == 0) {
+            buf[0] = REPLICA_MAGIC;
+            buf[1] = PROTOCOL_VERSION;
+            buf[2] = type;
+            buf[3] = ranking_node;
+            buf[4] = ranking_nodes;
+            buf[5] = 0;
+            len = REPLICA_HEADER_LEN;
+        }
+
+        buf[5]++;
+        buf[len] = name_len;
+        memcpy(buf + len + 1, e[i].name, name_len);
+        len += 1 + name_len;
+        buf[len] = e[i].first;
+        buf[len + 1] = e[i].n;
+        len += 2;
+        for (int c = 0; c < e[i].n; c++)
+            for (int k = 0; k < 3; k++, len += 4)
+                put_u32(buf + len, e[i].counts[e[i].first + c][k]);
+    }
+}
+
+// Sends everything on the dirty list: this node's column of the players
+// it does not own to their owners, the whole vector of those it owns.
+static void replica_drain(void) {
+    static ReplicaEntry updates[REPLICA_BATCH], publishes[REPLICA_BATCH];
+    uint32_t            taken[REPLICA_BATCH], n;
+
+    do {
+        int nu = 0, np = 0;
+
+        ranking_lock();
+        n = ranking_take_dirty(taken, REPLICA_BATCH);
+        for (uint32_t i = 0; i < n; i++) {
+            const Player       *p = &ranking_players()[taken[i]];
+            const PlayerCounts *c = ranking_counts(taken[i]);
+            ReplicaEntry       *e;
+
+            if (ranking_owner(p->name) == ranking_node) {
+                e = &publishes[np++];
+                e->first = 0;
+                e->n = ranking_nodes;
+            } else {
+                const uint32_t *own = c->counts[ranking_node];
+                if (own[0] == 0 && own[1] == 0 && own[2] == 0)
+                    continue;
+                e = &updates[nu++];
+                e->first = ranking_node;
+                e->n = 1;
+            }
+            memcpy(e->name, p->name, sizeof(e->name));
+            memcpy(e->counts, c->counts, sizeof(e->counts));
+        }
+        ranking_unlock();
+
+        replica_flush(REPLICA_UPDATE, updates, nu);
+        replica_flush(REPLICA_PUBLISH, publishes, np);
+    } while (n == REPLICA_BATCH);
+}
+
+// Anti-entropy: queues the next slice of players for resending, or, after
+// the dirty list overflowed, as many as it holds until everyone has been.
+static void replica_sweep(void) {
+    static uint32_t next, hurry;    // next player to look at; players left to look at in a hurry
+
+    ranking_lock();
+    if (ranking->dirty_all) {
+        ranking->dirty_all = 0;
+        hurry = ranking->count;
+    }
+    uint32_t n = hurry > 0 ? RANKING_DIRTY_MAX / 2 : REPLICA_SWEEP_PLAYERS;
+    for (uint32_t i = 0; i < n && i < ranking->count && ranking->dirty_len < RANKING_DIRTY_MAX; i++)
+        ranking_mark(next++ % ranking->count);
+    hurry = hurry > n ? hurry - n : 0;
+    ranking_unlock();
+}
+
+static void replica_receive(const uint8_t *buf, size_t len) {
+    size_t off = REPLICA_HEADER_LEN;
+
+    if (len < REPLICA_HEADER_LEN || buf[0] != REPLICA_MAGIC || buf[1] != PROTOCOL_VERSION ||
+        buf[3] == ranking_node || buf[4] != ranking_nodes)
+        return;
+
+    ranking_lock();
+    for (int i = 0; i < buf[5]; i++) {
+        uint32_t counts[RANKING_MAX_NODES][3];
+        char     name[50];
+        size_t   name_len;
+        int      first, n;
+
+        if (off + 1 > len || (name_len = buf[off]) >= sizeof(name) || off + 3 + name_len > len)
+            break;
+        memcpy(name, buf + off + 1, name_len);
+        name[name_len] = '\0';
+        off += 1 + name_len;
+        first = buf[off];
+        n = buf[off + 1];
+        off += 2;
+        if (first + n > ranking_nodes || off + 12 * n > len)
+            break;
+        for (int c = 0; c < n; c++)
+            for (int k = 0; k < 3; k++, off += 4)
+                counts[c][k] = get_u32(buf + off);
+
+        if (buf[2] == REPLICA_UPDATE) {
+            if (ranking_owner(name) == ranking_node)
+                ranking_merge(name, first, n, counts);
+        } else if (buf[2] == REPLICA_PUBLISH && first == 0) {
+            ranking_merge(name, 0, n, counts);
+
+            // The owner is behind on this node's column: tell it again.
+            Player *p = ranking_find(name, 0);
+            if (p != NULL) {
+                const uint32_t *own = ranking_counts(p - ranking_players())->counts[ranking_node];
+                if (own[0] > counts[ranking_node][0] || own[1] > counts[ranking_node][1] ||
+                    own[2] > counts[ranking_node][2])
+                    ranking_mark(p - ranking_players());
+            }
+        }
+    }
+    ranking_unlock();
+}
+
+static void *replica_run(void *arg) {
+    uint8_t  buf[REPLICA_MAX_LEN];
+    uint64_t next_tick = 0, next_sweep = replica_ms() + REPLICA_SWEEP_MS;
+
+    (void)arg;
+    while (1) {
+        uint64_t now = replica_ms();
+
+        if (now >= next_sweep) {
+            replica_sweep();
+            next_sweep = now + REPLICA_SWEEP_MS;
+        }
+        if (now >= next_tick) {
+            replica_drain();
+            next_tick = now + REPLICA_TICK_MS;
+        }
+
+        struct pollfd pfd = { .fd = replica_fd, .events = POLLIN };
+        if (poll(&pfd, 1, next_tick - now) <= 0)
+            continue;
+        ssize_t n;
+        while ((n = recv(replica_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            replica_receive(buf, n);
+    }
+    return NULL;
+}
+
+// Joins the replication group and starts the thread that keeps this
+// node's copy of the ranking in step with the cluster.
+int replica_start(void) {
+    pthread_t tid;
+
+    if ((replica_fd = replica_socket()) < 0)
+        return -1;
+    if (pthread_create(&tid, NULL, replica_run, NULL) != 0) {
+        close(replica_fd);
+        return -1;
+    }
+    pthread_detach(tid);
+    log_printf(LOG_INFO, "Ranking node %d of %d, replicating on %s:%d", ranking_node, ranking_nodes,
+               REPLICA_MULTICAST_IP, REPLICA_PORT);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#define REPLICA_MULTICAST_IP "239.255.255.251"
+#define REPLICA_PORT 12953
+#define REPLICA_TICK_MS 50          // how often dirty players are sent
+#define REPLICA_SWEEP_MS 1000       // how often the anti-entropy sweep moves on
+#define REPLICA_SWEEP_PLAYERS 256   // players it looks at each time
+
+// Ranking replication between the nodes of a cluster (-n node/nodes), over
+// local multicast so several servers on one host can form one. A node sends
+// the columns it changed for players it does not own to their owner
+// (REPLICA_UPDATE), and the owner publishes each player's whole vector
+// after merging (REPLICA_PUBLISH). Datagrams can be lost: a sweep keeps
+// resending everyone's counts a few hundred players at a time, and since
+// merging is idempotent, nothing is hurt by hearing them twice.
+//
+// A datagram: REPLICA_MAGIC, the protocol version, its type, the sender's
+// node, the cluster's node count, the number of entries; then per entry
+// the name's length and bytes, the first column, the number of columns,
+// and wins, draws, losses as u32 (network order) for each.
+#define REPLICA_MAGIC 0xB9
+#define REPLICA_HEADER_LEN 6
+#define REPLICA_MAX_LEN 1400
+
+enum {
+    REPLICA_UPDATE = 1,
+    REPLICA_PUBLISH
+};
+
+int replica_start(void);
+
+#endif
@@ -0,0 +1,191 @@
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "resume.h"
+
+ResumeSlot *resume_table;               // NULL: resumption is off
+static uint64_t grace_ms;
+static int      sweep_next;             // the sweeper's position
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Slots are held for a few stores at most, by whichever process owns the
+// session, so a spin that yields is all the locking they need.
+static void slot_lock(ResumeSlot *r) {
+    while (__atomic_exchange_n(&r->lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static void slot_unlock(ResumeSlot *r) {
+    __atomic_store_n(&r->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Maps the table; call before forking. A grace of 0 turns resumption off.
+int resume_init(int grace_seconds) {
+    if (grace_seconds <= 0)
+        return 0;
+
+    ResumeSlot *t = mmap(NULL, RESUME_SLOTS * sizeof(ResumeSlot), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED)
+        return -1;
+    grace_ms = (uint64_t)grace_seconds * 1000;
+    resume_table = t;
+    return 0;
+}
+
+int resume_grace(void) {
+    return grace_ms / 1000;
+}
+
+// Claims a free slot for a player who just logged in. The token is the
+// slot's index under random bits. Returns 0 if resumption is off or every
+// slot is in use.
+uint64_t resume_issue(const char *name, int *slot, uint32_t *gen) {
+    static __thread Rng rng;
+    static __thread int seeded;
+    uint32_t            start;
+
+    if (resume_table == NULL)
+        return 0;
+    if (!seeded) {
+        rng_seed(&rng);
+        seeded = 1;
+    }
+
+    start = rng_next(&rng);
+    for (uint32_t i = 0; i < RESUME_SLOTS; i++) {
+        uint32_t    index = (start + i) & (RESUME_SLOTS - 1);
+        ResumeSlot *r = &resume_table[index];
+        uint64_t    token;
+
+        if (__atomic_load_n(&r->token, __ATOMIC_RELAXED) != 0)
+            continue;
+        slot_lock(r);
+        if (r->token != 0) {
+            slot_unlock(r);
+            continue;
+        }
+        do
+            token = (rng_next(&rng) & ~(uint64_t)(RESUME_SLOTS - 1)) | index;
+        while (token >> __builtin_ctz(RESUME_SLOTS) == 0);
+
+        r->token = token;
+        r->parked_until = 0;
+        memset(&r->game, 0, sizeof(r->game));
+        r->state = 0;
+        strncpy(r->name, name, sizeof(r->name) - 1);
+        r->name[sizeof(r->name) - 1] = '\0';
+        __atomic_store_n(&r->gen, r->gen + 1, __ATOMIC_RELEASE);
+        *gen = r->gen;
+        slot_unlock(r);
+        *slot = index;
+        return token;
+    }
+    return 0;
+}
+
+// Records where the session is. Returns -1 if it has been taken over.
+int resume_save(int slot, uint32_t gen, int state, const Game *g, const HandRecord *h) {
+    ResumeSlot *r = &resume_table[slot];
+    int         rc = -1;
+
+    slot_lock(r);
+    if (r->gen == gen) {
+        r->state = state;
+        r->game = *g;
+        r->hand = *h;
+        rc = 0;
+    }
+    slot_unlock(r);
+    return rc;
+}
+
+// The connection dropped: keep the slot for the grace period.
+int resume_park(int slot, uint32_t gen, int state, const Game *g, const HandRecord *h) {
+    ResumeSlot *r = &resume_table[slot];
+    int         rc = -1;
+
+    slot_lock(r);
+    if (r->gen == gen) {
+        r->state = state;
+        r->game = *g;
+        r->hand = *h;
+        r->parked_until = monotonic_ms() + grace_ms;
+        rc = 0;
+    }
+    slot_unlock(r);
+    return rc;
+}
+
+// The player left for good.
+void resume_drop(int slot, uint32_t gen) {
+    ResumeSlot *r = &resume_table[slot];
+
+    slot_lock(r);
+    if (r->gen == gen) {
+        r->token = 0;
+        r->parked_until = 0;
+    }
+    slot_unlock(r);
+}
+
+// Takes the slot named by a token for a new connection, parked or not,
+// and copies it out. Returns its index, or -1 for a token that is unknown,
+// freed or past its grace period.
+int resume_take(uint64_t token, ResumeSlot *copy, uint32_t *gen) {
+    ResumeSlot *r;
+    int         index = token & (RESUME_SLOTS - 1);
+
+    if (resume_table == NULL || token == 0)
+        return -1;
+
+    r = &resume_table[index];
+    slot_lock(r);
+    if (r->token != token || (r->parked_until != 0 && r->parked_until <= monotonic_ms())) {
+        slot_unlock(r);
+        return -1;
+    }
+    __atomic_store_n(&r->gen, r->gen + 1, __ATOMIC_RELEASE);
+    r->parked_until = 0;
+    *copy = *r;
+    *gen = r->gen;
+    slot_unlock(r);
+    return index;
+}
+
+// For the one sweeper: frees the next slot whose grace period is over and
+// copies it out, so a hand left in it can still be played out. Returns 0
+// once there is none.
+int resume_expire(ResumeSlot *copy) {
+    uint64_t now = monotonic_ms();
+
+    if (resume_table == NULL)
+        return 0;
+
+    for (int i = 0; i < RESUME_SLOTS; i++) {
+        ResumeSlot *r = &resume_table[sweep_next];
+        uint64_t    until = __atomic_load_n(&r->parked_until, __ATOMIC_RELAXED);
+
+        sweep_next = (sweep_next + 1) & (RESUME_SLOTS - 1);
+        if (until == 0 || until > now)
+            continue;
+
+        slot_lock(r);
+        if (r->parked_until != 0 && r->parked_until <= now) {
+            *copy = *r;
+            r->token = 0;
+            r->parked_until = 0;
+            __atomic_store_n(&r->gen, r->gen + 1, __ATOMIC_RELEASE);
+            slot_unlock(r);
+            return 1;
+        }
+        slot_unlock(r);
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdint.h>
+#include "record.h"
+
+#define RESUME_SLOTS 4096           // a power of two
+#define RESUME_DEFAULT_GRACE 30     // seconds a dropped session is kept
+
+// Session resumption. A binary session is given a token at login that
+// names a slot of this table, which is mapped shared before any fork so
+// the reconnect finds it whichever child or worker it lands on. The
+// session keeps the slot's copy of where it is current after every move.
+// When its connection drops the slot is parked for the grace period rather
+// than the hand being played out, and a HELLO carrying the token takes it
+// back with one round trip.
+//
+// A reconnect may arrive before the server has noticed the old connection
+// is gone. It takes the slot over anyway: the slot's generation moves on,
+// and the old session, finding itself stale, closes without touching it.
+typedef struct {
+    uint64_t token;             // 0: free
+    uint32_t lock;
+    uint32_t gen;
+    uint64_t parked_until;      // ms, CLOCK_MONOTONIC; 0 while a connection holds it
+    Game     game;
+    HandRecord hand;            // of the hand under way
+    uint8_t  state;             // the caller's: where to pick up
+    char     name[50];
+} ResumeSlot;
+
+extern ResumeSlot *resume_table;
+
+int resume_init(int grace_seconds);
+int resume_grace(void);
+uint64_t resume_issue(const char *name, int *slot, uint32_t *gen);
+int resume_save(int slot, uint32_t gen, int state, const Game *g, const HandRecord *h);
+int resume_park(int slot, uint32_t gen, int state, const Game *g, const HandRecord *h);
+void resume_drop(int slot, uint32_t gen);
+int resume_take(uint64_t token, ResumeSlot *copy, uint32_t *gen);
+int resume_expire(ResumeSlot *copy);
+
+// Whether another connection has taken the slot over since `gen`.
+static inline int resume_stale(int slot, uint32_t gen) {
+    return __atomic_load_n(&resume_table[slot].gen, __ATOMIC_ACQUIRE) != gen;
+}
+
+#endif
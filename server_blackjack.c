@@ -1,515 +1,3082 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <errno.h>
-#include <time.h>
-#include <syslog.h>
-#include <signal.h>
-#include <fcntl.h>
-#include <pthread.h>
-#include <ifaddrs.h>
-#include <net/if.h>
-
-#define PORT 12951
-#define MAX_PLAYERS 10
-#define MAXLINE 1024
-#define MAXFD 64
-#define IPV4_MULTICAST_IP "239.255.255.250"
-#define IPV6_MULTICAST_IP "ff02::1"
-#define MULTICAST_PORT 12951
-
-typedef struct {
-    char name[50];
-    int wins, draws, losses;
-} Player;
-
-Player players[MAX_PLAYERS];
-int player_count = 0;
-
-typedef enum {
-    IPV4,
-    IPV6
-} IP_VERSION;
-
-typedef struct {
-    IP_VERSION version;
-    char ip_address[INET6_ADDRSTRLEN];
-} ServerConfig;
-
-void get_local_ip(char *ip_buffer, size_t buffer_size, IP_VERSION version) {
-    struct ifaddrs *ifaddr, *ifa;
-    void *tmp_addr;
-    int family;
-
-    if (getifaddrs(&ifaddr) == -1) {
-        perror("getifaddrs");
-        exit(EXIT_FAILURE);
-    }
-
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL)
-            continue;
-
-        family = ifa->ifa_addr->sa_family;
-
-        if ((version == IPV4 && family == AF_INET) ||
-            (version == IPV6 && family == AF_INET6)) {
-            
-            if (strncmp(ifa->ifa_name, "lo", 2) == 0)
-                continue;
-
-            if (version == IPV4)
-                tmp_addr = &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
-            else
-                tmp_addr = &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
-
-            inet_ntop(family, tmp_addr, ip_buffer, buffer_size);
-            break;
-        }
-    }
-
-    freeifaddrs(ifaddr);
-}
-
-void *multicast_server_ip(void *arg) {
-    ServerConfig *config = (ServerConfig *)arg;
-    int multicast_sock;
-    char ip_buffer[INET6_ADDRSTRLEN];
-
-    if (config->version == IPV4) {
-        struct sockaddr_in multicast_addr;
-        
-        if ((multicast_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-            perror("multicast socket creation failed");
-            return NULL;
-        }
-
-        memset(&multicast_addr, 0, sizeof(multicast_addr));
-        multicast_addr.sin_family = AF_INET;
-        multicast_addr.sin_addr.s_addr = inet_addr(IPV4_MULTICAST_IP);
-        multicast_addr.sin_port = htons(MULTICAST_PORT);
-
-        // Set TTL for IPv4
-        unsigned char ttl = 1;
-        if (setsockopt(multicast_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
-            perror("setsockopt IP_MULTICAST_TTL failed");
-            close(multicast_sock);
-            return NULL;
-        }
-
-        while (1) {
-            get_local_ip(ip_buffer, sizeof(ip_buffer), IPV4);
-            printf("Sending IPv4: %s\n", ip_buffer);
-
-            if (sendto(multicast_sock, ip_buffer, strlen(ip_buffer)+1, 0,
-                      (struct sockaddr *)&multicast_addr, sizeof(multicast_addr)) < 0) {
-                perror("sendto failed");
-            }
-            sleep(5);
-        }
-    } else {  // IPv6
-        struct sockaddr_in6 multicast_addr;
-        
-        if ((multicast_sock = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
-            perror("multicast socket creation failed");
-            return NULL;
-        }
-
-        memset(&multicast_addr, 0, sizeof(multicast_addr));
-        multicast_addr.sin6_family = AF_INET6;
-        inet_pton(AF_INET6, IPV6_MULTICAST_IP, &multicast_addr.sin6_addr);
-        multicast_addr.sin6_port = htons(MULTICAST_PORT);
-
-        // Set hop limit for IPv6
-        int hops = 1;
-        if (setsockopt(multicast_sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)) < 0) {
-            perror("setsockopt IPV6_MULTICAST_HOPS failed");
-            close(multicast_sock);
-            return NULL;
-        }
-
-        while (1) {
-            get_local_ip(ip_buffer, sizeof(ip_buffer), IPV6);
-            printf("Sending IPv6: %s\n", ip_buffer);
-
-            if (sendto(multicast_sock, ip_buffer, strlen(ip_buffer)+1, 0,
-                      (struct sockaddr *)&multicast_addr, sizeof(multicast_addr)) < 0) {
-                perror("sendto failed");
-            }
-            sleep(5);
-        }
-    }
-
-    close(multicast_sock);
-    return NULL;
-}
-
-
-int draw_card() {
-    return rand() % 11 + 1;
-}
-
-void save_rankings(const char *filename) {
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        syslog(LOG_ERR, "Failed to open rankings file for writing: %s", strerror(errno));
-        return;
-    }
-
-    for (int i = 0; i < player_count; i++) {
-        fprintf(file, "%s %d %d %d\n", players[i].name, players[i].wins, players[i].draws, players[i].losses);
-    }
-
-    fclose(file);
-    syslog(LOG_INFO, "Rankings saved to file: %s", filename);
-}
-
-void load_rankings(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        if (errno != ENOENT) {
-            syslog(LOG_ERR, "Failed to open rankings file for reading: %s", strerror(errno));
-        }
-        return;
-    }
-
-    player_count = 0;
-    while (fscanf(file, "%49s %d %d %d", players[player_count].name, &players[player_count].wins, &players[player_count].draws, &players[player_count].losses) == 4) {
-        player_count++;
-        if (player_count >= MAX_PLAYERS) {
-            break;
-        }
-    }
-
-    fclose(file);
-    syslog(LOG_INFO, "Rankings loaded from file: %s", filename);
-}
-
-void update_player_stats(const char *name, int result) {
-    int found = 0;
-    for (int i = 0; i < player_count; i++) {
-        if (strcmp(players[i].name, name) == 0) {
-            if (result == 1) players[i].wins++;
-            else if (result == 0) players[i].draws++;
-            else if (result == -1) players[i].losses++;
-            found = 1;
-            break;
-        }
-    }
-
-    if (!found && player_count < MAX_PLAYERS) {
-        strncpy(players[player_count].name, name, sizeof(players[player_count].name) - 1);
-        players[player_count].wins = (result == 1);
-        players[player_count].draws = (result == 0);
-        players[player_count].losses = (result == -1);
-        player_count++;
-    }
-}
-
-void display_rankings(int connfd) {
-    char buff[MAXLINE];
-    snprintf(buff, sizeof(buff), "Current Rankings:\n");
-    send(connfd, buff, strlen(buff), 0);
-
-    for (int i = 0; i < player_count; i++) {
-        snprintf(buff, sizeof(buff), "%s - W: %d, D: %d, L: %d\n", players[i].name, players[i].wins, players[i].draws, players[i].losses);
-        send(connfd, buff, strlen(buff), 0);
-    }
-}
-
-void handle_game(int connfd, const char *player_name) {
-    char    buff[MAXLINE];
-    int     player_score = 0;
-    int     result = 0; // 1: win, 0: draw, -1: loss
-
-    srand(time(0));
-
-    int dealer_score = draw_card();
-    snprintf(buff, sizeof(buff), "The dealer's face-up card is: %d\n", dealer_score);
-    send(connfd, buff, strlen(buff), 0);
-
-    while (1) {
-        snprintf(buff, sizeof(buff), "Your current score: %d. Draw a card? (yes/no): \n", player_score);
-        if (send(connfd, buff, strlen(buff), 0) < 0) {
-            fprintf(stderr,"send error : %s\n", strerror(errno));
-            break;
-        }
-
-        memset(buff, 0, sizeof(buff));
-        if (recv(connfd, buff, sizeof(buff), 0) <= 0) {
-            fprintf(stderr,"recv error : %s\n", strerror(errno));
-            break;
-        }
-
-        if (strncmp(buff, "no", 2) == 0) {
-            snprintf(buff, sizeof(buff), "Final score: %d.\n", player_score);
-            send(connfd, buff, strlen(buff), 0);
-            break;
-        } else if (strncmp(buff, "yes", 3) == 0) {
-            int card = draw_card(); 
-
-            if(card == 1 || card == 11) {
-                snprintf(buff,sizeof(buff), "You drew a %d. Do you want it to be 1 or 11? (1/11): \n", card);
-                send(connfd,buff,sizeof(buff), 0);
-
-                memset(buff, 0, sizeof(buff));
-                if (recv(connfd, buff, sizeof(buff), 0) <= 0) {
-                    fprintf(stderr,"recv error : %s\n", strerror(errno));
-                    break;
-                }
-
-                int choice = atoi(buff);
-                if(choice == 1) {
-                    player_score += 1;
-                } else if (choice == 11) {
-                    player_score += 11;
-                } else {
-                    snprintf(buff,sizeof(buff), "Invalid choice. Defaulting to 1. \n");
-                    send(connfd, buff, strlen(buff), 0);
-                    player_score += 1;
-                }    
-            } else {
-                player_score += card;
-            }
-
-
-            if (player_score == 21) {
-                snprintf(buff, sizeof(buff), "You drew %d. Your total score is %d! BLACKJACK!\n", card, player_score);
-                result = 1;
-                send(connfd, buff, strlen(buff), 0);
-                break;
-            }
-            else if (player_score > 21) {
-                snprintf(buff, sizeof(buff), "You drew %d. Your total score is %d. BUST!\n", card, player_score);
-                result = -1;
-                send(connfd, buff, strlen(buff), 0);
-                break;
-
-            } else {
-                snprintf(buff, sizeof(buff), "You drew %d. Your total score is now %d.\n", card, player_score);
-                send(connfd, buff, strlen(buff), 0);
-            }
-        } else {
-            snprintf(buff, sizeof(buff), "Invalid input. Please type 'yes' or 'no'.\n");
-            send(connfd, buff, strlen(buff), 0);
-        }
-    }
-
-    if (player_score <= 21) {
-        while (dealer_score < 17) {
-            int card = draw_card();
-            dealer_score += card;
-            snprintf(buff, sizeof(buff), "The dealer drew a %d. Dealer's score: %d.\n", card, dealer_score);
-            send(connfd, buff, strlen(buff), 0);
-        }
-
-        if (dealer_score > 21) {
-            snprintf(buff, sizeof(buff), "Dealer BUST! You win with a score of %d!\n", player_score);
-            result = 1;
-            send(connfd, buff, strlen(buff), 0);
-        } else if (dealer_score > player_score) {
-            snprintf(buff, sizeof(buff), "Dealer wins with a score of %d against your %d.\n", dealer_score, player_score);
-            result = -1;
-            send(connfd, buff, strlen(buff), 0);
-        } else if (dealer_score < player_score) {
-            snprintf(buff, sizeof(buff), "You win with a score of %d against the dealer's %d.\n", player_score, dealer_score);
-            result = 1;
-            send(connfd, buff, strlen(buff), 0);
-        } else {
-            snprintf(buff, sizeof(buff), "It's a tie! Both you and the dealer have a score of %d.\n", player_score);
-            result = 0;
-            send(connfd, buff, strlen(buff), 0);
-        }
-    }
-
-    update_player_stats(player_name, result);
-    save_rankings("/var/log/blackjack");
-
-}
-
-void handle_client(int connfd) {
-    char buff[MAXLINE];
-    char player_name[50];
-
-    snprintf(buff, sizeof(buff), "Enter your name: ");
-    send(connfd, buff, strlen(buff), 0);
-
-    memset(player_name, 0, sizeof(player_name));
-    if (recv(connfd, player_name, sizeof(player_name), 0) <= 0) {
-        close(connfd);
-        return;
-    }
-
-    printf("Player connected: %s\n", player_name);
-
-    while (1) {
-        snprintf(buff, sizeof(buff),
-                 "Welcome, %s! Choose an option:\n"
-                 "1. Play Blackjack\n"
-                 "2. View Rankings\n"
-                 "3. Exit\n"
-                 "> ", player_name);
-        send(connfd, buff, strlen(buff), 0);
-
-        memset(buff, 0, sizeof(buff));
-        if (recv(connfd, buff, sizeof(buff), 0) <= 0) {
-            fprintf(stderr, "recv error : %s\n", strerror(errno));
-            break;
-        }
-
-        if (strncmp(buff, "1", 1) == 0) {
-            handle_game(connfd, player_name);
-        } else if (strncmp(buff, "2", 1) == 0) {
-            load_rankings("/var/log/blackjack");
-            display_rankings(connfd);
-        } else if (strncmp(buff, "3", 1) == 0) {
-            snprintf(buff, sizeof(buff), "Goodbye, %s!\n", player_name);
-            send(connfd, buff, strlen(buff), 0);
-            break;
-        } else {
-            snprintf(buff, sizeof(buff), "Invalid option. Please try again.\n");
-            send(connfd, buff, strlen(buff), 0);
-        }
-    }
-
-    save_rankings("/var/log/blackjack");
-    close(connfd);
-    printf("Player %s disconnected.\n", player_name);
-}
-
-int
-daemon_init(const char *pname, int facility, uid_t uid)
-{
-    int		i;
-    pid_t	pid;
-
-    if ( (pid = fork()) < 0)
-        return (-1);
-    else if (pid)
-        exit(0);			/* parent terminates */
-
-    /* child 1 continues... */
-
-    if (setsid() < 0)			/* become session leader */
-        return (-1);
-
-    signal(SIGHUP, SIG_IGN);
-    if ( (pid = fork()) < 0)
-        return (-1);
-    else if (pid)
-        exit(0);			/* child 1 terminates */
-
-    /* child 2 continues... */
-
-    chdir("/");				/* change working directory - or chroot()*/
-
-    /* close off file descriptors */
-    for (i = 0; i < MAXFD; i++){
-        close(i);
-    }
-
-    /* redirect stdin, stdout, and stderr to /dev/null */
-    open("/dev/null", O_RDONLY);
-    open("/dev/null", O_RDWR);
-    open("/dev/null", O_RDWR);
-
-    openlog(pname, LOG_PID, facility);
-    
-    setuid(uid); /* change user */
-    
-    return (0);				/* success */
-}
-
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf (stderr, "Usage: %s <ip version> \n", argv[0]);
-        return 1;
-    }
-
-    if (daemon_init("blackjackd", LOG_DAEMON, 1000) < 0) {
-        fprintf(stderr, "Failed to initialize daemon.\n");
-        return 1;
-    }
-
-    syslog(LOG_INFO, "Blackjack server started");
-
-    int listenfd, connfd;
-    struct sockaddr_in server_addr;
-    struct sockaddr_in6 server_addr6;
-    struct sockaddr_storage client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    pthread_t multicast_thread;
-    ServerConfig config;
-  
-    int choice = atoi(argv[1]);
-    config.version = (choice == 6) ? IPV6 : IPV4;
-
-    if (config.version == IPV4) {
-        if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-            fprintf(stderr, "socket error : %s\n", strerror(errno));
-            return 1;
-        }
-
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        server_addr.sin_port = htons(PORT);
-
-        if (bind(listenfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-            fprintf(stderr, "bind error : %s\n", strerror(errno));
-            return 1;
-        }
-    } else {
-        if ((listenfd = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
-            fprintf(stderr, "socket error : %s\n", strerror(errno));
-            return 1;
-        }
-
-        server_addr6.sin6_family = AF_INET6;
-        server_addr6.sin6_addr = in6addr_any;
-        server_addr6.sin6_port = htons(PORT);
-
-        if (bind(listenfd, (struct sockaddr *) &server_addr6, sizeof(server_addr6)) < 0) {
-            fprintf(stderr, "bind error : %s\n", strerror(errno));
-            return 1;
-        }
-    }
-
-    if (listen(listenfd, MAX_PLAYERS) < 0) {
-        fprintf(stderr, "listen error : %s\n", strerror(errno));
-        return 1;
-    }
-
-    if (pthread_create(&multicast_thread, NULL, multicast_server_ip, &config) != 0) {
-        fprintf(stderr, "Failed to create multicast thread\n");
-        return 1;
-    }
-
-    printf("Server listening on port %d using %s...\n", 
-           PORT, config.version == IPV4 ? "IPv4" : "IPv6");
-
-    signal(SIGPIPE, SIG_IGN);
-
-    while (1) {
-        connfd = accept(listenfd, (struct sockaddr *)&client_addr, &client_len);
-        if (connfd < 0) {
-            fprintf(stderr, "accept error : %s\n", strerror(errno));
-            continue;
-        }
-
-        if (fork() == 0) {
-            close(listenfd);
-            handle_client(connfd);
-            exit(0);
-        }
-        close(connfd);
-    }
-
-    close(listenfd);
-    return 0;
-}
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/filter.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "rankings.h"
+#include "replica.h"
+#include "logger.h"
+#include "discovery.h"
+#include "stats.h"
+#include "protocol.h"
+#include "shoe.h"
+#include "engine.h"
+#include "ev.h"
+#include "record.h"
+#include "resume.h"
+#include "timer.h"
+#include "uring.h"
+
+#define PORT 12951
+#define MAXLINE 1024
+#define MAXFD 64
+#define MAX_EVENTS 256
+#define VIEW_CHUNK (64 * 1024)
+#define TOP_DEFAULT 10
+#define TOP_MAX 1000
+#define OUT_SEGMENTS 32
+#define TABLE_MAX_SEATS 7
+#define TABLE_JOIN_MS 100       // how long the lobby waits to fill a table
+#define TABLE_DEFAULT_COUNT 64  // tables in play at once per worker
+#define LOBBY_DEFAULT_DEPTH 1024
+#define DECISION_TIMEOUT 30     // seconds a seated player has to act
+#define NAME_TIMEOUT 30         // seconds to answer each prompt; see prompt_timeout
+#define MENU_TIMEOUT 300
+#define HIT_TIMEOUT 60
+#define ACE_TIMEOUT 60
+#define TIMER_TICK_MS 10
+#define ACCEPT_PAUSE_MS 100     // accepting stops this long when out of descriptors,
+#define ACCEPT_PAUSE_MAX_MS 2000    // ... doubling while that lasts
+#define URING_ENTRIES 4096      // submissions per io_uring worker's ring
+#define URING_BUFFERS 4096      // provided receive buffers per ring, MAXLINE each
+#define SHARD_QUEUE_SIZE 256    // results in flight from one core to another; a power of two
+#define LEGACY_RANKINGS_FILE "/var/log/blackjack"
+#define DATA_DIR "/var/lib/blackjack"
+#define BEACON_INTERVAL_MS 5000
+#define BEACON_ANSWER_MS 100    // least time between beacons sent for queries
+
+typedef enum {
+    IPV4,
+    IPV6,
+    IP_DUAL         // one IPv6 socket that takes IPv4 connections too
+} IP_VERSION;
+
+typedef struct {
+    IP_VERSION version;
+    char ip_address[INET6_ADDRSTRLEN];
+} ServerConfig;
+
+typedef enum {
+    MODE_FORK,
+    MODE_EPOLL,
+    MODE_CORE,      // epoll workers pinned one per core, ranking sharded between them
+    MODE_URING      // workers driving their sessions through io_uring
+} SERVER_MODE;
+
+// Where a connected player is in the name -> menu -> hit/stand -> ace dialogue.
+// The session waits for exactly one client message in each of these states.
+typedef enum {
+    STATE_NAME,
+    STATE_MENU,
+    STATE_HIT,
+    STATE_ACE,
+    STATE_VIEW,     // streaming the ranking; the menu follows it
+    STATE_LOBBY,    // waiting for a seat at a table
+    STATE_SEATED,   // at a table, waiting for the others to finish
+    STATE_CLOSED
+} SessionState;
+
+// What a timer on a worker's wheel times.
+enum {
+    TIMER_PROMPT,   // a session's open prompt
+    TIMER_TABLE,    // a table's decision window
+    TIMER_ACCEPT    // the end of a worker's pause in accepting
+};
+
+// A session's output for the current turn: pieces of arena text and
+// constant strings, written out together with one writev() when the
+// session next waits for input.
+typedef struct {
+    const char *text;       // constant text, or NULL for arena bytes
+    size_t      off;        // into the arena when text is NULL
+    size_t      len;
+} OutSegment;
+
+typedef struct Table Table;
+typedef struct Worker Worker;
+typedef struct Session Session;
+
+struct Session {
+    int             fd;
+    SessionState    state;
+    char            player_name[50];
+    Game            game;
+    HandRecord      hand;           // the hand under way, for the hand record
+    uint32_t        view_next;      // ranking rows still to be sent
+    uint32_t        view_end;
+    uint32_t        events;         // epoll interest currently registered
+    OutSegment      seg[OUT_SEGMENTS];
+    int             seg_first, seg_count;
+    size_t          out_len;        // queued bytes not yet sent
+    char           *arena;          // formatted text the segments point into
+    size_t          arena_len;
+    size_t          arena_cap;
+    int             binary;         // speaking frames (protocol.h) instead of text
+    uint8_t         in[FRAME_HEADER_LEN + FRAME_MAX_PAYLOAD];
+    size_t          in_len;         // bytes of a frame still incomplete
+    int             held;           // whole frames in `in` that arrived while waiting
+    Shoe            shoe;
+    Worker         *worker;         // epoll mode: the loop that owns the session
+    Table          *table;          // seated at, or NULL
+    int             seat;
+    uint64_t        queued_at;      // ms, when it joined the lobby
+    Session        *lobby_prev, *lobby_next;
+    int             resume_slot;    // resume.h, or -1 without a token
+    uint32_t        resume_gen;
+    int             superseded;     // a reconnect took the session over
+    uint64_t        deadline;       // ms: to answer the open prompt, 0 for none
+    Timer           timer;          // epoll mode: the deadline on the worker's wheel
+    // io_uring mode: the send in flight reads iov and the arena as they
+    // were when it was queued, so an arena that grows meanwhile is copied
+    // rather than reallocated, and the old one freed when the send is done.
+    int             uring_ops;      // operations in flight on the session, and the ready list
+    int             sending;
+    int             closing;        // cancelled; freed once uring_ops is 0
+    int             ready;
+    Session        *ready_next;
+    char           *arena_busy;
+    struct msghdr   msg;
+    struct iovec    iov[OUT_SEGMENTS];
+    uint64_t        answer_start;   // stats_clock() of the input the send in flight answers
+    int             answer_kind;
+};
+
+// A seat keeps the hand of a player who left mid-round, so it is still
+// settled and recorded when the dealer plays.
+typedef struct {
+    Session        *session;        // NULL if empty or the player left
+    Game            game;
+    HandRecord      hand;
+    char            name[50];
+    int             taken;
+    int             deciding;
+} Seat;
+
+// Up to seats_per_table players against one dealer hand and one shoe. The
+// lobby seats a table all at once and the round starts right away; it ends
+// when every seat has stood, busted or run out of time. Tables belong to
+// one epoll worker, so nothing here is locked.
+struct Table {
+    Shoe            shoe;
+    Seat            seats[TABLE_MAX_SEATS];
+    int             taken;          // seats 0..taken-1 are in the round
+    int             deciding;       // seats yet to finish their turn
+    int             up_card;
+    uint64_t        started;        // ms
+    Timer           timer;          // end of the decision window
+    Worker         *worker;
+    Table          *prev, *next;    // the worker's active tables
+};
+
+// One epoll loop. Its lobby is a FIFO of players waiting for a seat, and
+// at most tables_per_worker of its tables play at once.
+struct Worker {
+    int             listenfd;
+    int             epfd;
+    Session        *lobby_head, *lobby_tail;
+    int             lobby_len;
+    int             tables;         // in play
+    uint64_t        round_ms;       // moving average of a round's length
+    Table          *active;
+    Table          *spare;
+    int             index;          // core mode: the shard this worker applies
+    int             cpu;
+    int             wakefd;         // eventfd other cores ring after queueing to it
+    int             asleep;         // in epoll_wait, or about to be
+    TimerWheel      wheel;          // prompt deadlines and decision windows, in TIMER_TICK_MS ticks
+    Timer           accept_timer;   // armed while accepting is paused
+    int             accept_pause;   // ms of the current pause, 0 when accepting
+    Uring          *ring;           // io_uring mode, or NULL for epoll
+    Session        *ready;          // io_uring mode: sessions with held frames to run
+};
+
+// Core mode shards the ranking updates by player: each player's results
+// are applied by one core, in batches, so its rows stay in that core's
+// cache and the store's lock is taken once per batch rather than once per
+// hand. A result reaches its core through a single-producer single-consumer
+// ring per pair of cores; head and tail sit on lines of their own, each
+// side keeping a copy of the other's index so it rarely reads it.
+typedef struct {
+    _Alignas(64) uint32_t head;     // the consumer's
+    uint32_t        tail_seen;
+    _Alignas(64) uint32_t tail;     // the producer's
+    uint32_t        head_seen;
+    _Alignas(64) RankingUpdate slots[SHARD_QUEUE_SIZE];
+} ShardQueue;
+
+int server_port = PORT;
+int unbuffered = 0;     // send every message on its own, for comparison
+int shoe_decks = SHOE_DEFAULT_DECKS;
+int shoe_cut = SHOE_DEFAULT_CUT;
+int seats_per_table = 1;        // 1: every player gets a private dealer
+int decision_timeout = DECISION_TIMEOUT;
+// Seconds a player has to answer each prompt, by LatencyKind; 0: no limit.
+// An idle or half-open connection is closed, and a hand stands.
+int prompt_timeout[LAT_ACE + 1] = { NAME_TIMEOUT, MENU_TIMEOUT, HIT_TIMEOUT, ACE_TIMEOUT };
+int tables_per_worker = TABLE_DEFAULT_COUNT;
+int lobby_depth = LOBBY_DEFAULT_DEPTH;         // players waiting per worker
+int max_sessions = 0;                          // 0: no limit
+int listen_backlog = SOMAXCONN;
+const char *stats_socket_path;
+Worker *shards;                 // core mode: the workers, by shard; NULL otherwise
+int shard_count;
+ShardQueue *shard_queues;       // [producer * shard_count + consumer]
+static __thread Worker *this_worker;
+
+uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The addresses beacons announce, cached: a netlink socket subscribed to
+// address changes says when to walk the interfaces again, instead of the
+// walk being repeated for every beacon.
+static int beacon_addresses(Beacon *b, IP_VERSION version) {
+    struct ifaddrs *ifaddr, *ifa;
+
+    if (getifaddrs(&ifaddr) == -1)
+        return -1;
+
+    b->count = 0;
+    for (ifa = ifaddr; ifa != NULL && b->count < BEACON_MAX_ADDRS; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || (ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_UP))
+            continue;
+
+        BeaconAddr *a = &b->addrs[b->count];
+        if (version != IPV6 && ifa->ifa_addr->sa_family == AF_INET) {
+            a->family = 4;
+            memcpy(a->addr, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr, 4);
+            b->count++;
+        } else if (version != IPV4 && ifa->ifa_addr->sa_family == AF_INET6) {
+            a->family = 6;
+            memcpy(a->addr, &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr, 16);
+            b->count++;
+        }
+    }
+
+    freeifaddrs(ifaddr);
+    return 0;
+}
+
+static int netlink_open(void) {
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR };
+    int                fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void beacon_send(int sockfd, int family, Beacon *b) {
+    uint8_t       buf[BEACON_MAX_LEN];
+    ServerStats   now;
+    struct rlimit rl;
+    char          text[96];
+
+    stats_total(stats, &now);
+    b->sessions = now.sessions;
+    // Without -c the practical limit is the descriptors we may open.
+    if (max_sessions > 0)
+        b->capacity = max_sessions;
+    else
+        b->capacity = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < UINT32_MAX ? rl.rlim_cur : UINT32_MAX;
+
+    if (discovery_send(sockfd, family, buf, beacon_put(buf, BEACON_ANNOUNCE, b)) < 0) {
+        log_printf(LOG_WARNING, "Beacon not sent: %s", strerror(errno));
+        return;
+    }
+    snprintf(text, sizeof(text), "%d address(es) on the IPv%d group, port %d, %u/%u sessions",
+             b->count, family, b->port, b->sessions, b->capacity);
+    log_event(LOG_DEBUG, LOG_EVENT_BEACON, text);
+}
+
+// Announces the server every BEACON_INTERVAL_MS, give or take a random
+// fifth so that servers started together do not beacon in lockstep, and at
+// once (at most every BEACON_ANSWER_MS) when a client's query arrives. A
+// dual-stack server sends the same beacon, with the addresses of both
+// families, to both groups.
+void *multicast_server_ip(void *arg) {
+    ServerConfig *config = (ServerConfig *)arg;
+    int           socks[2], families[2], nsocks = 0, nlfd;
+    Beacon        b;
+    Rng           rng;
+    uint64_t      next, answered[2] = { 0, 0 };
+
+    for (int family = 6; family >= 4; family -= 2) {
+        if ((family == 6 && config->version == IPV4) || (family == 4 && config->version == IPV6))
+            continue;
+        if ((socks[nsocks] = discovery_socket(family)) < 0) {
+            // Another program holds the port without sharing it: still announce.
+            log_printf(LOG_WARNING, "Discovery port busy, IPv%d queries will go unanswered: %s", family, strerror(errno));
+            if ((socks[nsocks] = socket(family == 6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0)) < 0) {
+                log_printf(LOG_ERR, "multicast socket error : %s", strerror(errno));
+                continue;
+            }
+        }
+        families[nsocks++] = family;
+    }
+    if (nsocks == 0)
+        return NULL;
+    if ((nlfd = netlink_open()) < 0)
+        log_printf(LOG_WARNING, "No netlink address notifications, addresses will not be refreshed: %s", strerror(errno));
+
+    memset(&b, 0, sizeof(b));
+    rng_seed(&rng);
+    b.version = PROTOCOL_VERSION;
+    b.port = server_port;
+    b.instance = rng_below(&rng, UINT32_MAX);
+    beacon_addresses(&b, config->version);
+    for (int i = 0; i < nsocks; i++)
+        beacon_send(socks[i], families[i], &b);
+    next = now_ms() + BEACON_INTERVAL_MS * 4 / 5 + rng_below(&rng, BEACON_INTERVAL_MS * 2 / 5);
+
+    while (1) {
+        struct pollfd pfd[3] = { { .fd = nlfd, .events = POLLIN },
+                                 { .fd = socks[0], .events = POLLIN },
+                                 { .fd = nsocks > 1 ? socks[1] : -1, .events = POLLIN } };
+        uint64_t      now = now_ms();
+
+        if (now >= next) {
+            for (int i = 0; i < nsocks; i++)
+                beacon_send(socks[i], families[i], &b);
+            next = now + BEACON_INTERVAL_MS * 4 / 5 + rng_below(&rng, BEACON_INTERVAL_MS * 2 / 5);
+            continue;
+        }
+        if (poll(pfd, 3, next - now) <= 0)
+            continue;
+
+        if (pfd[0].revents & POLLIN) {
+            char msg[4096];
+            while (recv(nlfd, msg, sizeof(msg), 0) > 0)
+                ;
+            beacon_addresses(&b, config->version);
+        }
+        for (int i = 0; i < nsocks; i++) {
+            uint8_t buf[BEACON_MAX_LEN];
+            Beacon  q;
+            ssize_t n;
+
+            if (!(pfd[1 + i].revents & POLLIN))
+                continue;
+            n = recv(socks[i], buf, sizeof(buf), 0);
+            if (n > 0 && beacon_get(buf, n, &q) == BEACON_QUERY && now_ms() >= answered[i] + BEACON_ANSWER_MS) {
+                beacon_send(socks[i], families[i], &b);
+                answered[i] = now_ms();
+            }
+        }
+    }
+    return NULL;
+}
+
+
+int session_flush(Session *s);
+
+static char *arena_reserve(Session *s, size_t len) {
+    if (s->arena_len + len > s->arena_cap) {
+        size_t cap = s->arena_cap ? s->arena_cap : MAXLINE;
+        while (cap < s->arena_len + len)
+            cap *= 2;
+        char *arena;
+        if (s->arena != NULL && s->arena == s->arena_busy) {
+            if ((arena = malloc(cap)) == NULL)
+                return NULL;
+            memcpy(arena, s->arena, s->arena_len);
+        } else if ((arena = realloc(s->arena, cap)) == NULL) {
+            return NULL;
+        }
+        s->arena = arena;
+        s->arena_cap = cap;
+    }
+    return s->arena + s->arena_len;
+}
+
+// Appends len bytes that are already in the arena at arena_len.
+static void arena_commit(Session *s, size_t len) {
+    OutSegment *last = s->seg_count > 0 ? &s->seg[s->seg_first + s->seg_count - 1] : NULL;
+
+    if (last != NULL && last->text == NULL && last->off + last->len == s->arena_len) {
+        last->len += len;
+    } else {
+        last = &s->seg[s->seg_first + s->seg_count++];
+        last->text = NULL;
+        last->off = s->arena_len;
+        last->len = len;
+    }
+    s->arena_len += len;
+    s->out_len += len;
+}
+
+// Makes room for one more segment, packing the queue to the front of the
+// array or, if it is full, flattening it into the arena.
+static int segment_room(Session *s) {
+    if (s->seg_first + s->seg_count < OUT_SEGMENTS)
+        return 0;
+    if (s->seg_first > 0) {
+        memmove(s->seg, s->seg + s->seg_first, s->seg_count * sizeof(OutSegment));
+        s->seg_first = 0;
+        return 0;
+    }
+
+    char *flat = malloc(s->out_len > 0 ? s->out_len : 1);
+    size_t len = 0;
+    if (flat == NULL)
+        return -1;
+    for (int i = 0; i < s->seg_count; i++) {
+        OutSegment *g = &s->seg[i];
+        memcpy(flat + len, g->text ? g->text + g->off : s->arena + g->off, g->len);
+        len += g->len;
+    }
+    if (s->arena != s->arena_busy)
+        free(s->arena);
+    s->arena = flat;
+    s->arena_len = s->arena_cap = len;
+    s->seg[0] = (OutSegment){ .text = NULL, .off = 0, .len = len };
+    s->seg_count = 1;
+    return 0;
+}
+
+// Drops arena bytes that have already been sent once they are the bulk of
+// it, so a slow reader of a long ranking does not grow the arena forever.
+static void arena_compact(Session *s) {
+    size_t dead = s->arena_len;
+
+    for (int i = 0; i < s->seg_count; i++) {
+        OutSegment *g = &s->seg[s->seg_first + i];
+        if (g->text == NULL && g->off < dead)
+            dead = g->off;
+    }
+    if (dead < s->arena_cap / 2)
+        return;
+
+    memmove(s->arena, s->arena + dead, s->arena_len - dead);
+    s->arena_len -= dead;
+    for (int i = 0; i < s->seg_count; i++) {
+        OutSegment *g = &s->seg[s->seg_first + i];
+        if (g->text == NULL)
+            g->off -= dead;
+    }
+}
+
+int session_write(Session *s, const char *data, size_t len) {
+    char *dst;
+
+    if (segment_room(s) < 0 || (dst = arena_reserve(s, len)) == NULL)
+        return -1;
+    memcpy(dst, data, len);
+    arena_commit(s, len);
+    STAT_ADD(messages, 1);
+
+    return unbuffered ? session_flush(s) : 0;
+}
+
+// Queues a string literal by reference: it is never copied.
+int session_write_static(Session *s, const char *text) {
+    if (segment_room(s) < 0)
+        return -1;
+
+    OutSegment *g = &s->seg[s->seg_first + s->seg_count++];
+    g->text = text;
+    g->off = 0;
+    g->len = strlen(text);
+    s->out_len += g->len;
+    STAT_ADD(messages, 1);
+
+    return unbuffered ? session_flush(s) : 0;
+}
+
+int session_printf(Session *s, const char *fmt, ...) {
+    char    *dst;
+    va_list  ap;
+    int      len;
+
+    if (segment_room(s) < 0 || (dst = arena_reserve(s, MAXLINE)) == NULL)
+        return -1;
+
+    va_start(ap, fmt);
+    len = vsnprintf(dst, MAXLINE, fmt, ap);
+    va_end(ap);
+    if (len >= MAXLINE)
+        len = MAXLINE - 1;
+
+    arena_commit(s, len);
+    STAT_ADD(messages, 1);
+
+    return unbuffered ? session_flush(s) : 0;
+}
+
+// Queues one binary frame.
+int session_frame(Session *s, int type, const void *payload, size_t len) {
+    char *dst;
+
+    if (segment_room(s) < 0 || (dst = arena_reserve(s, FRAME_HEADER_LEN + len)) == NULL)
+        return -1;
+    arena_commit(s, frame_put((uint8_t *)dst, type, payload, len));
+    STAT_ADD(messages, 1);
+
+    return unbuffered ? session_flush(s) : 0;
+}
+
+// A fixed message for the player, as text or as a MSG_TEXT frame.
+int session_notice(Session *s, const char *text) {
+    if (s->binary)
+        return session_frame(s, MSG_TEXT, text, strlen(text));
+    return session_write_static(s, text);
+}
+
+// Drops what a send took from the front of the queue.
+static void session_sent(Session *s, size_t sent) {
+    STAT_ADD(send_bytes, sent);
+    s->out_len -= sent;
+    while (sent > 0) {
+        OutSegment *g = &s->seg[s->seg_first];
+        if (sent < g->len) {
+            g->off += sent;
+            g->len -= sent;
+            break;
+        }
+        sent -= g->len;
+        s->seg_first++;
+        s->seg_count--;
+    }
+    if (s->out_len == 0) {
+        s->seg_first = s->seg_count = 0;
+        s->arena_len = 0;
+    }
+}
+
+int uring_flush(Session *s);
+
+// Sends everything queued for the turn in as few writev() calls as the
+// socket allows. Returns -1 on a hard error; on a non-blocking socket that
+// is full the rest stays queued for EPOLLOUT. An io_uring worker's session
+// only queues the send, for the worker's next submission.
+int session_flush(Session *s) {
+    struct iovec iov[OUT_SEGMENTS];
+
+    if (s->worker != NULL && s->worker->ring != NULL)
+        return uring_flush(s);
+
+    while (s->out_len > 0) {
+        int n = s->seg_count;
+        for (int i = 0; i < n; i++) {
+            OutSegment *g = &s->seg[s->seg_first + i];
+            iov[i].iov_base = (char *)(g->text ? g->text + g->off : s->arena + g->off);
+            iov[i].iov_len = g->len;
+        }
+
+        ssize_t sent = writev(s->fd, iov, n);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (s->worker == NULL)
+                    return -1;      // fork mode: the send timed out
+                arena_compact(s);
+                return 0;
+            }
+            return -1;
+        }
+        STAT_ADD(send_calls, 1);
+        session_sent(s, sent);
+    }
+    return 0;
+}
+
+void menu_prompt(Session *s);
+
+void ranking_row(Session *s, uint32_t rank, const Player *p) {
+    if (s->binary) {
+        char *dst;
+        if (segment_room(s) < 0 || (dst = arena_reserve(s, FRAME_HEADER_LEN + RANKING_ROW_FIXED + sizeof(p->name))) == NULL)
+            return;
+        arena_commit(s, frame_ranking_row((uint8_t *)dst, rank, p->name, p->wins, p->draws, p->losses));
+        STAT_ADD(messages, 1);
+    } else {
+        session_printf(s, "%u. %s - W: %d, D: %d, L: %d\n", rank, p->name, p->wins, p->draws, p->losses);
+    }
+}
+
+// Closes a ranking listing in binary mode; text listings need no marker.
+void ranking_end(Session *s, uint32_t count) {
+    uint8_t payload[4];
+
+    if (s->binary) {
+        put_u32(payload, count);
+        session_frame(s, MSG_RANKING_END, payload, sizeof(payload));
+    }
+}
+
+// Walks the mapped ranking records without taking the ranking lock. Rows
+// are formatted a buffer at a time and only while the socket keeps up, so a
+// ranking of millions of names never sits in memory all at once; epoll mode
+// resumes the walk from epoll_worker once the queued output has drained.
+static void view_stream(Session *s) {
+    uint32_t count;
+    Player  *players = ranking_view(&count);
+
+    while (s->view_next < s->view_end && s->out_len < VIEW_CHUNK) {
+        char  *dst;
+        size_t len = 0;
+
+        if (segment_room(s) < 0 || (dst = arena_reserve(s, VIEW_CHUNK)) == NULL) {
+            s->view_next = s->view_end;
+            break;
+        }
+        while (s->view_next < s->view_end && len < VIEW_CHUNK - MAXLINE) {
+            Player *p = &players[s->view_next++];
+            if (s->binary)
+                len += frame_ranking_row((uint8_t *)dst + len, 0, p->name, p->wins, p->draws, p->losses);
+            else
+                len += snprintf(dst + len, VIEW_CHUNK - len, "%s - W: %d, D: %d, L: %d\n",
+                                p->name, p->wins, p->draws, p->losses);
+        }
+        arena_commit(s, len);
+
+        if (session_flush(s) < 0) {
+            s->view_next = s->view_end;
+            break;
+        }
+    }
+
+    if (s->view_next == s->view_end && s->state == STATE_VIEW) {
+        ranking_end(s, s->view_end);
+        menu_prompt(s);
+    }
+}
+
+static int session_waiting(const Session *s);
+int session_input(Session *s, const char *buff, size_t len);
+
+// Streams more of a listing the socket was too backed up to take at once.
+// Frames that arrived behind the menu choice waited for the listing; once
+// it is done they are run as at the menu.
+void display_more(Session *s) {
+    view_stream(s);
+    if (s->held && !session_waiting(s))
+        session_input(s, NULL, 0);
+}
+
+void display_rankings(Session *s) {
+    if (!s->binary)
+        session_write_static(s, "Current Rankings:\n");
+
+    ranking_view(&s->view_end);
+    s->view_next = 0;
+    s->state = STATE_VIEW;
+    view_stream(s);
+}
+
+void display_top(Session *s, uint32_t k) {
+    Player  *top = malloc(k * sizeof(Player));
+    uint32_t n, count, rank = 0;
+
+    if (top == NULL)
+        return;
+
+    ranking_lock();
+    n = ranking_top(k, top);
+    count = ranking->count;
+    ranking_unlock();
+
+    if (!s->binary)
+        session_printf(s, "Top %u Players:\n", n);
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 0 || top[i].wins != top[i - 1].wins)
+            rank = i + 1;
+        ranking_row(s, rank, &top[i]);
+    }
+    ranking_end(s, count);
+    free(top);
+}
+
+void display_rank(Session *s) {
+    Player   p;
+    uint32_t rank, count;
+
+    ranking_lock();
+    rank = ranking_rank(s->player_name, &p);
+    count = ranking->count;
+    ranking_unlock();
+
+    if (s->binary) {
+        if (rank != 0)
+            ranking_row(s, rank, &p);
+        ranking_end(s, count);
+    } else if (rank == 0) {
+        session_write_static(s, "You have no recorded games yet.\n");
+    } else {
+        session_printf(s, "Your rank: %u of %u (W: %d, D: %d, L: %d)\n", rank, count, p.wins, p.draws, p.losses);
+    }
+}
+
+// Which prompt an input answers, for the response-time histograms; -1 for
+// input that answers none.
+static int prompt_kind(SessionState state) {
+    switch (state) {
+    case STATE_NAME: return LAT_NAME;
+    case STATE_MENU: return LAT_MENU;
+    case STATE_HIT:  return LAT_HIT;
+    case STATE_ACE:  return LAT_ACE;
+    default:         return -1;
+    }
+}
+
+static uint64_t ms_ticks(uint64_t ms) {
+    return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+}
+
+// Starts the clock on the prompt the session now waits at, or stops it in
+// the states that answer none: the lobby, and a table, whose decision
+// window times all its seats at once. The rankings are streamed on the
+// menu's clock, so a client too slow to take them runs out of it too.
+// Epoll sessions are timed on their worker's wheel; a forked child waits
+// for the deadline in poll().
+void prompt_deadline(Session *s) {
+    int kind = s->table == NULL ? prompt_kind(s->state) : -1;
+    int seconds = kind >= 0 ? prompt_timeout[kind] : 0;
+
+    s->deadline = seconds > 0 ? now_ms() + seconds * 1000ull : 0;
+    if (s->worker == NULL)
+        return;
+    if (s->deadline == 0) {
+        timer_cancel(&s->worker->wheel, &s->timer);
+    } else {
+        timer_arm(&s->worker->wheel, &s->timer, ms_ticks(s->deadline));
+        STAT_ADD(timers_armed, 1);
+    }
+}
+
+void menu_prompt(Session *s) {
+    s->state = STATE_MENU;
+    prompt_deadline(s);
+    if (s->binary) {
+        session_frame(s, MSG_MENU, s->player_name, strlen(s->player_name));
+        return;
+    }
+
+    session_printf(s, "Welcome, %s! Choose an option:\n", s->player_name);
+    session_write_static(s,
+                         "1. Play Blackjack\n"
+                         "2. View Rankings\n"
+                         "3. Exit\n"
+                         "4. Top Players\n"
+                         "5. My Rank\n"
+                         "> ");
+}
+
+void game_prompt(Session *s) {
+    s->state = STATE_HIT;
+    prompt_deadline(s);
+    if (s->binary) {
+        uint8_t score = s->game.player_score;
+        session_frame(s, MSG_PROMPT_HIT, &score, 1);
+        return;
+    }
+    session_printf(s, "Your current score: %d. Draw a card? (yes/no): \n", s->game.player_score);
+}
+
+void ace_prompt(Session *s) {
+    s->state = STATE_ACE;
+    prompt_deadline(s);
+    if (s->binary) {
+        uint8_t card = s->game.card;
+        session_frame(s, MSG_PROMPT_ACE, &card, 1);
+        return;
+    }
+    session_printf(s, "You drew a %d. Do you want it to be 1 or 11? (1/11): \n", s->game.card);
+}
+
+void send_token(Session *s, uint64_t token) {
+    uint8_t payload[10];
+
+    put_u64(payload, token);
+    put_u16(payload + 8, resume_grace());
+    session_frame(s, MSG_RESUME, payload, sizeof(payload));
+}
+
+void send_deal(Session *s, int who, int card, int score) {
+    uint8_t payload[3] = { who, card, score };
+    session_frame(s, MSG_DEAL, payload, sizeof(payload));
+}
+
+void game_upcard(Session *s) {
+    if (s->binary)
+        send_deal(s, DEAL_DEALER_UP, s->game.up_card, s->game.dealer_score);
+    else
+        session_printf(s, "The dealer's face-up card is: %d\n", s->game.up_card);
+}
+
+void game_start(Session *s) {
+    game_deal(&s->game, &s->shoe);
+    record_deal(&s->hand, &s->shoe, s->game.up_card, 0);
+    game_upcard(s);
+    game_prompt(s);
+}
+
+void game_result(Session *s) {
+    Game *g = &s->game;
+
+    if (s->binary) {
+        uint8_t payload[3] = { (uint8_t)g->result, g->player_score, g->dealer_score };
+        session_frame(s, MSG_RESULT, payload, sizeof(payload));
+        return;
+    }
+
+    if (game_busted(g->player_score)) {
+        return;     // the BUST! line already said it
+    } else if (game_busted(g->dealer_score)) {
+        session_printf(s, "Dealer BUST! You win with a score of %d!\n", g->player_score);
+    } else if (g->result < 0) {
+        session_printf(s, "Dealer wins with a score of %d against your %d.\n", g->dealer_score, g->player_score);
+    } else if (g->result > 0) {
+        session_printf(s, "You win with a score of %d against the dealer's %d.\n", g->player_score, g->dealer_score);
+    } else {
+        session_printf(s, "It's a tie! Both you and the dealer have a score of %d.\n", g->player_score);
+    }
+}
+
+// Queues a result for the core whose shard the player is in, and wakes
+// that core if it is waiting for events. Returns 0 if the queue is full.
+static int shard_push(const char *name, int result) {
+    Worker     *to = &shards[ranking_hash(name) % shard_count];
+    ShardQueue *q = &shard_queues[this_worker->index * shard_count + to->index];
+    uint32_t    tail = q->tail;
+
+    if (tail - q->head_seen == SHARD_QUEUE_SIZE) {
+        q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail - q->head_seen == SHARD_QUEUE_SIZE) {
+            STAT_ADD(shard_spills, 1);
+            return 0;
+        }
+    }
+
+    RankingUpdate *u = &q->slots[tail & (SHARD_QUEUE_SIZE - 1)];
+    strncpy(u->name, name, sizeof(u->name) - 1);
+    u->name[sizeof(u->name) - 1] = '\0';
+    u->result = result;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (to != this_worker) {
+        STAT_ADD(shard_handoffs, 1);
+        // Pairs with the fence in epoll_worker: either it sees the new
+        // tail before sleeping, or we see it asleep.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&to->asleep, __ATOMIC_RELAXED) && __atomic_exchange_n(&to->asleep, 0, __ATOMIC_ACQUIRE))
+            eventfd_write(to->wakefd, 1);
+    }
+    return 1;
+}
+
+// Whether any core has queued results for w since it last looked.
+static int shard_pending(Worker *w) {
+    for (int p = 0; p < shard_count; p++) {
+        ShardQueue *q = &shard_queues[p * shard_count + w->index];
+        if (q->head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+            return 1;
+    }
+    return 0;
+}
+
+// Applies the results queued for w's shard, up to RANKING_BATCH_MAX per
+// acquisition of the ranking lock.
+static void shard_drain(Worker *w) {
+    static __thread RankingUpdate batch[RANKING_BATCH_MAX];
+    int                           n;
+
+    do {
+        n = 0;
+        for (int p = 0; p < shard_count && n < RANKING_BATCH_MAX; p++) {
+            ShardQueue *q = &shard_queues[p * shard_count + w->index];
+            uint32_t    head = q->head;
+
+            if (head == q->tail_seen && head == (q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)))
+                continue;
+            while (head != q->tail_seen && n < RANKING_BATCH_MAX)
+                batch[n++] = q->slots[head++ & (SHARD_QUEUE_SIZE - 1)];
+            __atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+        }
+        if (n > 0) {
+            ranking_lock();
+            ranking_record(batch, n);
+            ranking_unlock();
+            STAT_ADD(shard_batches, 1);
+        }
+    } while (n == RANKING_BATCH_MAX);
+}
+
+void game_record(const char *name, const Game *g, const HandRecord *h) {
+    int      result = g->result;
+    uint64_t start = stats_clock();
+
+    // In core mode the time recorded is the hand-off to the player's shard;
+    // threads other than the workers record directly.
+    if (this_worker == NULL || !shard_push(name, result)) {
+        ranking_lock();
+        update_player_stats(name, result);
+        ranking_unlock();
+    }
+    stat_latency(LAT_PERSIST, stats_clock() - start);
+    recorder_put(name, g, h);
+
+    STAT_ADD(hands, 1);
+    if (result > 0)
+        STAT_ADD(wins, 1);
+    else if (result < 0)
+        STAT_ADD(losses, 1);
+    else
+        STAT_ADD(draws, 1);
+}
+
+// The dealer's turn and the ranking update. Also runs when the player drops
+// in the middle of a hand, so the hand is still recorded.
+void game_finish(Session *s) {
+    Game *g = &s->game;
+    int   card;
+
+    game_stand(g);
+    record_step(&s->hand, RECORD_DEALER);
+    while ((card = game_dealer_draw(g, &s->shoe)) != 0) {
+        record_card(&s->hand, &s->shoe, card);
+        STAT_ADD(dealer_cards, 1);
+        if (s->binary)
+            send_deal(s, DEAL_DEALER, card, g->dealer_score);
+        else
+            session_printf(s, "The dealer drew a %d. Dealer's score: %d.\n", card, g->dealer_score);
+    }
+    STAT_ADD(rounds, 1);
+    game_result(s);
+    game_record(s->player_name, g, &s->hand);
+}
+
+void seat_done(Session *s);
+
+// Reports a card the player drew and counted.
+void game_card(Session *s) {
+    Game *g = &s->game;
+
+    if (s->binary) {
+        send_deal(s, DEAL_PLAYER, g->card, g->player_score);
+    } else if (g->player_score == GAME_TARGET) {
+        session_printf(s, "You drew %d. Your total score is %d! BLACKJACK!\n", g->card, g->player_score);
+    } else if (game_busted(g->player_score)) {
+        session_printf(s, "You drew %d. Your total score is %d. BUST!\n", g->card, g->player_score);
+    } else {
+        session_printf(s, "You drew %d. Your total score is now %d.\n", g->card, g->player_score);
+    }
+
+    if (g->phase == GAME_PLAYER) {
+        game_prompt(s);
+    } else if (s->table != NULL) {
+        seat_done(s);
+    } else {
+        game_finish(s);
+        menu_prompt(s);
+    }
+}
+
+void session_update(Session *s);
+
+// Sends what a table queued for a seat other than the one whose event is
+// being handled. A failed send is left for that session's own next event.
+void seat_flush(Session *s) {
+    if (session_flush(s) == 0)
+        session_update(s);
+}
+
+Table *table_open(Worker *w) {
+    Table *t;
+
+    if ((t = w->spare) != NULL) {
+        w->spare = t->next;
+    } else if ((t = calloc(1, sizeof(Table))) != NULL) {
+        shoe_init(&t->shoe, shoe_decks, shoe_cut);
+        t->worker = w;
+        t->timer.kind = TIMER_TABLE;
+    } else {
+        return NULL;
+    }
+
+    t->prev = NULL;
+    t->next = w->active;
+    if (w->active != NULL)
+        w->active->prev = t;
+    w->active = t;
+    w->tables++;
+    return t;
+}
+
+void table_release(Table *t) {
+    Worker *w = t->worker;
+
+    if (t->prev != NULL)
+        t->prev->next = t->next;
+    else
+        w->active = t->next;
+    if (t->next != NULL)
+        t->next->prev = t->prev;
+
+    timer_cancel(&w->wheel, &t->timer);
+    t->taken = t->deciding = 0;
+    t->prev = NULL;
+    t->next = w->spare;
+    w->spare = t;
+    w->tables--;
+}
+
+void round_start(Table *t) {
+    shoe_hand_start(&t->shoe);
+    t->up_card = shoe_draw(&t->shoe);
+    t->deciding = 0;
+    t->started = now_ms();
+
+    for (int i = 0; i < t->taken; i++) {
+        Seat *seat = &t->seats[i];
+
+        game_join(&seat->session->game, t->up_card);
+        record_deal(&seat->session->hand, &t->shoe, t->up_card, RECORD_TABLE);
+        seat->deciding = 1;
+        t->deciding++;
+        game_upcard(seat->session);
+        game_prompt(seat->session);
+        seat_flush(seat->session);
+    }
+    timer_arm(&t->worker->wheel, &t->timer, ms_ticks(t->started + decision_timeout * 1000ull));
+    STAT_ADD(timers_armed, 1);
+}
+
+// Where a seat's hand is recorded: with its player, or with the seat once
+// the player has left.
+static HandRecord *seat_hand(Seat *seat) {
+    return seat->session != NULL ? &seat->session->hand : &seat->hand;
+}
+
+// The dealer plays once for the whole table, and only if someone is still
+// in. Its draws are encoded once per protocol and the same bytes go to every
+// seat, followed by that seat's own result and menu, in one send per seat.
+void round_finish(Table *t) {
+    Worker  *w = t->worker;
+    Game     dealer;
+    char     text[2 * MAXLINE];
+    uint8_t  frames[2 * MAXLINE];
+    size_t   text_len = 0, frames_len = 0;
+    int      card, live = 0;
+    uint64_t took = now_ms() - t->started;
+
+    for (int i = 0; i < t->taken; i++) {
+        Seat *seat = &t->seats[i];
+        Game *g = seat->session != NULL ? &seat->session->game : &seat->game;
+        if (!game_busted(g->player_score))
+            live = 1;
+        record_step(seat_hand(seat), RECORD_DEALER);
+    }
+
+    game_join(&dealer, t->up_card);
+    game_stand(&dealer);
+    while (live && (card = game_dealer_draw(&dealer, &t->shoe)) != 0) {
+        uint8_t payload[3] = { DEAL_DEALER, card, dealer.dealer_score };
+        text_len += snprintf(text + text_len, sizeof(text) - text_len,
+                             "The dealer drew a %d. Dealer's score: %d.\n", card, dealer.dealer_score);
+        frames_len += frame_put(frames + frames_len, MSG_DEAL, payload, sizeof(payload));
+        for (int i = 0; i < t->taken; i++)
+            record_card(seat_hand(&t->seats[i]), &t->shoe, card);
+        STAT_ADD(dealer_cards, 1);
+    }
+    STAT_ADD(rounds, 1);
+
+    for (int i = 0; i < t->taken; i++) {
+        Seat    *seat = &t->seats[i];
+        Session *s = seat->session;
+
+        if (s == NULL) {
+            game_settle_dealer(&seat->game, dealer.dealer_score);
+            game_record(seat->name, &seat->game, &seat->hand);
+        } else {
+            game_settle_dealer(&s->game, dealer.dealer_score);
+            if (s->binary && frames_len > 0)
+                session_write(s, (const char *)frames, frames_len);
+            else if (!s->binary && text_len > 0)
+                session_write(s, text, text_len);
+            game_result(s);
+            game_record(s->player_name, &s->game, &s->hand);
+            s->table = NULL;
+            menu_prompt(s);
+            seat_flush(s);
+        }
+        memset(seat, 0, sizeof(*seat));
+    }
+
+    // What the lobby's wait estimates are based on.
+    w->round_ms = w->round_ms == 0 ? took : (w->round_ms * 7 + took) / 8;
+    table_release(t);
+}
+
+// The player's turn is over: stood, busted, reached 21 or timed out.
+void seat_done(Session *s) {
+    Table *t = s->table;
+    Seat  *seat = &t->seats[s->seat];
+
+    s->state = STATE_SEATED;
+    if (seat->deciding) {
+        seat->deciding = 0;
+        t->deciding--;
+    }
+
+    if (t->deciding == 0)
+        round_finish(t);
+    else
+        session_notice(s, "Waiting for the other players...\n");
+}
+
+// A seated player disconnected: their hand stands and is settled with
+// everyone else's.
+void table_leave(Session *s) {
+    Table *t = s->table;
+    Seat  *seat = &t->seats[s->seat];
+
+    s->table = NULL;
+    seat->game = s->game;
+    seat->hand = s->hand;
+    memcpy(seat->name, s->player_name, sizeof(seat->name));
+    seat->session = NULL;
+    if (seat->deciding) {
+        game_stand(&seat->game);
+        seat->deciding = 0;
+        if (--t->deciding == 0)
+            round_finish(t);
+    }
+}
+
+void lobby_remove(Session *s) {
+    Worker *w = s->worker;
+
+    if (s->lobby_prev != NULL)
+        s->lobby_prev->lobby_next = s->lobby_next;
+    else
+        w->lobby_head = s->lobby_next;
+    if (s->lobby_next != NULL)
+        s->lobby_next->lobby_prev = s->lobby_prev;
+    else
+        w->lobby_tail = s->lobby_prev;
+    s->lobby_prev = s->lobby_next = NULL;
+    w->lobby_len--;
+}
+
+// Seats waiting players, oldest first, while the worker has a free table.
+// A table only starts short-handed once its oldest player has waited out
+// the join window.
+void lobby_schedule(Worker *w) {
+    uint64_t now = now_ms();
+    Table   *t;
+
+    while (w->lobby_len > 0 && w->tables < tables_per_worker) {
+        if (w->lobby_len < seats_per_table && now < w->lobby_head->queued_at + TABLE_JOIN_MS)
+            break;
+        if ((t = table_open(w)) == NULL)
+            break;
+
+        while (t->taken < seats_per_table && w->lobby_head != NULL) {
+            Session *s = w->lobby_head;
+            Seat    *seat = &t->seats[t->taken];
+
+            lobby_remove(s);
+            STAT_ADD(lobby_wait_ms, now - s->queued_at);
+            seat->taken = 1;
+            seat->session = s;
+            s->table = t;
+            s->seat = t->taken++;
+            s->state = STATE_SEATED;
+        }
+        round_start(t);
+    }
+}
+
+// Roughly how long the player at this 1-based place in the lobby waits:
+// every full wave of tables ahead of them takes about one round.
+uint32_t lobby_estimate(Worker *w, int place) {
+    uint32_t round_ms = w->round_ms != 0 ? w->round_ms : DECISION_TIMEOUT * 1000 / 10;
+    int      waves = (place - 1) / (seats_per_table * tables_per_worker);
+
+    if (waves == 0 && w->tables < tables_per_worker)
+        return TABLE_JOIN_MS;
+    return (waves + 1) * round_ms;
+}
+
+void lobby_join(Session *s) {
+    Worker  *w = s->worker;
+    uint32_t wait_ms;
+
+    // Backpressure: past the queue limit the player is turned away at once
+    // rather than left waiting for a seat that is minutes off.
+    if (w->lobby_len >= lobby_depth) {
+        STAT_ADD(lobby_full, 1);
+        session_notice(s, "The lobby is full. Please try again later.\n");
+        menu_prompt(s);
+        return;
+    }
+
+    s->queued_at = now_ms();
+    s->state = STATE_LOBBY;
+    prompt_deadline(s);
+    s->lobby_prev = w->lobby_tail;
+    s->lobby_next = NULL;
+    if (w->lobby_tail != NULL)
+        w->lobby_tail->lobby_next = s;
+    else
+        w->lobby_head = s;
+    w->lobby_tail = s;
+    w->lobby_len++;
+    STAT_ADD(lobby_joins, 1);
+
+    wait_ms = lobby_estimate(w, w->lobby_len);
+    lobby_schedule(w);
+    if (s->state != STATE_LOBBY)
+        return;
+
+    if (s->binary) {
+        uint8_t payload[6];
+        put_u16(payload, w->lobby_len);
+        put_u32(payload + 2, wait_ms);
+        session_frame(s, MSG_QUEUE, payload, sizeof(payload));
+    } else {
+        session_printf(s, "You are number %d in the lobby. Estimated wait: %.1f s.\n",
+                       w->lobby_len, wait_ms / 1000.0);
+    }
+}
+
+// A table's decision window ended: whoever has not answered stands.
+void table_expire(Table *t) {
+    for (int i = 0; i < t->taken; i++) {
+        Seat *seat = &t->seats[i];
+        if (!seat->deciding)
+            continue;
+        if (seat->session->state == STATE_ACE)
+            STAT_ADD(timeouts_ace, 1);
+        else
+            STAT_ADD(timeouts_hit, 1);
+        session_notice(seat->session, "Time is up: you stand.\n");
+        game_stand(&seat->session->game);
+        seat->session->state = STATE_SEATED;
+        seat->deciding = 0;
+    }
+    t->deciding = 0;
+    round_finish(t);
+}
+
+void session_expired(Session *s);
+void accept_resume(Worker *w);
+
+// Runs what is due on the worker's wheel, prompts nobody answered and
+// decision windows that ended, and then the lobby. Returns the
+// milliseconds until something may be due next, or -1 if nothing is
+// waiting.
+int timers_run(Worker *w) {
+    uint64_t now = now_ms(), next, join;
+    Timer   *timer;
+
+    while ((timer = wheel_expire(&w->wheel, now / TIMER_TICK_MS)) != NULL) {
+        STAT_ADD(timers_fired, 1);
+        if (timer->kind == TIMER_TABLE)
+            table_expire((Table *)((char *)timer - offsetof(Table, timer)));
+        else if (timer->kind == TIMER_ACCEPT)
+            accept_resume(w);
+        else
+            session_expired((Session *)((char *)timer - offsetof(Session, timer)));
+    }
+
+    lobby_schedule(w);
+
+    next = wheel_next(&w->wheel);
+    next = next == UINT64_MAX ? 0 : next * TIMER_TICK_MS;
+    if (w->lobby_len > 0 && w->tables < tables_per_worker) {
+        join = w->lobby_head->queued_at + TABLE_JOIN_MS;
+        if (next == 0 || join < next)
+            next = join;
+    }
+    if (next == 0)
+        return -1;
+    return next > now ? (int)(next - now) : 0;
+}
+
+// The moves of the dialogue, whichever encoding they arrived in.
+
+void player_name(Session *s, const char *name, size_t len) {
+    if (len > sizeof(s->player_name) - 1)
+        len = sizeof(s->player_name) - 1;
+    memcpy(s->player_name, name, len);
+    s->player_name[len] = '\0';
+
+    log_event(LOG_INFO, LOG_EVENT_CONNECT, s->player_name);
+    if (s->binary) {
+        uint64_t token = resume_issue(s->player_name, &s->resume_slot, &s->resume_gen);
+        if (token != 0)
+            send_token(s, token);
+    }
+    menu_prompt(s);
+}
+
+// A HELLO with a resume token: the player's name and, if one was under
+// way, the hand come back, and the prompt that was open is sent again.
+int player_resume(Session *s, uint64_t token) {
+    ResumeSlot r;
+    int        slot = resume_take(token, &r, &s->resume_gen);
+
+    if (slot < 0) {
+        STAT_ADD(resume_misses, 1);
+        session_notice(s, "Your session could not be resumed. Please log in again.\n");
+        return -1;
+    }
+    s->resume_slot = slot;
+    memcpy(s->player_name, r.name, sizeof(s->player_name));
+    s->game = r.game;
+    s->hand = r.hand;
+    STAT_ADD(resumes, 1);
+    log_printf(LOG_INFO, "Player %s resumed", s->player_name);
+
+    send_token(s, token);
+    if (r.state == STATE_HIT) {
+        game_upcard(s);
+        game_prompt(s);
+    } else if (r.state == STATE_ACE) {
+        game_upcard(s);
+        ace_prompt(s);
+    } else {
+        menu_prompt(s);
+    }
+    return 0;
+}
+
+void player_choose(Session *s, int option, int arg) {
+    switch (option) {
+    case 1:
+        if (seats_per_table > 1 && s->worker != NULL)
+            lobby_join(s);
+        else
+            game_start(s);
+        break;
+    case 2:
+        display_rankings(s);
+        break;
+    case 3:
+        if (s->binary) {
+            char text[MAXLINE];
+            int  len = snprintf(text, sizeof(text), "Goodbye, %s!\n", s->player_name);
+            session_frame(s, MSG_TEXT, text, len);
+        } else {
+            session_printf(s, "Goodbye, %s!\n", s->player_name);
+        }
+        s->state = STATE_CLOSED;
+        if (s->resume_slot >= 0)
+            resume_drop(s->resume_slot, s->resume_gen);
+        break;
+    case 4:     // arg: how many of the top players
+        display_top(s, arg > 0 && arg <= TOP_MAX ? arg : TOP_DEFAULT);
+        menu_prompt(s);
+        break;
+    case 5:
+        display_rank(s);
+        menu_prompt(s);
+        break;
+    default:
+        session_notice(s, "Invalid option. Please try again.\n");
+        menu_prompt(s);
+        break;
+    }
+}
+
+// draw: 1 to hit, 0 to stand, -1 for anything else.
+void player_hit(Session *s, int draw) {
+    if (draw == 0) {
+        if (!s->binary)
+            session_printf(s, "Final score: %d.\n", s->game.player_score);
+        if (s->table != NULL) {
+            game_stand(&s->game);
+            seat_done(s);
+        } else {
+            game_finish(s);
+            menu_prompt(s);
+        }
+    } else if (draw == 1) {
+        Shoe *shoe = s->table != NULL ? &s->table->shoe : &s->shoe;
+
+        game_hit(&s->game, shoe);
+        record_card(&s->hand, shoe, s->game.card);
+
+        if (s->game.phase == GAME_ACE) {
+            ace_prompt(s);
+        } else {
+            game_card(s);
+        }
+    } else {
+        session_notice(s, "Invalid input. Please type 'yes' or 'no' ('?' for a hint).\n");
+        game_prompt(s);
+    }
+}
+
+// What the table says about the decision in front of the player: one
+// lookup, and the prompt again.
+void player_hint(Session *s) {
+    const EvHint *h = ev_hint(s->game.player_score, s->game.up_card);
+
+    STAT_ADD(hints, 1);
+    if (s->binary) {
+        uint8_t payload[8];
+        put_u16(payload, h->stand);
+        put_u16(payload + 2, h->hit);
+        put_u16(payload + 4, h->ace_low);
+        put_u16(payload + 6, h->ace_high);
+        session_frame(s, MSG_HINT, payload, sizeof(payload));
+        return;
+    }
+
+    if (s->state == STATE_ACE) {
+        session_printf(s, "Hint: counting it as 1 is worth %+.3f, as 11 %+.3f a bet. Count it as %d.\n",
+                       (double)h->ace_low / EV_UNIT, (double)h->ace_high / EV_UNIT,
+                       h->ace_high > h->ace_low ? 11 : 1);
+        ace_prompt(s);
+    } else {
+        session_printf(s, "Hint: standing is worth %+.3f, drawing %+.3f a bet. %s.\n",
+                       (double)h->stand / EV_UNIT, (double)h->hit / EV_UNIT,
+                       h->hit > h->stand ? "Draw a card" : "Stand");
+        game_prompt(s);
+    }
+}
+
+void player_ace(Session *s, int choice) {
+    if (choice != 1 && choice != 11)
+        session_notice(s, "Invalid choice. Defaulting to 1. \n");
+    game_choose_ace(&s->game, choice);
+    record_step(&s->hand, choice == CARD_ACE ? RECORD_ACE_HIGH : RECORD_ACE_LOW);
+    game_card(s);
+}
+
+// Text mode: one recv() is one message, as typed by a person or sent by the
+// original client.
+void session_text(Session *s, const char *buff, size_t len) {
+    switch (s->state) {
+    case STATE_NAME:
+        player_name(s, buff, len);
+        break;
+
+    case STATE_MENU:
+        // "4 25" asks for the top 25.
+        player_choose(s, buff[0] >= '1' && buff[0] <= '5' ? buff[0] - '0' : 0,
+                      buff[0] == '4' ? atoi(buff + 1) : 0);
+        break;
+
+    case STATE_HIT:
+        if (buff[0] == '?' || strncmp(buff, "hint", 4) == 0)
+            player_hint(s);
+        else
+            player_hit(s, strncmp(buff, "no", 2) == 0 ? 0 : strncmp(buff, "yes", 3) == 0 ? 1 : -1);
+        break;
+
+    case STATE_ACE:
+        if (buff[0] == '?' || strncmp(buff, "hint", 4) == 0)
+            player_hint(s);
+        else
+            player_ace(s, atoi(buff));
+        break;
+
+    case STATE_VIEW:
+    case STATE_LOBBY:
+    case STATE_SEATED:
+    case STATE_CLOSED:
+        break;
+    }
+}
+
+// Binary mode: one complete frame. Returns -1 for a frame the session
+// cannot be in, which ends it.
+int session_message(Session *s, int type, const uint8_t *payload, size_t len) {
+    switch (s->state) {
+    case STATE_NAME:
+        if (type == MSG_HELLO && len >= 1) {
+            uint8_t version = PROTOCOL_VERSION;
+            session_frame(s, MSG_HELLO, &version, 1);
+            if (len < 9 || player_resume(s, get_u64(payload + 1)) < 0)
+                session_frame(s, MSG_PROMPT_NAME, NULL, 0);
+            return 0;
+        }
+        if (type == MSG_NAME && len > 0) {
+            player_name(s, (const char *)payload, len);
+            return 0;
+        }
+        break;
+
+    case STATE_MENU:
+        if (type == MSG_CHOOSE && len >= 3) {
+            player_choose(s, payload[0], get_u16(payload + 1));
+            return 0;
+        }
+        break;
+
+    case STATE_HIT:
+        if (type == MSG_HIT && len >= 1) {
+            player_hit(s, payload[0] != 0);
+            return 0;
+        }
+        if (type == MSG_HINT) {
+            player_hint(s);
+            return 0;
+        }
+        break;
+
+    case STATE_ACE:
+        if (type == MSG_ACE && len >= 1) {
+            player_ace(s, payload[0]);
+            return 0;
+        }
+        if (type == MSG_HINT) {
+            player_hint(s);
+            return 0;
+        }
+        break;
+
+    case STATE_VIEW:
+    case STATE_LOBBY:
+    case STATE_SEATED:
+    case STATE_CLOSED:
+        return 0;
+    }
+
+    return -1;
+}
+
+// Advances the session by whatever one recv() returned. A binary session
+// buffers partial frames and handles every complete one, however TCP split
+// or merged them. Returns -1 once the session is over; any queued output
+// should still be flushed before closing.
+// In the lobby or at a table the player has nothing to answer yet, nor
+// while a ranking listing is still going out.
+static int session_waiting(const Session *s) {
+    return s->state == STATE_LOBBY || s->state == STATE_SEATED || s->state == STATE_VIEW;
+}
+
+// Frames that arrive while the session is waiting, typically a client's
+// next menu choice sent along with its stand or its ranking request, are
+// held in `in` and handled once the menu is back; call with len 0 to run
+// them.
+static int session_feed(Session *s, const char *buff, size_t len) {
+    const uint8_t *payload;
+    size_t         payload_len;
+    int            type;
+
+    if (!s->binary && s->state == STATE_NAME && len > 0 && (uint8_t)buff[0] == FRAME_MAGIC)
+        s->binary = 1;
+
+    if (!s->binary) {
+        if (len > 0)
+            session_text(s, buff, len);
+        return s->state == STATE_CLOSED ? -1 : 0;
+    }
+
+    do {
+        size_t n = sizeof(s->in) - s->in_len;
+        if (n > len)
+            n = len;
+        if (n > 0)
+            memcpy(s->in + s->in_len, buff, n);
+        s->in_len += n;
+        buff += n;
+        len -= n;
+
+        uint8_t *p = s->in;
+        long     used = 0;
+
+        while (!session_waiting(s) &&
+               (used = frame_get(p, s->in + s->in_len - p, &type, &payload, &payload_len)) > 0) {
+            if (session_message(s, type, payload, payload_len) < 0)
+                return -1;
+            p += used;
+        }
+        if (used < 0)
+            return -1;
+
+        s->in_len -= p - s->in;
+        memmove(s->in, p, s->in_len);
+        if (n == 0)
+            break;      // still waiting with a full buffer: the rest is dropped
+    } while (len > 0);
+
+    s->held = session_waiting(s) && frame_get(s->in, s->in_len, &type, &payload, &payload_len) > 0;
+    return s->state == STATE_CLOSED ? -1 : 0;
+}
+
+// Where a resumed session picks up: the hand it is playing alone, or else
+// the menu. A seat at a table is not kept; leaving it stands as before.
+static int resume_point(const Session *s) {
+    if (s->table == NULL && (s->state == STATE_HIT || s->state == STATE_ACE))
+        return s->state;
+    return STATE_MENU;
+}
+
+// Taken over by a reconnect: the player and the hand are its now.
+static int session_taken(Session *s) {
+    if (s->resume_slot >= 0 && resume_stale(s->resume_slot, s->resume_gen)) {
+        s->superseded = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Keeps the resume slot's copy of where the session is current after a
+// move, and passes the move's return code on.
+static int session_keep(Session *s, int rc) {
+    if (s->resume_slot >= 0 && s->state != STATE_CLOSED &&
+        resume_save(s->resume_slot, s->resume_gen, resume_point(s), &s->game, &s->hand) < 0) {
+        s->superseded = 1;
+        return -1;
+    }
+    return rc;
+}
+
+int session_input(Session *s, const char *buff, size_t len) {
+    if (session_taken(s))
+        return -1;
+    return session_keep(s, session_feed(s, buff, len));
+}
+
+// The player let a prompt's deadline pass. A hand stands and play goes on;
+// a connection left at the name prompt or the menu is closed, and its
+// resume token dropped so the client does not simply come back. Returns -1
+// once the session is over.
+int session_timeout(Session *s) {
+    if (session_taken(s))
+        return -1;
+
+    switch (s->state) {
+    case STATE_NAME:
+        STAT_ADD(timeouts_name, 1);
+        session_notice(s, "Timed out waiting for your name.\n");
+        s->state = STATE_CLOSED;
+        break;
+
+    case STATE_MENU:
+    case STATE_VIEW:
+        STAT_ADD(timeouts_menu, 1);
+        if (s->binary)
+            send_token(s, 0);
+        session_notice(s, "Idle for too long. Goodbye.\n");
+        s->state = STATE_CLOSED;
+        if (s->resume_slot >= 0)
+            resume_drop(s->resume_slot, s->resume_gen);
+        break;
+
+    case STATE_HIT:
+    case STATE_ACE:
+        if (s->state == STATE_ACE)
+            STAT_ADD(timeouts_ace, 1);
+        else
+            STAT_ADD(timeouts_hit, 1);
+        session_notice(s, "Time is up: you stand.\n");
+        player_hit(s, 0);
+        break;
+
+    case STATE_LOBBY:
+    case STATE_SEATED:
+        return 0;
+
+    case STATE_CLOSED:      // the goodbye was never taken
+        return -1;
+    }
+    return session_keep(s, s->state == STATE_CLOSED ? -1 : 0);
+}
+
+// worker: the epoll loop that will drive the session, NULL in fork mode.
+void session_open(Session *s, int connfd, Worker *worker) {
+    memset(s, 0, sizeof(*s));
+    s->fd = connfd;
+    s->state = STATE_NAME;
+    s->resume_slot = -1;
+    s->worker = worker;
+    s->timer.kind = TIMER_PROMPT;
+    shoe_init(&s->shoe, shoe_decks, shoe_cut);
+
+    // Each turn goes out as one gathered write, so there is nothing for
+    // Nagle to coalesce; it would only hold the prompt behind a delayed ACK.
+    int on = 1;
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    session_write_static(s, "Enter your name: ");
+    prompt_deadline(s);
+    STAT_ADD(sessions, 1);
+}
+
+// Takes the player out of the game: the lobby, a table, the hand under way
+// and the worker's wheel. The connection is let go by session_release().
+void session_leave(Session *s) {
+    // A player who never got past the name prompt has nothing to record.
+    // With a resume token a hand is kept for the grace period instead of
+    // played out, and one taken over by a reconnect belongs to it.
+    if (s->player_name[0] != '\0') {
+        int kept = s->superseded;
+
+        // Parked, or taken over by a reconnect before we noticed the drop:
+        // either way the hand is not ours to play out.
+        if (!kept && s->resume_slot >= 0 && s->state != STATE_CLOSED) {
+            resume_park(s->resume_slot, s->resume_gen, resume_point(s), &s->game, &s->hand);
+            kept = 1;
+        }
+
+        if (s->state == STATE_LOBBY)
+            lobby_remove(s);
+        else if (s->table != NULL)
+            table_leave(s);
+        else if ((s->state == STATE_HIT || s->state == STATE_ACE) && !kept)
+            game_finish(s);
+
+        log_event(LOG_INFO, LOG_EVENT_DISCONNECT, s->player_name);
+    }
+
+    if (s->worker != NULL)
+        timer_cancel(&s->worker->wheel, &s->timer);
+}
+
+void session_release(Session *s) {
+    close(s->fd);
+    STAT_ADD(sessions, -1);
+    if (s->arena_busy != s->arena)
+        free(s->arena_busy);
+    free(s->arena);
+    s->arena = s->arena_busy = NULL;
+    s->arena_len = s->arena_cap = 0;
+    s->seg_first = s->seg_count = 0;
+    s->out_len = 0;
+}
+
+void session_close(Session *s) {
+    session_leave(s);
+    session_release(s);
+}
+
+// Plays out the hands of players who did not come back within the grace
+// period, as if they had stood when the connection dropped, and records
+// them. One thread for the whole server: forked children park their
+// sessions in the shared table and are gone by then.
+void *resume_sweeper(void *arg) {
+    Shoe       shoe;
+    ResumeSlot r;
+    int        card;
+
+    (void)arg;
+    shoe_init(&shoe, shoe_decks, shoe_cut);
+    while (1) {
+        sleep(1);
+        while (resume_expire(&r)) {
+            STAT_ADD(resume_expired, 1);
+            if (r.state != STATE_HIT && r.state != STATE_ACE)
+                continue;
+
+            shoe_hand_start(&shoe);
+            game_stand(&r.game);
+            record_step(&r.hand, RECORD_DEALER);
+            while ((card = game_dealer_draw(&r.game, &shoe)) != 0) {
+                record_card(&r.hand, &shoe, card);
+                STAT_ADD(dealer_cards, 1);
+            }
+            STAT_ADD(rounds, 1);
+            game_record(r.name, &r.game, &r.hand);
+            log_printf(LOG_INFO, "Player %s did not come back; the hand was played out", r.name);
+        }
+    }
+    return NULL;
+}
+
+// Admission control: past max_sessions a new connection is told so and
+// closed at once, instead of queueing behind everyone already playing.
+int server_full(int connfd) {
+    static const char full[] = "The server is full. Please try again later.\n";
+
+    ServerStats now;
+
+    if (max_sessions == 0)
+        return 0;
+    stats_total(stats, &now);
+    if (now.sessions < (uint64_t)max_sessions)
+        return 0;
+    send(connfd, full, sizeof(full) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(connfd);
+    STAT_ADD(rejected, 1);
+    return 1;
+}
+
+// Fork mode: the child waits in poll() until the open prompt's deadline,
+// and feeds the state machine what recv() returns. A client that stops
+// reading is given as long as the menu's deadline to take its output.
+void handle_client(int connfd) {
+    char    buff[MAXLINE];
+    Session session;
+    ssize_t n;
+
+    session_open(&session, connfd, NULL);
+    if (prompt_timeout[LAT_MENU] > 0) {
+        struct timeval tv = { .tv_sec = prompt_timeout[LAT_MENU] };
+        setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    while (session_flush(&session) == 0) {
+        if (session.deadline != 0) {
+            struct pollfd pfd = { .fd = connfd, .events = POLLIN };
+            uint64_t      now = now_ms();
+            int           ready = 0;
+
+            if (session.deadline > now) {
+                STAT_ADD(wait_calls, 1);
+                ready = poll(&pfd, 1, session.deadline - now);
+            }
+
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready == 0) {
+                if (session_timeout(&session) < 0) {
+                    session_flush(&session);    // the notice
+                    break;
+                }
+                continue;
+            }
+        }
+
+        memset(buff, 0, sizeof(buff));
+        if ((n = recv(connfd, buff, sizeof(buff) - 1, 0)) <= 0) {
+            if (n < 0 && session.state != STATE_NAME)
+                log_printf(LOG_ERR, "recv error : %s", strerror(errno));
+            break;
+        }
+        STAT_ADD(recv_calls, 1);
+        STAT_ADD(recv_bytes, n);
+
+        int      kind = prompt_kind(session.state);
+        uint64_t start = stats_clock();
+
+        if (session_input(&session, buff, n) < 0) {
+            session_flush(&session);    // the goodbye
+            break;
+        }
+        if (session_flush(&session) < 0)
+            break;
+        if (kind >= 0)
+            stat_latency(kind, stats_clock() - start);
+    }
+
+    session_close(&session);
+}
+
+void epoll_update(int epfd, Session *s) {
+    uint32_t events = s->state == STATE_CLOSED ? 0 : EPOLLIN;
+
+    // Held frames become runnable when the wait ends, which may happen on
+    // another session's event; a writable socket brings this one back.
+    if (s->out_len > 0 || (s->held && !session_waiting(s)))
+        events |= EPOLLOUT;
+
+    if (events != s->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = s };
+        STAT_ADD(ctl_calls, 1);
+        epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->events = events;
+    }
+}
+
+void worker_close(Session *s);
+
+// A prompt's deadline passed on a worker's session. One that is over is
+// closed whether or not the client took its last output.
+void session_expired(Session *s) {
+    if (session_timeout(s) == 0 && session_flush(s) == 0) {
+        session_update(s);
+        return;
+    }
+    session_flush(s);
+    worker_close(s);
+}
+
+// Out of descriptors or memory, a pending connection cannot be accepted,
+// and the listener stays readable: accepting again at once would spin on
+// the same error. Each would-be spin pauses accepting instead, on the
+// worker's wheel, for a while that doubles as long as it goes on; the
+// connections wait in the backlog meanwhile.
+static int accept_starved(int err) {
+    return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+}
+
+static void uring_accept(Worker *w);
+
+// Stops accepting: the epoll listener is switched to no events, and in
+// io_uring mode the failed multishot accept, which the error ended, is not
+// submitted again until the pause is over.
+static void accept_pause(Worker *w, int err) {
+    struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+
+    STAT_ADD(accept_errors, 1);
+    if (w->accept_pause == 0)
+        log_printf(LOG_ERR, "accept error : %s; not accepting for a while", strerror(err));
+    w->accept_pause = w->accept_pause == 0 ? ACCEPT_PAUSE_MS
+                    : w->accept_pause * 2 > ACCEPT_PAUSE_MAX_MS ? ACCEPT_PAUSE_MAX_MS : w->accept_pause * 2;
+    if (w->ring == NULL) {
+        STAT_ADD(ctl_calls, 1);
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->listenfd, &ev);
+    }
+    w->accept_timer.kind = TIMER_ACCEPT;
+    timer_arm(&w->wheel, &w->accept_timer, ms_ticks(now_ms() + w->accept_pause));
+}
+
+void accept_resume(Worker *w) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if (w->ring != NULL) {
+        uring_accept(w);
+        return;
+    }
+    STAT_ADD(ctl_calls, 1);
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->listenfd, &ev);
+}
+
+void epoll_accept(Worker *w) {
+    int epfd = w->epfd;
+
+    while (1) {
+        int connfd = accept4(w->listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (connfd < 0) {
+            if (accept_starved(errno)) {
+                accept_pause(w, errno);
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                log_printf(LOG_ERR, "accept error : %s", strerror(errno));
+            if (errno != EINTR && errno != ECONNABORTED)
+                return;
+            continue;
+        }
+        w->accept_pause = 0;
+        STAT_ADD(accepts, 1);
+        if (server_full(connfd))
+            continue;
+
+        Session *s = malloc(sizeof(Session));
+        if (s == NULL) {
+            close(connfd);
+            continue;
+        }
+        session_open(s, connfd, w);
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+        STAT_ADD(ctl_calls, 1);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            log_printf(LOG_ERR, "epoll_ctl error : %s", strerror(errno));
+            session_close(s);
+            free(s);
+            continue;
+        }
+        s->events = EPOLLIN;
+        session_flush(s);
+        epoll_update(epfd, s);
+    }
+}
+
+// Epoll mode: one loop per worker, each with its own SO_REUSEPORT listener,
+// drives every session it accepted without blocking on any of them.
+void *epoll_worker(void *arg) {
+    Worker             *w = arg;
+    int                 epfd;
+    struct epoll_event  ev, events[MAX_EVENTS];
+    char                buff[MAXLINE];
+
+    wheel_init(&w->wheel, now_ms() / TIMER_TICK_MS);
+    if ((epfd = w->epfd = epoll_create1(0)) < 0) {
+        log_printf(LOG_ERR, "epoll_create1 error : %s", strerror(errno));
+        return NULL;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, w->listenfd, &ev) < 0) {
+        log_printf(LOG_ERR, "epoll_ctl error : %s", strerror(errno));
+        close(epfd);
+        return NULL;
+    }
+
+    if (shards != NULL) {
+        cpu_set_t cpus;
+
+        this_worker = w;
+        CPU_ZERO(&cpus);
+        CPU_SET(w->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            log_printf(LOG_WARNING, "Failed to pin worker %d to CPU %d", w->index, w->cpu);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &w->wakefd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, w->wakefd, &ev) < 0) {
+            log_printf(LOG_ERR, "epoll_ctl error : %s", strerror(errno));
+            close(epfd);
+            return NULL;
+        }
+    }
+
+    while (1) {
+        int timeout = timers_run(w);
+
+        if (shards != NULL) {
+            shard_drain(w);
+            __atomic_store_n(&w->asleep, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (shard_pending(w))
+                timeout = 0;
+        }
+
+        STAT_ADD(wait_calls, 1);
+        int nready = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (shards != NULL)
+            __atomic_store_n(&w->asleep, 0, __ATOMIC_RELAXED);
+        if (nready < 0) {
+            if (errno == EINTR)
+                continue;
+            log_printf(LOG_ERR, "epoll_wait error : %s", strerror(errno));
+            break;
+        }
+
+        // One clock read per event: the end of a timed response is the
+        // start of the next event's, unless something untimed came between.
+        uint64_t now = stats_clock();
+        int      fresh = 1;
+
+        for (int i = 0; i < nready; i++) {
+            Session *s = events[i].data.ptr;
+            int      done = 0, kind = -1;
+            uint64_t start = fresh ? now : stats_clock();
+
+            if (s == NULL) {
+                epoll_accept(w);
+                fresh = 0;
+                continue;
+            }
+            if ((void *)s == &w->wakefd) {
+                eventfd_t value;
+                eventfd_read(w->wakefd, &value);
+                fresh = 0;
+                continue;
+            }
+
+            if (s->held && !session_waiting(s))
+                session_input(s, NULL, 0);
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t n = recv(s->fd, buff, sizeof(buff) - 1, 0);
+                if (n > 0) {
+                    STAT_ADD(recv_calls, 1);
+                    STAT_ADD(recv_bytes, n);
+                    buff[n] = '\0';
+                    kind = prompt_kind(s->state);
+                    session_input(s, buff, n);
+                } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    done = 1;
+                }
+            }
+
+            if (!done && s->out_len > 0 && session_flush(s) < 0)
+                done = 1;
+
+            if (!done && s->state == STATE_VIEW && s->out_len < VIEW_CHUNK) {
+                display_more(s);
+                if (session_flush(s) < 0)
+                    done = 1;
+            }
+
+            if (done || s->superseded || (s->state == STATE_CLOSED && s->out_len == 0)) {
+                session_close(s);
+                free(s);
+                fresh = 0;
+                continue;
+            }
+
+            epoll_update(epfd, s);
+            fresh = kind >= 0;
+            if (fresh) {
+                now = stats_clock();
+                stat_latency(kind, now - start);
+            }
+        }
+    }
+
+    close(epfd);
+    return NULL;
+}
+
+// io_uring mode. The loop is the epoll loop's, but every accept, recv and
+// send is an operation on the worker's ring: one multishot accept for the
+// listener, one multishot recv per session into the ring's provided
+// buffers, and one sendmsg per turn of a session's queued output. What a
+// batch of completions produces for all its sessions goes to the kernel
+// with the same io_uring_enter() that waits for the next batch.
+//
+// user_data is the session's address with the operation in the low bits.
+enum {
+    URING_CANCEL,
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND
+};
+#define URING_OP_MASK 3
+
+static struct io_uring_sqe *worker_sqe(Worker *w) {
+    struct io_uring_sqe *sqe;
+
+    // A full queue is submitted early rather than waited on.
+    while ((sqe = uring_sqe(w->ring)) == NULL) {
+        STAT_ADD(wait_calls, 1);
+        uring_enter(w->ring, 0, 0);
+    }
+    STAT_ADD(uring_ops, 1);
+    return sqe;
+}
+
+static void uring_accept(Worker *w) {
+    struct io_uring_sqe *sqe = worker_sqe(w);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = w->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = URING_ACCEPT;
+}
+
+static void uring_recv(Session *s) {
+    struct io_uring_sqe *sqe = worker_sqe(s->worker);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (uintptr_t)s | URING_RECV;
+    s->uring_ops++;
+}
+
+// Queues the session's output as one sendmsg of all its segments, unless
+// one is in flight; its completion queues the rest.
+int uring_flush(Session *s) {
+    struct io_uring_sqe *sqe;
+    int                  n = s->seg_count;
+
+    if (s->sending || s->closing || s->out_len == 0)
+        return 0;
+    for (int i = 0; i < n; i++) {
+        OutSegment *g = &s->seg[s->seg_first + i];
+        s->iov[i].iov_base = (char *)(g->text ? g->text + g->off : s->arena + g->off);
+        s->iov[i].iov_len = g->len;
+    }
+    memset(&s->msg, 0, sizeof(s->msg));
+    s->msg.msg_iov = s->iov;
+    s->msg.msg_iovlen = n;
+
+    sqe = worker_sqe(s->worker);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)&s->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)s | URING_SEND;
+    s->sending = 1;
+    s->arena_busy = s->arena;
+    s->uring_ops++;
+    return 0;
+}
+
+static void uring_op_done(Session *s) {
+    if (--s->uring_ops == 0 && s->closing) {
+        session_release(s);
+        free(s);
+    }
+}
+
+// Ends a session: out of the game at once, but its descriptor and memory
+// are only let go once nothing in flight refers to them. One cancel takes
+// back everything on the descriptor, a send to a client that stopped
+// reading included.
+static void uring_close(Session *s) {
+    struct io_uring_sqe *sqe;
+
+    s->closing = 1;
+    session_leave(s);
+    if (s->uring_ops == 0) {
+        session_release(s);
+        free(s);
+        return;
+    }
+    sqe = worker_sqe(s->worker);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = s->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = URING_CANCEL;
+}
+
+// After a session's event: close it, stream more of the rankings, or send
+// what it queued.
+static void uring_settle(Session *s) {
+    if (s->superseded || (s->state == STATE_CLOSED && s->out_len == 0)) {
+        uring_close(s);
+        return;
+    }
+    if (s->state == STATE_VIEW && s->out_len < VIEW_CHUNK)
+        display_more(s);
+    session_flush(s);
+    session_update(s);
+}
+
+static void uring_accepted(Worker *w, int res, unsigned flags) {
+    Session *s;
+
+    // An error ends the multishot accept; out of descriptors, submitting it
+    // again at once would only fail again.
+    if (res < 0 && accept_starved(-res) && !(flags & IORING_CQE_F_MORE)) {
+        accept_pause(w, -res);
+        return;
+    }
+    if (!(flags & IORING_CQE_F_MORE))
+        uring_accept(w);
+    if (res < 0) {
+        if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED)
+            log_printf(LOG_ERR, "accept error : %s", strerror(-res));
+        return;
+    }
+    w->accept_pause = 0;
+    STAT_ADD(accepts, 1);
+    if (server_full(res))
+        return;
+    if ((s = malloc(sizeof(Session))) == NULL) {
+        close(res);
+        return;
+    }
+    session_open(s, res, w);
+    uring_recv(s);
+    session_flush(s);
+}
+
+static void uring_received(Worker *w, Session *s, int res, unsigned flags) {
+    int      ended = !(flags & IORING_CQE_F_MORE);
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (s->closing) {
+        if (flags & IORING_CQE_F_BUFFER)
+            uring_buffer_return(w->ring, bid);
+        if (ended)
+            uring_op_done(s);
+        return;
+    }
+
+    if (res > 0) {
+        char    *buff = uring_buffer(w->ring, bid);
+        int      kind = prompt_kind(s->state);
+        uint64_t start = stats_clock();
+
+        STAT_ADD(recv_bytes, res);
+        if (s->held && !session_waiting(s))
+            session_input(s, NULL, 0);
+        buff[res] = '\0';
+        session_input(s, buff, res);
+        if (kind >= 0) {
+            s->answer_kind = kind;
+            s->answer_start = start;
+        }
+    }
+    if (flags & IORING_CQE_F_BUFFER)
+        uring_buffer_return(w->ring, bid);
+
+    // A multishot recv stops when the buffers run out, which only needs it
+    // armed again, or for good at the end of the connection.
+    if (ended) {
+        s->uring_ops--;
+        if (res > 0 || res == -ENOBUFS)
+            uring_recv(s);
+    }
+    if (res <= 0 && res != -ENOBUFS) {
+        uring_close(s);
+        return;
+    }
+    uring_settle(s);
+}
+
+static void uring_sent(Session *s, int res) {
+    s->sending = 0;
+    if (s->arena_busy != s->arena)
+        free(s->arena_busy);
+    s->arena_busy = NULL;
+    if (s->closing) {
+        uring_op_done(s);
+        return;
+    }
+    s->uring_ops--;
+    if (res < 0) {
+        uring_close(s);
+        return;
+    }
+
+    session_sent(s, res);
+    if (s->out_len == 0 && s->answer_start != 0) {
+        stat_latency(s->answer_kind, stats_clock() - s->answer_start);
+        s->answer_start = 0;
+    }
+    uring_settle(s);
+}
+
+// Runs the frames held by sessions that have stopped waiting, as EPOLLOUT
+// does for the epoll loop.
+static void uring_run_ready(Worker *w) {
+    Session *s;
+
+    while ((s = w->ready) != NULL) {
+        w->ready = s->ready_next;
+        s->ready = 0;
+        if (s->closing) {
+            uring_op_done(s);
+            continue;
+        }
+        s->uring_ops--;
+        session_input(s, NULL, 0);
+        uring_settle(s);
+    }
+}
+
+void *uring_worker(void *arg) {
+    Worker              *w = arg;
+    Uring                ring;
+    struct io_uring_cqe *cqe;
+
+    if (uring_init(&ring, URING_ENTRIES, URING_BUFFERS, MAXLINE) < 0) {
+        log_printf(LOG_WARNING, "io_uring unavailable for a worker (%s); it uses epoll", strerror(errno));
+        return epoll_worker(arg);
+    }
+    w->ring = &ring;
+    wheel_init(&w->wheel, now_ms() / TIMER_TICK_MS);
+    uring_accept(w);
+
+    while (1) {
+        int timeout = timers_run(w);
+
+        uring_run_ready(w);
+        STAT_ADD(wait_calls, 1);
+        if (uring_enter(&ring, 1, timeout) < 0) {
+            log_printf(LOG_ERR, "io_uring_enter error : %s", strerror(errno));
+            break;
+        }
+
+        while ((cqe = uring_cqe(&ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int      res = cqe->res;
+            unsigned flags = cqe->flags;
+            Session *s = (Session *)(uintptr_t)(data & ~(uint64_t)URING_OP_MASK);
+
+            uring_cqe_seen(&ring);
+            switch (data & URING_OP_MASK) {
+            case URING_ACCEPT: uring_accepted(w, res, flags); break;
+            case URING_RECV:   uring_received(w, s, res, flags); break;
+            case URING_SEND:   uring_sent(s, res); break;
+            default:           break;
+            }
+        }
+    }
+
+    w->ring = NULL;
+    uring_exit(&ring);
+    return NULL;
+}
+
+// After output was queued for a session outside its own event.
+void session_update(Session *s) {
+    Worker *w = s->worker;
+
+    if (w->ring == NULL) {
+        epoll_update(w->epfd, s);
+    } else if (s->held && !session_waiting(s) && !s->ready && !s->closing) {
+        s->ready = 1;
+        s->ready_next = w->ready;
+        w->ready = s;
+        s->uring_ops++;
+    }
+}
+
+void worker_close(Session *s) {
+    if (s->worker->ring != NULL) {
+        uring_close(s);
+    } else {
+        session_close(s);
+        free(s);
+    }
+}
+
+int
+daemon_init(const char *pname, int facility, uid_t uid)
+{
+    int		i;
+    pid_t	pid;
+
+    if ( (pid = fork()) < 0)
+        return (-1);
+    else if (pid)
+        exit(0);			/* parent terminates */
+
+    /* child 1 continues... */
+
+    if (setsid() < 0)			/* become session leader */
+        return (-1);
+
+    signal(SIGHUP, SIG_IGN);
+    if ( (pid = fork()) < 0)
+        return (-1);
+    else if (pid)
+        exit(0);			/* child 1 terminates */
+
+    /* child 2 continues... */
+
+    chdir("/");				/* change working directory - or chroot()*/
+
+    /* close off file descriptors */
+    for (i = 0; i < MAXFD; i++){
+        close(i);
+    }
+
+    /* redirect stdin, stdout, and stderr to /dev/null */
+    open("/dev/null", O_RDONLY);
+    open("/dev/null", O_RDWR);
+    open("/dev/null", O_RDWR);
+
+    openlog(pname, LOG_PID, facility);
+    
+    setuid(uid); /* change user */
+    
+    return (0);				/* success */
+}
+
+// A failure that stops the server. Past daemon_init() stderr is /dev/null,
+// so it goes to the log, and is written out before the process exits.
+static int fatal(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static int fatal(const char *fmt, ...) {
+    char    text[LOG_TEXT_MAX + 1];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    log_printf(LOG_ERR, "%s", text);
+    logger_flush();
+    return 1;
+}
+
+// Fork mode: reaps finished games so they do not linger as zombies, and
+// frees the stats slot of any child that died before releasing it. Only
+// the server's own process group: the hand recorder's compressors have
+// groups of their own and are waited for by the recorder.
+static void reap_children(int sig) {
+    int   saved = errno;
+    pid_t pid;
+
+    (void)sig;
+    while ((pid = waitpid(0, NULL, WNOHANG)) > 0)
+        stats_reap(pid);
+    errno = saved;
+}
+
+const char *version_name(IP_VERSION version) {
+    return version == IPV4 ? "IPv4" : version == IPV6 ? "IPv6" : "IPv4 and IPv6";
+}
+
+int create_listener(IP_VERSION version, int reuseport) {
+    int listenfd;
+    int on = 1;
+    struct sockaddr_in server_addr;
+    struct sockaddr_in6 server_addr6;
+
+    if (version == IPV4) {
+        if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+            log_printf(LOG_ERR, "socket error : %s", strerror(errno));
+            return -1;
+        }
+
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            log_printf(LOG_ERR, "setsockopt SO_REUSEPORT error : %s", strerror(errno));
+            close(listenfd);
+            return -1;
+        }
+
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        server_addr.sin_port = htons(server_port);
+
+        if (bind(listenfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+            log_printf(LOG_ERR, "bind error : %s", strerror(errno));
+            close(listenfd);
+            return -1;
+        }
+    } else {
+        int v6only = version == IPV6;
+
+        if ((listenfd = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
+            log_printf(LOG_ERR, "socket error : %s", strerror(errno));
+            return -1;
+        }
+
+        // Dual stack: IPv4 clients arrive as ::ffff:a.b.c.d on the same socket.
+        if (setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+            log_printf(LOG_ERR, "setsockopt IPV6_V6ONLY error : %s", strerror(errno));
+            close(listenfd);
+            return -1;
+        }
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            log_printf(LOG_ERR, "setsockopt SO_REUSEPORT error : %s", strerror(errno));
+            close(listenfd);
+            return -1;
+        }
+
+        memset(&server_addr6, 0, sizeof(server_addr6));
+        server_addr6.sin6_family = AF_INET6;
+        server_addr6.sin6_addr = in6addr_any;
+        server_addr6.sin6_port = htons(server_port);
+
+        if (bind(listenfd, (struct sockaddr *) &server_addr6, sizeof(server_addr6)) < 0) {
+            log_printf(LOG_ERR, "bind error : %s", strerror(errno));
+            close(listenfd);
+            return -1;
+        }
+    }
+
+    if (listen(listenfd, listen_backlog) < 0) {
+        log_printf(LOG_ERR, "listen error : %s", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
+// Replaces the SO_REUSEPORT group's hash with the number of the CPU that
+// took the connection: the listener of the worker pinned there. CPUs
+// without a listener fall back to the hash.
+void steer_by_cpu(int listenfd) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog = { .len = 2, .filter = code };
+
+    if (setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+        log_printf(LOG_WARNING, "setsockopt SO_ATTACH_REUSEPORT_CBPF error : %s", strerror(errno));
+}
+
+// Serves the counters in the Prometheus text format on a Unix socket, to
+// anything from `nc -U` to a scraper: a request starting with GET gets an
+// HTTP response, anything else (or nothing, within 100 ms) just the text.
+void *stats_server(void *arg) {
+    static char        body[32 * 1024];
+    const char        *path = arg;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int                listenfd;
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        log_printf(LOG_ERR, "stats socket error : %s", strerror(errno));
+        return NULL;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(addr.sun_path);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 16) < 0) {
+        log_printf(LOG_ERR, "stats socket %s error : %s", path, strerror(errno));
+        close(listenfd);
+        return NULL;
+    }
+
+    while (1) {
+        char          request[256];
+        struct pollfd pfd;
+        ssize_t       n = 0;
+        size_t        len;
+        int           connfd = accept(listenfd, NULL, NULL);
+
+        if (connfd < 0)
+            continue;
+
+        pfd.fd = connfd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) > 0)
+            n = recv(connfd, request, sizeof(request), 0);
+
+        len = stats_format(stats, body, sizeof(body));
+        if (n >= 3 && memcmp(request, "GET", 3) == 0) {
+            char header[128];
+            int  hlen = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+            send(connfd, header, hlen, MSG_NOSIGNAL);
+        }
+        send(connfd, body, len, MSG_NOSIGNAL);
+        close(connfd);
+    }
+    return NULL;
+}
+
+// Maps the I/O counters before any fork so every child adds to the same
+// totals. The object is named after the port so several servers can run
+// side by side; it is removed and recreated so counts start from zero.
+int stats_init(void) {
+    char name[64];
+    int  fd;
+
+    snprintf(name, sizeof(name), STATS_SHM_NAME, server_port);
+    shm_unlink(name);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0) {
+        if (ftruncate(fd, sizeof(StatsRegion)) == 0)
+            stats = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (stats != NULL && stats != MAP_FAILED)
+            return 0;
+    }
+
+    // No /dev/shm: keep counting privately rather than refusing to start.
+    stats = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return stats == MAP_FAILED ? -1 : 0;
+}
+
+void usage(const char *pname) {
+    fprintf(stderr, "Usage: %s [-m fork|epoll|core|uring] [-w workers] [-p port] [-d data dir] [-D decks] [-C cut percent] [-t seats] [-T decision seconds]\n"
+                    "          [-i name,menu,hit,ace prompt seconds] [-k tables per worker] [-q lobby depth] [-c max sessions] [-b listen backlog]\n"
+                    "          [-S stats socket] [-l log file] [-n node/nodes] [-g resume grace seconds] [-r hand record dir] [-R MB per record file]\n"
+                    "          [-z record compressor] [-f] [-s] [-u] [4|6]\n", pname);
+}
+
+int main(int argc, char *argv[]) {
+    SERVER_MODE mode = MODE_FORK;
+    int workers = 0;        // default: one epoll loop per core
+    int foreground = 0;
+    int sync_log = 0;
+    const char *data_dir = DATA_DIR;
+    const char *log_path = NULL;
+    int resume_grace_s = RESUME_DEFAULT_GRACE;
+    const char *record_dir = NULL;
+    const char *record_compress = NULL;
+    int record_rotate = RECORD_DEFAULT_ROTATE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:w:p:d:D:C:t:T:i:k:q:c:b:S:l:n:g:r:R:z:fsu")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "fork") == 0) {
+                mode = MODE_FORK;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                mode = MODE_EPOLL;
+            } else if (strcmp(optarg, "core") == 0) {
+                mode = MODE_CORE;
+            } else if (strcmp(optarg, "uring") == 0) {
+                mode = MODE_URING;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            if (workers < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            server_port = atoi(optarg);
+            break;
+        case 'd':
+            data_dir = optarg;
+            break;
+        case 'f':
+            foreground = 1;
+            break;
+        case 'u':
+            unbuffered = 1;
+            break;
+        case 'l':
+            log_path = optarg;
+            break;
+        case 's':
+            sync_log = 1;
+            break;
+        case 'D':
+            shoe_decks = atoi(optarg);
+            if (shoe_decks < 1 || shoe_decks > SHOE_MAX_DECKS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            shoe_cut = atoi(optarg);
+            if (shoe_cut < 1 || shoe_cut > 100) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            seats_per_table = atoi(optarg);
+            if (seats_per_table < 1 || seats_per_table > TABLE_MAX_SEATS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            decision_timeout = atoi(optarg);
+            if (decision_timeout < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'i': {
+            int *t = prompt_timeout;
+            if (sscanf(optarg, "%d,%d,%d,%d", &t[LAT_NAME], &t[LAT_MENU], &t[LAT_HIT], &t[LAT_ACE]) != 4) {
+                usage(argv[0]);
+                return 1;
+            }
+            for (int k = LAT_NAME; k <= LAT_ACE; k++) {
+                if (t[k] < 0 || t[k] > UINT16_MAX) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            break;
+        }
+        case 'k':
+            tables_per_worker = atoi(optarg);
+            if (tables_per_worker < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'q':
+            lobby_depth = atoi(optarg);
+            if (lobby_depth < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            max_sessions = atoi(optarg);
+            if (max_sessions < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            stats_socket_path = optarg;
+            break;
+        case 'n':
+            if (sscanf(optarg, "%d/%d", &ranking_node, &ranking_nodes) != 2 || ranking_nodes < 1 ||
+                ranking_nodes > RANKING_MAX_NODES || ranking_node < 0 || ranking_node >= ranking_nodes) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            resume_grace_s = atoi(optarg);
+            if (resume_grace_s < 0 || resume_grace_s > UINT16_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            record_dir = optarg;
+            break;
+        case 'R':
+            record_rotate = atoi(optarg);
+            if (record_rotate < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'z':
+            record_compress = optarg;
+            break;
+        case 'b':
+            listen_backlog = atoi(optarg);
+            if (listen_backlog < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (workers == 0) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (mode == MODE_CORE && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            workers = CPU_COUNT(&allowed);
+        else
+            workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers < 1)
+        workers = 1;
+
+    if (seats_per_table > 1 && mode == MODE_FORK) {
+        fprintf(stderr, "Tables (-t) need an event loop mode (-m epoll, core or uring)\n");
+        return 1;
+    }
+
+    if (!foreground && daemon_init("blackjackd", LOG_DAEMON, 1000) < 0) {
+        fprintf(stderr, "Failed to initialize daemon.\n");
+        return 1;
+    }
+
+    // In the foreground the log goes to standard output, as daemons' go to syslog.
+    if (log_path == NULL && foreground)
+        log_path = "-";
+    if (logger_init(log_path, sync_log) < 0) {
+        fprintf(stderr, "Failed to open log %s : %s\n", log_path, strerror(errno));
+        syslog(LOG_ERR, "Failed to open log %s : %s", log_path, strerror(errno));
+        return 1;
+    }
+    log_printf(LOG_INFO, "Blackjack server started");
+
+    if (record_dir != NULL && recorder_init(record_dir, record_rotate, record_compress, shoe_decks) < 0) {
+        return fatal("Failed to set up the hand record : %s", strerror(errno));
+    }
+
+    if (ranking_init() < 0) {
+        return fatal("Failed to create ranking store : %s", strerror(errno));
+    }
+
+    long pending = ranking_open(data_dir, LEGACY_RANKINGS_FILE);
+    if (pending < 0) {
+        return fatal("Failed to recover rankings from %s : %s", data_dir, strerror(errno));
+    }
+    if (pending > 0)
+        ranking_compact();
+
+    if (stats_init() < 0) {
+        return fatal("Failed to create stats region : %s", strerror(errno));
+    }
+    stats_clock_init();
+    if (logger_start() < 0) {
+        return fatal("Failed to create logger thread");
+    }
+    if (recorder_start() < 0) {
+        return fatal("Failed to create hand recorder thread");
+    }
+
+    char default_socket[108];
+    if (stats_socket_path == NULL) {
+        snprintf(default_socket, sizeof(default_socket), STATS_SOCKET, server_port);
+        stats_socket_path = default_socket;
+    }
+    pthread_t stats_thread;
+    if (stats_socket_path[0] != '\0' &&
+        pthread_create(&stats_thread, NULL, stats_server, (void *)stats_socket_path) != 0) {
+        return fatal("Failed to create stats thread");
+    }
+
+    if (ranking_nodes > 1 && replica_start() < 0) {
+        return fatal("Failed to join the ranking cluster : %s", strerror(errno));
+    }
+
+    pthread_t compactor_thread;
+    if (pthread_create(&compactor_thread, NULL, ranking_compactor, NULL) != 0) {
+        return fatal("Failed to create compactor thread");
+    }
+
+    if (resume_init(resume_grace_s) < 0) {
+        return fatal("Failed to create resume table : %s", strerror(errno));
+    }
+    pthread_t sweeper_thread;
+    if (resume_table != NULL && pthread_create(&sweeper_thread, NULL, resume_sweeper, NULL) != 0) {
+        return fatal("Failed to create resume sweeper thread");
+    }
+
+    int listenfd, connfd, starved = 0;
+    struct sockaddr_storage client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    pthread_t multicast_thread;
+    ServerConfig config;
+  
+    // Both families on one socket unless told to serve only one, or the
+    // kernel has no IPv6.
+    config.version = IP_DUAL;
+    if (optind < argc)
+        config.version = atoi(argv[optind]) == 6 ? IPV6 : IPV4;
+    if (config.version == IP_DUAL) {
+        int probe = socket(AF_INET6, SOCK_STREAM, 0);
+        if (probe < 0)
+            config.version = IPV4;
+        else
+            close(probe);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // io_uring is picked at run time: a kernel without it, or one that
+    // forbids it, gets the epoll loop.
+    if (mode == MODE_URING) {
+        Uring probe;
+        if (uring_init(&probe, 8, 8, MAXLINE) < 0) {
+            log_printf(LOG_WARNING, "io_uring is unavailable (%s); using epoll", strerror(errno));
+            mode = MODE_EPOLL;
+        } else {
+            uring_exit(&probe);
+        }
+    }
+
+    if (mode == MODE_EPOLL || mode == MODE_CORE || mode == MODE_URING) {
+        void *(*loop)(void *) = mode == MODE_URING ? uring_worker : epoll_worker;
+        Worker *pool = calloc(workers, sizeof(Worker));
+        struct rlimit rl;
+        cpu_set_t allowed;
+        int cpus[CPU_SETSIZE], ncpus = 0;
+
+        // One descriptor per session: lift the soft limit as far as allowed.
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+
+        if (pool == NULL) {
+            return fatal("calloc error : %s", strerror(errno));
+        }
+        for (int i = 0; i < workers; i++) {
+            if ((pool[i].listenfd = create_listener(config.version, workers > 1)) < 0)
+                return fatal("No listener on port %d", server_port);
+            fcntl(pool[i].listenfd, F_SETFL, fcntl(pool[i].listenfd, F_GETFL) | O_NONBLOCK);
+        }
+
+        // Core mode: worker i runs on the i-th CPU we may use, and owns
+        // the i-th shard of the players.
+        if (mode == MODE_CORE) {
+            CPU_ZERO(&allowed);
+            sched_getaffinity(0, sizeof(allowed), &allowed);
+            for (int c = 0; c < CPU_SETSIZE; c++)
+                if (CPU_ISSET(c, &allowed))
+                    cpus[ncpus++] = c;
+            if (ncpus == 0)
+                cpus[ncpus++] = 0;
+
+            shard_queues = mmap(NULL, (size_t)workers * workers * sizeof(ShardQueue), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (shard_queues == MAP_FAILED) {
+                return fatal("mmap error : %s", strerror(errno));
+            }
+            for (int i = 0; i < workers; i++) {
+                pool[i].index = i;
+                pool[i].cpu = cpus[i % ncpus];
+                if ((pool[i].wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+                    return fatal("eventfd error : %s", strerror(errno));
+                }
+            }
+            shards = pool;
+            shard_count = workers;
+
+            // With a worker on each of CPUs 0..workers-1, let the kernel
+            // hand a connection to the listener of the CPU its packets
+            // arrived on, so it is served where it is already cached.
+            if (workers > 1 && cpus[workers - 1] == workers - 1)
+                steer_by_cpu(pool[0].listenfd);
+        }
+
+        if (pthread_create(&multicast_thread, NULL, multicast_server_ip, &config) != 0) {
+            return fatal("Failed to create multicast thread");
+        }
+
+        log_printf(LOG_INFO, "Server listening on port %d using %s with %d %s",
+                   server_port, version_name(config.version), workers,
+                   mode == MODE_CORE ? "core worker(s), ranking sharded" :
+                   mode == MODE_URING ? "io_uring worker(s)" : "epoll worker(s)");
+
+        for (int i = 1; i < workers; i++) {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, loop, &pool[i]) != 0) {
+                return fatal("Failed to create worker thread");
+            }
+        }
+        loop(&pool[0]);
+        logger_flush();
+        return 1;
+    }
+
+    if ((listenfd = create_listener(config.version, 0)) < 0)
+        return fatal("No listener on port %d", server_port);
+
+    signal(SIGCHLD, reap_children);
+
+    if (pthread_create(&multicast_thread, NULL, multicast_server_ip, &config) != 0) {
+        return fatal("Failed to create multicast thread");
+    }
+
+    log_printf(LOG_INFO, "Server listening on port %d using %s",
+               server_port, version_name(config.version));
+
+    while (1) {
+        connfd = accept(listenfd, (struct sockaddr *)&client_addr, &client_len);
+        if (connfd < 0) {
+            int err = errno;
+
+            // Out of descriptors, as in the event loops: wait, not spin.
+            if (accept_starved(err)) {
+                struct timespec pause = { 0, ACCEPT_PAUSE_MS * 1000000 };
+
+                STAT_ADD(accept_errors, 1);
+                if (!starved)
+                    log_printf(LOG_ERR, "accept error : %s; not accepting for a while", strerror(err));
+                starved = 1;
+                nanosleep(&pause, NULL);
+            } else if (err != EINTR && err != ECONNABORTED) {
+                log_printf(LOG_ERR, "accept error : %s", strerror(err));
+            }
+            continue;
+        }
+        starved = 0;
+        STAT_ADD(accepts, 1);
+        if (server_full(connfd))
+            continue;
+
+        if (fork() == 0) {
+            stat_slot = NULL;       // the parent's; the child claims its own
+            signal(SIGCHLD, SIG_DFL);
+            close(listenfd);
+            handle_client(connfd);
+            stats_release();
+            exit(0);
+        }
+        close(connfd);
+    }
+
+    close(listenfd);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "shoe.h"
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(Rng *r) {
+    if (getrandom(r->s, sizeof(r->s), GRND_NONBLOCK) != sizeof(r->s)) {
+        // No entropy yet (early boot): still never repeat across sessions.
+        static uint64_t counter;
+        struct timespec ts;
+        uint64_t x;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        x = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        x ^= (uint64_t)getpid() << 32;
+        x += __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ull;
+        for (int i = 0; i < 4; i++)
+            r->s[i] = splitmix64(&x);
+    }
+    if ((r->s[0] | r->s[1] | r->s[2] | r->s[3]) == 0)
+        r->s[0] = 1;    // the one state xoshiro cannot leave
+}
+
+// Uniform in [0, n) without modulo bias (Lemire's multiply-and-reject).
+uint32_t rng_below(Rng *r, uint32_t n) {
+    uint64_t m = (rng_next(r) >> 32) * n;
+    uint32_t low = (uint32_t)m;
+
+    if (low < n) {
+        uint32_t threshold = -n % n;
+        while (low < threshold) {
+            m = (rng_next(r) >> 32) * n;
+            low = (uint32_t)m;
+        }
+    }
+    return m >> 32;
+}
+
+static const uint8_t deck[13] = { SHOE_DECK };
+
+void shoe_init(Shoe *shoe, int decks, int cut_percent) {
+    if (decks < 1)
+        decks = 1;
+    if (decks > SHOE_MAX_DECKS)
+        decks = SHOE_MAX_DECKS;
+    if (cut_percent < 1 || cut_percent > 100)
+        cut_percent = SHOE_DEFAULT_CUT;
+
+    shoe->size = decks * 52;
+    shoe->cut = shoe->size * cut_percent / 100;
+
+    rng_seed(&shoe->rng);
+    shoe_shuffle(shoe);
+}
+
+void shoe_shuffle(Shoe *shoe) {
+    shoe_shuffle_seed(shoe, rng_next(&shoe->rng));
+}
+
+// Fresh decks in the shoe's order for seed.
+void shoe_shuffle_seed(Shoe *shoe, uint64_t seed) {
+    for (int i = 0; i < shoe->size; i++)
+        shoe->cards[i] = deck[i % 13];
+    shoe_shuffle_cards(shoe, seed);
+}
+
+// Fisher-Yates over the cards as they are, driven by a generator expanded
+// from seed. Only the shuffle test calls it on anything but fresh decks.
+void shoe_shuffle_cards(Shoe *shoe, uint64_t seed) {
+    Rng      r;
+    uint64_t x = seed;
+
+    for (int i = 0; i < 4; i++)
+        r.s[i] = splitmix64(&x);
+    shoe->seed = seed;
+
+    for (uint32_t i = shoe->size - 1; i > 0; i--) {
+        uint32_t j = rng_below(&r, i + 1);
+        uint8_t  t = shoe->cards[i];
+        shoe->cards[i] = shoe->cards[j];
+        shoe->cards[j] = t;
+    }
+    shoe->next = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef SHOE_H
+#define SHOE_H
+
+#include <stdint.h>
+
+#define SHOE_MAX_DECKS 8
+#define SHOE_DEFAULT_DECKS 6
+#define SHOE_DEFAULT_CUT 75     // percent of the shoe dealt before a reshuffle
+#define CARD_ACE 11             // aces are dealt as 11; the player may count one as 1
+
+// One deck's card values: an ace, 2-9, and a ten for each of 10, J, Q, K.
+// SHOE_DECK_ID is the list read as hex digits, so the hint table, worked
+// out from these odds, can check at compile time that they are its own.
+#define SHOE_DECK CARD_ACE, 2, 3, 4, 5, 6, 7, 8, 9, 10, 10, 10, 10
+#define SHOE_DECK_ID deck_id_(SHOE_DECK)
+#define deck_id_(...) deck_id13_(__VA_ARGS__)
+#define deck_id13_(a, b, c, d, e, f, g, h, i, j, k, l, m) \
+    (((((((((((((0ull + (a)) * 16 + (b)) * 16 + (c)) * 16 + (d)) * 16 + (e)) * 16 + (f)) * 16 + (g)) * 16 + (h)) \
+       * 16 + (i)) * 16 + (j)) * 16 + (k)) * 16 + (l)) * 16 + (m))
+
+// xoshiro256**: small, fast and good enough for dealing cards. Each session
+// owns one, so drawing takes no lock and no two sessions share a sequence.
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+// A shoe of N decks holding card values (2-10, 10 for faces, CARD_ACE).
+// Drawing is an index bump; the shuffle runs when a hand starts past the
+// cut card, or in the rare hand that empties the shoe.
+//
+// Every shuffle starts from fresh decks and draws only on a 64-bit seed
+// taken from the shoe's generator, so the seed alone gives the order of
+// the cards dealt until the next one (shoe_shuffle_seed()).
+typedef struct {
+    uint8_t  cards[SHOE_MAX_DECKS * 52];
+    uint16_t size;
+    uint16_t next;
+    uint16_t cut;
+    uint64_t seed;          // of the current shuffle
+    Rng      rng;
+} Shoe;
+
+void rng_seed(Rng *r);
+uint32_t rng_below(Rng *r, uint32_t n);
+
+void shoe_init(Shoe *shoe, int decks, int cut_percent);
+void shoe_shuffle(Shoe *shoe);
+void shoe_shuffle_seed(Shoe *shoe, uint64_t seed);
+void shoe_shuffle_cards(Shoe *shoe, uint64_t seed);
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(Rng *r) {
+    uint64_t *s = r->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+// Call before each hand: reshuffles once the cut card has come out.
+static inline void shoe_hand_start(Shoe *shoe) {
+    if (shoe->next >= shoe->cut)
+        shoe_shuffle(shoe);
+}
+
+static inline int shoe_draw(Shoe *shoe) {
+    if (shoe->next == shoe->size)
+        shoe_shuffle(shoe);
+    return shoe->cards[shoe->next++];
+}
+
+#endif
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "engine.h"
+
+#define DEFAULT_HANDS 100000000L
+#define DEFAULT_BATCH 65536
+#define DEFAULT_HIT_BELOW 17
+#define MAX_SCORE GAME_TARGET
+#define UP_CARDS 12     // dealer up-card values 2..11 index directly
+
+// Monte Carlo simulation of the server's game, with no sockets. Hands are
+// played by the same engine as the server (engine.h); only the player's
+// decisions come from here.
+
+// One thread's totals. Merged once all batches are done.
+typedef struct {
+    uint64_t hands;
+    uint64_t wins, draws, losses;
+    uint64_t player_busts, dealer_busts;
+    int64_t  net;                               // sum of +1 / 0 / -1
+    uint64_t decisions[MAX_SCORE + 1][UP_CARDS];
+    int64_t  stand[MAX_SCORE + 1][UP_CARDS];    // outcome sums if standing there
+    int64_t  hit[MAX_SCORE + 1][UP_CARDS];      // ... if hitting once, then the policy
+} SimStats;
+
+// The batches a worker still owns, [lo, hi) packed into one word so the
+// owner (taking from the back) and thieves (taking from the front) agree
+// with a single compare-and-swap.
+typedef struct {
+    _Alignas(64) uint64_t range;
+} WorkQueue;
+
+typedef struct {
+    int         id;
+    pthread_t   tid;
+    Shoe        shoe;
+    SimStats   *stats;
+    uint64_t    stolen;
+} Worker;
+
+static WorkQueue   *queues;
+static Worker      *workers;
+static int          nworkers;
+static long         total_hands;
+static int          batch_hands = DEFAULT_BATCH;
+static int          hit_below = DEFAULT_HIT_BELOW;
+static int          decision_ev = 1;
+
+static int queue_take(WorkQueue *q, uint32_t *batch) {
+    uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    uint32_t lo, hi;
+
+    do {
+        lo = r >> 32;
+        hi = (uint32_t)r;
+        if (lo >= hi)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&q->range, &r, (uint64_t)lo << 32 | (hi - 1),
+                                          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *batch = hi - 1;
+    return 1;
+}
+
+static int queue_steal(WorkQueue *q, uint32_t *batch) {
+    uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    uint32_t lo, hi;
+
+    do {
+        lo = r >> 32;
+        hi = (uint32_t)r;
+        if (lo >= hi)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&q->range, &r, (uint64_t)(lo + 1) << 32 | hi,
+                                          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *batch = lo;
+    return 1;
+}
+
+// The player's ace choice under the simulated policy.
+static inline int policy_ace(const Game *g) {
+    return g->player_score + CARD_ACE > MAX_SCORE ? 1 : CARD_ACE;
+}
+
+static inline void policy_hit(Game *g, Shoe *shoe) {
+    game_hit(g, shoe);
+    if (g->phase == GAME_ACE)
+        game_choose_ace(g, policy_ace(g));
+}
+
+// Hits once, then plays the rest of the hand by the policy. Returns the
+// outcome.
+static int play_out(Game *g, Shoe *shoe) {
+    policy_hit(g, shoe);
+    while (g->phase == GAME_PLAYER && g->player_score < hit_below)
+        policy_hit(g, shoe);
+    return game_resolve(g, shoe);
+}
+
+// Both choices at one decision point, played out on the same upcoming
+// cards; the real hand then continues from where the shoe was.
+static void evaluate(Shoe *shoe, SimStats *st, const Game *g) {
+    uint16_t next = shoe->next;
+    int      player = g->player_score, up = g->up_card;
+    Game     t;
+
+    st->decisions[player][up]++;
+    t = *g;
+    st->stand[player][up] += game_resolve(&t, shoe);
+    shoe->next = next;
+
+    t = *g;
+    st->hit[player][up] += play_out(&t, shoe);
+    shoe->next = next;
+}
+
+static void play_hand(Shoe *shoe, SimStats *st) {
+    Game g;
+
+    game_deal(&g, shoe);
+    while (g.phase == GAME_PLAYER) {
+        if (decision_ev)
+            evaluate(shoe, st, &g);
+        if (g.player_score >= hit_below)
+            break;
+        policy_hit(&g, shoe);
+    }
+    game_resolve(&g, shoe);
+
+    if (game_busted(g.player_score))
+        st->player_busts++;
+    else
+        st->dealer_busts += game_busted(g.dealer_score);
+
+    st->hands++;
+    st->net += g.result;
+    if (g.result > 0)
+        st->wins++;
+    else if (g.result < 0)
+        st->losses++;
+    else
+        st->draws++;
+}
+
+static void play_batch(Worker *w, uint32_t batch) {
+    long first = (long)batch * batch_hands;
+    long n = total_hands - first < batch_hands ? total_hands - first : batch_hands;
+
+    for (long i = 0; i < n; i++)
+        play_hand(&w->shoe, w->stats);
+}
+
+static void *sim_worker(void *arg) {
+    Worker  *w = arg;
+    uint32_t batch;
+
+    while (1) {
+        if (queue_take(&queues[w->id], &batch)) {
+            play_batch(w, batch);
+            continue;
+        }
+
+        int found = 0;
+        for (int i = 1; i < nworkers && !found; i++) {
+            if (queue_steal(&queues[(w->id + i) % nworkers], &batch)) {
+                w->stolen++;
+                play_batch(w, batch);
+                found = 1;
+            }
+        }
+        if (!found)
+            return NULL;    // nothing is ever added, so empty means done
+    }
+}
+
+static void merge(SimStats *dst, const SimStats *src) {
+    dst->hands += src->hands;
+    dst->wins += src->wins;
+    dst->draws += src->draws;
+    dst->losses += src->losses;
+    dst->player_busts += src->player_busts;
+    dst->dealer_busts += src->dealer_busts;
+    dst->net += src->net;
+    for (int p = 0; p <= MAX_SCORE; p++) {
+        for (int u = 0; u < UP_CARDS; u++) {
+            dst->decisions[p][u] += src->decisions[p][u];
+            dst->stand[p][u] += src->stand[p][u];
+            dst->hit[p][u] += src->hit[p][u];
+        }
+    }
+}
+
+static void print_table(const char *title, const SimStats *st, const int64_t table[][UP_CARDS]) {
+    printf("\n%s (rows: player score, columns: dealer up-card)\n", title);
+    printf("score");
+    for (int u = 2; u < UP_CARDS; u++)
+        printf(" %7d", u);
+    printf("\n");
+
+    for (int p = 0; p < MAX_SCORE; p++) {
+        int any = 0;
+        for (int u = 2; u < UP_CARDS; u++)
+            any |= st->decisions[p][u] != 0;
+        if (!any)
+            continue;
+
+        printf("%5d", p);
+        for (int u = 2; u < UP_CARDS; u++) {
+            if (st->decisions[p][u] == 0)
+                printf(" %7s", "-");
+            else
+                printf(" %+7.3f", (double)table[p][u] / st->decisions[p][u]);
+        }
+        printf("\n");
+    }
+}
+
+static void print_best(const SimStats *st) {
+    printf("\nbest move (H: hit, S: stand)\nscore");
+    for (int u = 2; u < UP_CARDS; u++)
+        printf(" %2d", u);
+    printf("\n");
+
+    for (int p = 0; p < MAX_SCORE; p++) {
+        int any = 0;
+        for (int u = 2; u < UP_CARDS; u++)
+            any |= st->decisions[p][u] != 0;
+        if (!any)
+            continue;
+
+        printf("%5d", p);
+        for (int u = 2; u < UP_CARDS; u++)
+            printf("  %c", st->decisions[p][u] == 0 ? '-' : st->hit[p][u] > st->stand[p][u] ? 'H' : 'S');
+        printf("\n");
+    }
+}
+
+static void usage(const char *pname) {
+    fprintf(stderr, "Usage: %s [-n hands] [-t threads] [-b hands per batch] [-D decks] [-C cut percent] [-H hit below] [-q]\n", pname);
+}
+
+int main(int argc, char *argv[]) {
+    int decks = SHOE_DEFAULT_DECKS;
+    int cut = SHOE_DEFAULT_CUT;
+    int opt;
+
+    total_hands = DEFAULT_HANDS;
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "n:t:b:D:C:H:q")) != -1) {
+        switch (opt) {
+        case 'n': total_hands = atol(optarg); break;
+        case 't': nworkers = atoi(optarg); break;
+        case 'b': batch_hands = atoi(optarg); break;
+        case 'D': decks = atoi(optarg); break;
+        case 'C': cut = atoi(optarg); break;
+        case 'H': hit_below = atoi(optarg); break;
+        case 'q': decision_ev = 0; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (total_hands < 1 || nworkers < 1 || batch_hands < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long batches = (total_hands + batch_hands - 1) / batch_hands;
+    if (batches > UINT32_MAX) {
+        fprintf(stderr, "Too many batches; raise -b\n");
+        return 1;
+    }
+
+    queues = aligned_alloc(64, nworkers * sizeof(WorkQueue));
+    workers = calloc(nworkers, sizeof(Worker));
+    if (queues == NULL || workers == NULL) {
+        perror("setup failed");
+        return 1;
+    }
+
+    // Batches are dealt out in contiguous runs; whoever finishes early
+    // steals from the front of someone else's run.
+    for (int i = 0; i < nworkers; i++) {
+        uint64_t lo = batches * i / nworkers, hi = batches * (i + 1) / nworkers;
+        queues[i].range = lo << 32 | hi;
+        workers[i].id = i;
+        workers[i].stats = aligned_alloc(64, sizeof(SimStats));
+        if (workers[i].stats == NULL) {
+            perror("setup failed");
+            return 1;
+        }
+        memset(workers[i].stats, 0, sizeof(SimStats));
+        shoe_init(&workers[i].shoe, decks, cut);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, sim_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to create worker thread\n");
+            return 1;
+        }
+    }
+    sim_worker(&workers[0]);
+
+    static SimStats total;
+    uint64_t stolen = workers[0].stolen;
+    merge(&total, workers[0].stats);
+    for (int i = 1; i < nworkers; i++) {
+        pthread_join(workers[i].tid, NULL);
+        merge(&total, workers[i].stats);
+        stolen += workers[i].stolen;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    double n = total.hands;
+    printf("%llu hands on %d threads in %.2fs (%.0f hands/sec, %llu of %ld batches stolen)\n",
+           (unsigned long long)total.hands, nworkers, elapsed, n / elapsed,
+           (unsigned long long)stolen, batches);
+    printf("rules: %d deck(s), cut at %d%%, player hits below %d\n", decks, cut, hit_below);
+    printf("house edge: %+.4f%%\n", -100.0 * total.net / n);
+    printf("outcomes: win %.4f%%, draw %.4f%%, loss %.4f%% (player bust %.4f%%, dealer bust %.4f%%)\n",
+           100 * total.wins / n, 100 * total.draws / n, 100 * total.losses / n,
+           100 * total.player_busts / n, 100 * total.dealer_busts / n);
+
+    if (decision_ev) {
+        print_table("EV of standing", &total, total.stand);
+        print_table("EV of hitting, then following the policy", &total, total.hit);
+        print_best(&total);
+    }
+    return 0;
+}
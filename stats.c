@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "stats.h"
+
+StatsRegion *stats;
+__thread StatsSlot *stat_slot;
+uint64_t stats_tick_mult = 1ull << 32;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Measures the TSC against CLOCK_MONOTONIC over 20 ms. Call once before
+// the first latency is recorded (and before forking).
+void stats_clock_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec pause = { 0, 20 * 1000000 };
+    uint64_t        ns = monotonic_ns(), ticks = stats_clock();
+
+    nanosleep(&pause, NULL);
+    ns = monotonic_ns() - ns;
+    ticks = stats_clock() - ticks;
+    if (ticks > 0)
+        stats_tick_mult = (uint64_t)(((unsigned __int128)ns << 32) / ticks);
+#endif
+}
+
+StatsSlot *stats_claim(void) {
+    pid_t tid = syscall(SYS_gettid);
+
+    for (int i = 1; i < STATS_SLOTS; i++) {
+        pid_t free_slot = 0;
+        if (__atomic_compare_exchange_n(&stats->slots[i].owner, &free_slot, tid, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return &stats->slots[i];
+    }
+    return &stats->slots[0];
+}
+
+// Hands the slot back when a thread or child is done. Its counts stay in
+// it; whoever claims it next keeps adding to them.
+void stats_release(void) {
+    if (stat_slot != NULL && stat_slot != &stats->slots[0])
+        __atomic_store_n(&stat_slot->owner, 0, __ATOMIC_RELEASE);
+    stat_slot = NULL;
+}
+
+// Frees whatever slot a child that has exited still held: one killed, or
+// crashed, before it could release it. Its sessions never closed, so they
+// are taken off first; nobody else writes a dead owner's slot. Safe in a
+// signal handler.
+void stats_reap(pid_t pid) {
+    for (int i = 1; i < STATS_SLOTS; i++) {
+        StatsSlot *slot = &stats->slots[i];
+
+        if (__atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE) != pid)
+            continue;
+        __atomic_store_n(&slot->counters.sessions, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void stats_total(const StatsRegion *region, ServerStats *total) {
+    uint64_t *dst = (uint64_t *)total;
+
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        const uint64_t *src = (const uint64_t *)&region->slots[i].counters;
+        for (size_t f = 0; f < sizeof(ServerStats) / sizeof(uint64_t); f++)
+            dst[f] += __atomic_load_n(&src[f], __ATOMIC_RELAXED);
+    }
+}
+
+void stats_latency_total(const StatsRegion *region, LatencyHist total[LAT_KINDS]) {
+    memset(total, 0, LAT_KINDS * sizeof(LatencyHist));
+    for (int i = 0; i < STATS_SLOTS; i++) {
+        for (int k = 0; k < LAT_KINDS; k++) {
+            const LatencyHist *h = &region->slots[i].latency[k];
+            for (int b = 0; b <= LATENCY_BUCKETS; b++)
+                total[k].buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            total[k].sum_ns += __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static size_t metric(char *buff, size_t size, size_t len, const char *name, const char *type,
+                     const char *help, uint64_t value) {
+    if (len >= size)
+        return len;
+    return len + snprintf(buff + len, size - len, "# HELP blackjack_%s %s\n# TYPE blackjack_%s %s\nblackjack_%s %llu\n",
+                          name, help, name, type, name, (unsigned long long)value);
+}
+
+// The Prometheus text exposition format: counters, gauges, and the latency
+// histograms with cumulative `le` buckets in seconds.
+size_t stats_format(const StatsRegion *region, char *buff, size_t size) {
+    static const char *kinds[LAT_KINDS] = { "name", "menu", "hit", "ace" };
+    ServerStats        t;
+    LatencyHist        lat[LAT_KINDS];
+    size_t             len = 0;
+
+    stats_total(region, &t);
+    stats_latency_total(region, lat);
+
+    len = metric(buff, size, len, "accepts_total", "counter", "Connections accepted.", t.accepts);
+    len = metric(buff, size, len, "rejected_total", "counter", "Connections refused because the server was full.", t.rejected);
+    len = metric(buff, size, len, "accept_errors_total", "counter", "Accepts failed for want of file descriptors or memory.", t.accept_errors);
+    len = metric(buff, size, len, "sessions", "gauge", "Sessions connected now.", t.sessions);
+    len = metric(buff, size, len, "hands_total", "counter", "Hands played.", t.hands);
+    len = metric(buff, size, len, "rounds_total", "counter", "Dealer hands played.", t.rounds);
+    len = metric(buff, size, len, "dealer_cards_total", "counter", "Cards drawn by the dealer.", t.dealer_cards);
+    if (len < size)
+        len += snprintf(buff + len, size - len,
+                        "# HELP blackjack_outcomes_total Hands by the player's outcome.\n"
+                        "# TYPE blackjack_outcomes_total counter\n"
+                        "blackjack_outcomes_total{outcome=\"win\"} %llu\n"
+                        "blackjack_outcomes_total{outcome=\"draw\"} %llu\n"
+                        "blackjack_outcomes_total{outcome=\"loss\"} %llu\n",
+                        (unsigned long long)t.wins, (unsigned long long)t.draws, (unsigned long long)t.losses);
+    len = metric(buff, size, len, "messages_total", "counter", "Protocol messages queued for sending.", t.messages);
+    len = metric(buff, size, len, "send_calls_total", "counter", "send() and writev() system calls.", t.send_calls);
+    len = metric(buff, size, len, "send_bytes_total", "counter", "Bytes sent.", t.send_bytes);
+    len = metric(buff, size, len, "recv_calls_total", "counter", "recv() system calls that returned data.", t.recv_calls);
+    len = metric(buff, size, len, "recv_bytes_total", "counter", "Bytes received.", t.recv_bytes);
+    len = metric(buff, size, len, "lobby_joins_total", "counter", "Players who joined a lobby.", t.lobby_joins);
+    len = metric(buff, size, len, "lobby_full_total", "counter", "Players turned away by a full lobby.", t.lobby_full);
+    len = metric(buff, size, len, "lobby_wait_ms_total", "counter", "Milliseconds waited in lobbies.", t.lobby_wait_ms);
+    len = metric(buff, size, len, "log_records_total", "counter", "Log records written.", t.log_records);
+    len = metric(buff, size, len, "log_dropped_total", "counter", "Log records dropped because the log ring was full.", t.log_dropped);
+    len = metric(buff, size, len, "hands_recorded_total", "counter", "Hands written to the hand record.", t.hands_recorded);
+    len = metric(buff, size, len, "record_dropped_total", "counter", "Hands left out of the hand record.", t.record_dropped);
+    len = metric(buff, size, len, "record_bytes_total", "counter", "Bytes written to the hand record.", t.record_bytes);
+    len = metric(buff, size, len, "shard_handoffs_total", "counter", "Results queued to the core owning the player.", t.shard_handoffs);
+    len = metric(buff, size, len, "shard_batches_total", "counter", "Batches of queued results applied to the ranking store.", t.shard_batches);
+    len = metric(buff, size, len, "shard_spills_total", "counter", "Results applied directly because their shard queue was full.", t.shard_spills);
+    len = metric(buff, size, len, "hints_total", "counter", "Hints served to players.", t.hints);
+    len = metric(buff, size, len, "resumes_total", "counter", "Sessions resumed with a token after a dropped connection.", t.resumes);
+    len = metric(buff, size, len, "resume_misses_total", "counter", "Resume tokens refused as unknown or expired.", t.resume_misses);
+    len = metric(buff, size, len, "resume_expired_total", "counter", "Dropped sessions whose grace period ran out.", t.resume_expired);
+    len = metric(buff, size, len, "wait_calls_total", "counter", "epoll_wait(), io_uring_enter() and poll() system calls.", t.wait_calls);
+    len = metric(buff, size, len, "ctl_calls_total", "counter", "epoll_ctl() system calls.", t.ctl_calls);
+    len = metric(buff, size, len, "uring_ops_total", "counter", "Operations submitted through io_uring.", t.uring_ops);
+    len = metric(buff, size, len, "timers_armed_total", "counter", "Deadlines set on the timer wheels.", t.timers_armed);
+    len = metric(buff, size, len, "timers_fired_total", "counter", "Timer wheel deadlines that expired.", t.timers_fired);
+    if (len < size)
+        len += snprintf(buff + len, size - len,
+                        "# HELP blackjack_timeouts_total Prompts left unanswered past their deadline.\n"
+                        "# TYPE blackjack_timeouts_total counter\n"
+                        "blackjack_timeouts_total{prompt=\"name\"} %llu\n"
+                        "blackjack_timeouts_total{prompt=\"menu\"} %llu\n"
+                        "blackjack_timeouts_total{prompt=\"hit\"} %llu\n"
+                        "blackjack_timeouts_total{prompt=\"ace\"} %llu\n",
+                        (unsigned long long)t.timeouts_name, (unsigned long long)t.timeouts_menu,
+                        (unsigned long long)t.timeouts_hit, (unsigned long long)t.timeouts_ace);
+
+    for (int k = 0; k < LAT_KINDS && len < size; k++) {
+        const char *name = k == LAT_PERSIST ? "persist_seconds" : "response_seconds";
+        char        label[32] = "", series[32] = "";
+        uint64_t    count = 0;
+
+        if (k != LAT_PERSIST) {
+            snprintf(label, sizeof(label), "prompt=\"%s\",", kinds[k]);
+            snprintf(series, sizeof(series), "{prompt=\"%s\"}", kinds[k]);
+        }
+        if (k == LAT_NAME || k == LAT_PERSIST)
+            len += snprintf(buff + len, size - len, "# HELP blackjack_%s %s\n# TYPE blackjack_%s histogram\n", name,
+                            k == LAT_PERSIST ? "Time to record one result in the ranking store."
+                                             : "Time from a prompt's answer arriving to the reply being sent.", name);
+
+        for (int b = 0; b < LATENCY_BUCKETS && len < size; b++) {
+            count += lat[k].buckets[b];
+            len += snprintf(buff + len, size - len, "blackjack_%s_bucket{%sle=\"%g\"} %llu\n",
+                            name, label, (double)(1ull << b) / 1e6, (unsigned long long)count);
+        }
+        count += lat[k].buckets[LATENCY_BUCKETS];
+        if (len < size)
+            len += snprintf(buff + len, size - len,
+                            "blackjack_%s_bucket{%sle=\"+Inf\"} %llu\nblackjack_%s_sum%s %.9f\nblackjack_%s_count%s %llu\n",
+                            name, label, (unsigned long long)count, name, series, lat[k].sum_ns / 1e9,
+                            name, series, (unsigned long long)count);
+    }
+    return len < size ? len : size;
+}
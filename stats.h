@@ -0,0 +1,154 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define STATS_SHM_NAME "/blackjackd-stats.%d"     // one per TCP port
+#define STATS_SOCKET "/tmp/blackjackd-stats.%d.sock"
+#define STATS_SLOTS 128        // a worker per core on 64 cores, and the helper threads
+#define LATENCY_BUCKETS 24      // upper bounds 1us, 2us, 4us ... 2^23us (~8s)
+
+// Server-wide counters. Forked children add to the same totals, and tools
+// such as bench_blackjack read them by port without having to talk to the
+// server. Every field is a uint64_t so slots can be summed field by field.
+typedef struct {
+    uint64_t accepts;
+    uint64_t hands;
+    uint64_t wins;          // the players' outcomes
+    uint64_t draws;
+    uint64_t losses;
+    uint64_t rounds;        // dealer hands played: one per hand, or per table round
+    uint64_t dealer_cards;
+    uint64_t messages;      // protocol messages queued for sending
+    uint64_t send_calls;    // send()/writev() system calls
+    uint64_t send_bytes;
+    uint64_t recv_calls;
+    uint64_t recv_bytes;
+    uint64_t sessions;      // connected now; a slot's share may wrap below 0
+    uint64_t rejected;      // turned away at accept: the server was full
+    uint64_t accept_errors; // accept() out of descriptors or memory; accepting paused
+    uint64_t lobby_joins;
+    uint64_t lobby_full;    // turned away: the lobby queue was full
+    uint64_t lobby_wait_ms; // summed over the players seated from the lobby
+    uint64_t log_records;   // written by the logger thread
+    uint64_t log_dropped;   // lost because the log ring was full
+    uint64_t hands_recorded;    // written by the hand recorder (record.h)
+    uint64_t record_dropped;    // lost because its ring was full or no file could be written
+    uint64_t record_bytes;
+    uint64_t shard_handoffs;    // core mode: results queued to another core's shard
+    uint64_t shard_batches;     // ranking lock acquisitions applying queued results
+    uint64_t shard_spills;      // results applied by their own core: the queue was full
+    uint64_t hints;             // hint prompts answered from the EV table
+    uint64_t resumes;           // sessions resumed with a token
+    uint64_t resume_misses;     // tokens that were unknown or past their grace period
+    uint64_t resume_expired;    // parked sessions nobody came back for
+    uint64_t timers_armed;      // deadlines set on the epoll workers' timer wheels
+    uint64_t timers_fired;
+    uint64_t timeouts_name;     // prompts left unanswered past their deadline
+    uint64_t timeouts_menu;     // ... including rankings the client would not take
+    uint64_t timeouts_hit;      // ... including decisions at a table
+    uint64_t timeouts_ace;
+    uint64_t wait_calls;        // epoll_wait(), io_uring_enter() and fork mode's poll() system calls
+    uint64_t ctl_calls;         // epoll_ctl() system calls
+    uint64_t uring_ops;         // accepts, recvs, sends and cancels submitted through io_uring
+} ServerStats;
+
+typedef enum {
+    LAT_NAME,               // from a prompt's answer arriving to the reply sent
+    LAT_MENU,
+    LAT_HIT,
+    LAT_ACE,
+    LAT_PERSIST,            // recording one result in the ranking store
+    LAT_KINDS
+} LatencyKind;
+
+// Log2 buckets in microseconds; the last one catches everything slower.
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS + 1];
+    uint64_t sum_ns;
+} LatencyHist;
+
+// One writer's share of the numbers, on cache lines of its own. Every
+// thread (and every forked child) claims a slot the first time it counts,
+// so the hot path never shares a line with another core and needs no
+// locked instruction: the single writer adds with a plain load and store,
+// and readers sum the slots. Slot 0 is never claimed; it takes the overflow
+// once all the others are in use, and only there do updates use atomic adds.
+// A slot records its claimant's thread id, which for a forked child's main
+// thread is its pid, so the parent can free the slot of a child that died
+// without releasing it.
+typedef struct {
+    _Alignas(64) ServerStats counters;
+    LatencyHist latency[LAT_KINDS];
+    pid_t       owner;      // 0: free
+} StatsSlot;
+
+typedef struct {
+    StatsSlot slots[STATS_SLOTS];
+} StatsRegion;
+
+extern StatsRegion *stats;
+extern __thread StatsSlot *stat_slot;
+extern uint64_t stats_tick_mult;    // ns per stats_clock() tick, 32.32 fixed point
+
+void stats_clock_init(void);
+StatsSlot *stats_claim(void);
+void stats_release(void);
+void stats_reap(pid_t pid);
+void stats_total(const StatsRegion *region, ServerStats *total);
+void stats_latency_total(const StatsRegion *region, LatencyHist total[LAT_KINDS]);
+size_t stats_format(const StatsRegion *region, char *buff, size_t size);
+
+static inline StatsSlot *stats_slot(void) {
+    if (__builtin_expect(stat_slot == NULL, 0))
+        stat_slot = stats_claim();
+    return stat_slot;
+}
+
+static inline void stat_add(StatsSlot *slot, uint64_t *field, uint64_t n) {
+    if (__builtin_expect(slot == &stats->slots[0], 0))
+        __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void stat_count(size_t offset, uint64_t n) {
+    StatsSlot *slot = stats_slot();
+    stat_add(slot, (uint64_t *)((char *)&slot->counters + offset), n);
+}
+
+#define STAT_ADD(field, n) stat_count(offsetof(ServerStats, field), (n))
+
+// A timestamp for latencies: the TSC where there is one (a few ns, against
+// tens for clock_gettime()), otherwise CLOCK_MONOTONIC in ns.
+static inline uint64_t stats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Records a duration of `ticks` (a difference of two stats_clock() values).
+static inline void stat_latency(LatencyKind kind, uint64_t ticks) {
+    uint64_t     ns = (uint64_t)(((unsigned __int128)ticks * stats_tick_mult) >> 32);
+    uint64_t     us = ns / 1000;
+    int          b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    StatsSlot   *slot = stats_slot();
+    LatencyHist *h = &slot->latency[kind];
+
+    if (b > LATENCY_BUCKETS)
+        b = LATENCY_BUCKETS;
+    stat_add(slot, &h->buckets[b], 1);
+    stat_add(slot, &h->sum_ns, ns);
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <stddef.h>
+#include "timer.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN(level) (1ull << (WHEEL_BITS * (level)))     // ticks one slot of the level above covers
+
+_Static_assert(WHEEL_SLOTS == 64, "a level's occupancy is one uint64_t");
+
+static void list_init(Timer *head) {
+    head->next = head->prev = head;
+}
+
+static void list_add(Timer *head, Timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+void wheel_init(TimerWheel *w, uint64_t now) {
+    w->now = now;
+    w->armed = 0;
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+        w->occupied[l] = 0;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++)
+        list_init(&w->slots[i]);
+    list_init(&w->due);
+}
+
+// Links the timer into the slot its deadline falls in, seen from the
+// current tick: the finest level whose span still reaches it. A deadline
+// past the top level waits in that level's furthest slot and is placed
+// again when it cascades.
+static void place(TimerWheel *w, Timer *t) {
+    uint64_t at = t->expires, delta;
+    int      level = 0, index;
+
+    if (at <= w->now) {
+        t->slot = TIMER_DUE;
+        list_add(&w->due, t);
+        return;
+    }
+
+    delta = at - w->now;
+    while (level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level + 1))
+        level++;
+    if (delta >= WHEEL_SPAN(WHEEL_LEVELS))
+        at = w->now + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+
+    index = (at >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    t->slot = level * WHEEL_SLOTS + index;
+    list_add(&w->slots[t->slot], t);
+    w->occupied[level] |= 1ull << index;
+}
+
+void timer_arm(TimerWheel *w, Timer *t, uint64_t expires) {
+    timer_cancel(w, t);
+    t->expires = expires;
+    place(w, t);
+    w->armed++;
+}
+
+void timer_cancel(TimerWheel *w, Timer *t) {
+    Timer *head;
+
+    if (!timer_armed(t))
+        return;
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    w->armed--;
+    if (t->slot == TIMER_DUE)
+        return;
+    head = &w->slots[t->slot];
+    if (head->next == head)
+        w->occupied[t->slot / WHEEL_SLOTS] &= ~(1ull << (t->slot & WHEEL_MASK));
+}
+
+// Empties a slot of a coarser level into the finer ones: every timer in it
+// is due before the level below wraps around again.
+static void cascade(TimerWheel *w, int level, int index) {
+    Timer *head = &w->slots[level * WHEEL_SLOTS + index], *t, *next;
+
+    w->occupied[level] &= ~(1ull << index);
+    t = head->next;
+    list_init(head);
+    for (; t != head; t = next) {
+        next = t->next;
+        place(w, t);
+    }
+}
+
+// Runs one tick: the levels that wrapped cascade, coarsest first, and
+// level 0's slot for the tick joins the due list whole, its timers marked
+// so a cancel leaves the slot's occupancy alone.
+static void tick(TimerWheel *w) {
+    uint64_t now = ++w->now;
+    int      top = 0, index = now & WHEEL_MASK;
+    Timer   *head = &w->slots[index];
+
+    while (top < WHEEL_LEVELS - 1 && (now & (WHEEL_SPAN(top + 1) - 1)) == 0)
+        top++;
+    for (int l = top; l > 0; l--)
+        cascade(w, l, (now >> (WHEEL_BITS * l)) & WHEEL_MASK);
+
+    if (head->next != head) {
+        for (Timer *t = head->next; t != head; t = t->next)
+            t->slot = TIMER_DUE;
+        head->next->prev = w->due.prev;
+        w->due.prev->next = head->next;
+        head->prev->next = &w->due;
+        w->due.prev = head->prev;
+        list_init(head);
+        w->occupied[0] &= ~(1ull << index);
+    }
+}
+
+// The earliest tick at which a timer can be due: the next occupied slot of
+// level 0, or the next cascade if a coarser level holds anything, since
+// those timers are all beyond it. UINT64_MAX when nothing is armed.
+uint64_t wheel_next(const TimerWheel *w) {
+    uint64_t next = UINT64_MAX;
+
+    if (w->due.next != &w->due)
+        return w->now;
+    if (w->occupied[0] != 0) {
+        unsigned from = (w->now + 1) & WHEEL_MASK;
+        uint64_t bits = w->occupied[0] >> from | (from != 0 ? w->occupied[0] << (64 - from) : 0);
+        next = w->now + 1 + __builtin_ctzll(bits);
+    }
+    for (int l = 1; l < WHEEL_LEVELS; l++) {
+        if (w->occupied[l] != 0) {
+            uint64_t wrap = (w->now | WHEEL_MASK) + 1;
+            if (wrap < next)
+                next = wrap;
+            break;
+        }
+    }
+    return next;
+}
+
+// Moves the wheel on to tick `now` and hands out one timer that is due,
+// disarmed, or NULL once there are none. Stretches with nothing due are
+// skipped rather than ticked through.
+Timer *wheel_expire(TimerWheel *w, uint64_t now) {
+    Timer *t;
+
+    while (w->due.next == &w->due) {
+        uint64_t next = wheel_next(w);
+        if (next > now) {
+            if (now > w->now)
+                w->now = now;
+            return NULL;
+        }
+        w->now = next - 1;
+        tick(w);
+    }
+
+    t = w->due.next;
+    t->next->prev = &w->due;
+    w->due.next = t->next;
+    t->next = t->prev = NULL;
+    w->armed--;
+    return t;
+}
@@ -0,0 +1,50 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4          // 64^4 ticks: 46 hours at 10 ms
+#define TIMER_DUE UINT16_MAX    // the slot of a timer on the due list
+
+// A hierarchical timing wheel. Level 0 has a slot per tick for the next 64
+// ticks, level 1 a slot per 64 ticks for the next 4096, and so on up. A
+// timer goes into the slot of the coarsest level its deadline is within,
+// and moves down a level each time the level below wraps around to it
+// (cascading), until it reaches level 0 and expires with its tick.
+//
+// Timers are intrusive: they live in the object they time, linked into
+// their slot's list, so arming and cancelling are a few pointer writes and
+// a bit in the level's occupancy mask, whatever the number armed. The
+// masks give the next tick that can hold an expiry in O(1) too, so an idle
+// wheel is not ticked through tick by tick.
+//
+// Nothing is locked: a wheel belongs to one thread.
+typedef struct Timer Timer;
+struct Timer {
+    Timer          *next, *prev;    // NULL when not armed
+    uint64_t        expires;        // tick
+    uint16_t        slot;           // level * WHEEL_SLOTS + index, or TIMER_DUE
+    uint16_t        kind;           // the owner's, to tell its timers apart
+};
+
+typedef struct {
+    uint64_t        now;            // the last tick run
+    uint64_t        armed;
+    uint64_t        occupied[WHEEL_LEVELS];
+    Timer           slots[WHEEL_LEVELS * WHEEL_SLOTS];  // list heads
+    Timer           due;            // expired, not yet handed out
+} TimerWheel;
+
+void wheel_init(TimerWheel *w, uint64_t now);
+void timer_arm(TimerWheel *w, Timer *t, uint64_t expires);
+void timer_cancel(TimerWheel *w, Timer *t);
+uint64_t wheel_next(const TimerWheel *w);
+Timer *wheel_expire(TimerWheel *w, uint64_t now);
+
+static inline int timer_armed(const Timer *t) {
+    return t->next != NULL;
+}
+
+#endif
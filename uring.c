@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t size) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned n) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+// Sets up a ring of `entries` submissions (and four times the
+// completions, as multishot requests post many per submission) and
+// registers buf_count buffers of buf_size bytes for received data. Fails
+// with errno set on a kernel without what the server uses: multishot
+// accept and recv, provided buffer rings, and timed waits.
+int uring_init(Uring *r, unsigned entries, unsigned buf_count, unsigned buf_size) {
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    size_t sq_size, cq_size, ring_bytes;
+    char  *rings;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    // Completions only when the loop asks for them, from the thread that
+    // submits: no interrupts of the loop to post them. Older kernels take
+    // the plain flags.
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = entries * 4;
+    if ((r->fd = sys_setup(entries, &p)) < 0) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        if ((r->fd = sys_setup(entries, &p)) < 0)
+            return -1;
+    }
+    r->features = p.features;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto fail;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    r->rings = mmap(NULL, r->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->rings == MAP_FAILED) {
+        r->rings = NULL;
+        goto fail;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    rings = r->rings;
+    r->sq_head = (unsigned *)(rings + p.sq_off.head);
+    r->sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(rings + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(rings + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = r->submitted = *r->sq_tail;
+    r->cq_head = (unsigned *)(rings + p.cq_off.head);
+    r->cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(rings + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+
+    // The buffer ring and the buffers it hands out, in one mapping.
+    r->buf_count = buf_count;
+    r->buf_size = buf_size;
+    ring_bytes = buf_count * sizeof(struct io_uring_buf);
+    r->buf_ring = mmap(NULL, ring_bytes + (size_t)buf_count * buf_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->buf_ring == MAP_FAILED) {
+        r->buf_ring = NULL;
+        goto fail;
+    }
+    r->buffers = (char *)r->buf_ring + ring_bytes;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)r->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = 0;
+    if (sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto fail;
+    for (unsigned bid = 0; bid < buf_count; bid++)
+        uring_buffer_return(r, bid);
+    return 0;
+
+fail:
+    uring_exit(r);
+    return -1;
+}
+
+void uring_exit(Uring *r) {
+    int saved = errno;
+
+    if (r->buf_ring != NULL)
+        munmap(r->buf_ring, r->buf_count * (sizeof(struct io_uring_buf) + r->buf_size));
+    if (r->sqes != NULL)
+        munmap(r->sqes, r->sqes_size);
+    if (r->rings != NULL)
+        munmap(r->rings, r->rings_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    errno = saved;
+}
+
+// A cleared submission entry to fill in, or NULL if the queue is full
+// until the next enter.
+struct io_uring_sqe *uring_sqe(Uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (r->sqe_tail - head >= r->sq_entries)
+        return NULL;
+    sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    r->sq_array[r->sqe_tail & *r->sq_mask] = r->sqe_tail & *r->sq_mask;
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Submits everything queued and, with `wait`, sleeps until that many
+// completions are in or timeout_ms has passed (-1: no limit), all in one
+// system call.
+int uring_enter(Uring *r, unsigned wait, int timeout_ms) {
+    struct __kernel_timespec        ts;
+    struct io_uring_getevents_arg   arg;
+    unsigned                        submit = uring_pending(r), flags = 0;
+    int                             rc;
+
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    memset(&arg, 0, sizeof(arg));
+    if (wait > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            arg.ts = (uintptr_t)&ts;
+        }
+    }
+
+    rc = sys_enter(r->fd, submit, wait, flags, wait > 0 ? &arg : NULL, wait > 0 ? sizeof(arg) : 0);
+    if (rc >= 0)
+        r->submitted += rc;
+    else if (errno == ETIME || errno == EINTR)
+        rc = 0;
+    return rc;
+}
+
+// Puts a buffer back on the ring for the kernel to fill again.
+void uring_buffer_return(Uring *r, unsigned bid) {
+    struct io_uring_buf *buf = &r->buf_ring->bufs[r->buf_tail & (r->buf_count - 1)];
+
+    buf->addr = (uintptr_t)uring_buffer(r, bid);
+    buf->len = r->buf_size - 1;     // room to terminate text input
+    buf->bid = bid;
+    r->buf_tail++;
+    __atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
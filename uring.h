@@ -0,0 +1,63 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring: the rings mapped from io_uring_setup() and driven
+// with io_uring_enter() directly, so the server needs no liburing. One
+// thread owns a ring; nothing is locked.
+//
+// Received data lands in provided buffers: a ring of buffers registered
+// with the kernel (group 0), from which a multishot recv picks one per
+// completion. The buffer goes back on the ring once its data is handled,
+// so the memory for input is fixed however many sessions are connected.
+typedef struct {
+    int                  fd;
+    unsigned             features;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned             sq_entries;
+    unsigned             sqe_tail;      // SQEs handed out, published by the next enter
+    unsigned             submitted;     // ... published so far
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *rings;
+    size_t               rings_size;
+    size_t               sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    char                *buffers;
+    unsigned             buf_count;     // a power of two
+    unsigned             buf_size;
+    uint16_t             buf_tail;
+} Uring;
+
+int uring_init(Uring *r, unsigned entries, unsigned buf_count, unsigned buf_size);
+void uring_exit(Uring *r);
+struct io_uring_sqe *uring_sqe(Uring *r);
+int uring_enter(Uring *r, unsigned wait, int timeout_ms);
+void uring_buffer_return(Uring *r, unsigned bid);
+
+static inline unsigned uring_pending(const Uring *r) {
+    return r->sqe_tail - r->submitted;
+}
+
+// The next completion, or NULL; uring_cqe_seen() consumes it.
+static inline struct io_uring_cqe *uring_cqe(Uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cqe_seen(Uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline char *uring_buffer(const Uring *r, unsigned bid) {
+    return r->buffers + (size_t)bid * r->buf_size;
+}
+
+#endif